@@ -0,0 +1,179 @@
+#include "sys.h"
+#include "AmplitudePlanes.h"
+#include "debug.h"
+#include <algorithm>
+
+namespace quantum {
+
+AmplitudePlanes::AmplitudePlanes(std::vector<QuBitField> const& coefficients) :
+  m_size(coefficients.size()), m_non_zero_planes(non_zero_planes(coefficients))
+{
+  for (int p = 0; p < number_of_planes; ++p)
+  {
+    if (!(m_non_zero_planes & (1U << p)))
+      continue;
+    m_plane[p].reserve(m_size);
+    for (auto const& coefficient : coefficients)
+      m_plane[p].push_back(coefficient.m_sum[p]);
+  }
+}
+
+//static
+unsigned int AmplitudePlanes::non_zero_planes(std::vector<QuBitField> const& coefficients)
+{
+  unsigned int const all_planes = (1U << number_of_planes) - 1;
+  unsigned int result = 0;
+  for (auto const& coefficient : coefficients)
+  {
+    for (int p = 0; p < number_of_planes; ++p)
+      if (coefficient.m_sum[p] != 0)
+        result |= 1U << p;
+    if (result == all_planes)
+      break;
+  }
+  return result;
+}
+
+//static
+int AmplitudePlanes::count(unsigned int planes)
+{
+  int result = 0;
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((planes & (1U << p)))
+      ++result;
+  return result;
+}
+
+QuBitField AmplitudePlanes::operator[](std::size_t i) const
+{
+  QuBitField result;
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((m_non_zero_planes & (1U << p)))
+      result.m_sum[p] = m_plane[p][i];
+  return result;
+}
+
+bool AmplitudePlanes::is_zero(std::size_t i) const
+{
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((m_non_zero_planes & (1U << p)) && m_plane[p][i] != 0)
+      return false;
+  return true;
+}
+
+std::vector<QuBitField> AmplitudePlanes::expand() const
+{
+  std::vector<QuBitField> result(m_size);
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((m_non_zero_planes & (1U << p)))
+      for (std::size_t i = 0; i < m_size; ++i)
+        result[i].m_sum[p] = m_plane[p][i];
+  return result;
+}
+
+void AmplitudePlanes::add_terms(std::vector<Output>& outputs, QuBitField const& entry, int row, int col) const
+{
+  if (entry.is_zero())
+    return;
+  for (int q = 0; q < number_of_planes; ++q)
+  {
+    if (!(m_non_zero_planes & (1U << q)))
+      continue; // Input plane q is zero.
+    // The entry times a coefficient that only has component q (equal to one).
+    QuBitField unit;
+    unit.m_sum[q] = 1;
+    QuBitField const product = entry * unit;
+    for (int p = 0; p < number_of_planes; ++p)
+    {
+      Rational const& factor = product.m_sum[p];
+      if (factor == 0)
+        continue;
+      auto output = std::find_if(outputs.begin(), outputs.end(), [=](Output const& output){ return output.m_row == row && output.m_plane == p; });
+      if (output == outputs.end())
+        output = outputs.insert(output, Output{row, p, {}});
+      output->m_terms.push_back(Term{col * number_of_planes + q, factor == 1 ? 1 : factor == -1 ? -1 : 0, factor});
+    }
+  }
+}
+
+void AmplitudePlanes::apply(std::vector<Output> const& outputs_with_terms, int number_of_rows, std::vector<unsigned long> const& masks)
+{
+  // The planes of the result.
+  unsigned int new_non_zero_planes = 0;
+  for (auto const& output : outputs_with_terms)
+    new_non_zero_planes |= 1U << output.m_plane;
+
+  // Every row must be written in each of those planes; also where there is nothing to add up.
+  std::vector<Output> outputs(outputs_with_terms);
+  for (int row = 0; row < number_of_rows; ++row)
+    for (int p = 0; p < number_of_planes; ++p)
+      if ((new_non_zero_planes & (1U << p)) &&
+          std::none_of(outputs.begin(), outputs.end(), [=](Output const& output){ return output.m_row == row && output.m_plane == p; }))
+        outputs.push_back(Output{row, p, {}});
+
+  // The offset of each row of the gate (relative to the first row of its group of coefficients), and the mask with all used bits.
+  std::vector<unsigned long> offset(number_of_rows, 0);
+  for (int row = 0; row < number_of_rows; ++row)
+    for (std::size_t j = 0; j < masks.size(); ++j)
+      if ((row & (1 << j)))
+        offset[row] |= masks[j];
+  unsigned long const used_mask = offset[number_of_rows - 1];
+
+  // The inputs that are used by at least one term.
+  std::vector<char> is_input(number_of_rows * number_of_planes, false);
+  for (auto const& output : outputs)
+    for (auto const& term : output.m_terms)
+      is_input[term.m_input] = true;
+  std::vector<int> inputs;
+  for (std::size_t input = 0; input < is_input.size(); ++input)
+    if (is_input[input])
+      inputs.push_back(input);
+
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((new_non_zero_planes & ~m_non_zero_planes & (1U << p)))
+      m_plane[p].assign(m_size, Rational{});
+
+  std::vector<Rational> gathered(number_of_rows * number_of_planes);
+  for (unsigned long i = 0; i < m_size; i = ((i | used_mask) + 1) & ~used_mask)
+  {
+    for (int input : inputs)
+      gathered[input] = m_plane[input % number_of_planes][i | offset[input / number_of_planes]];
+    for (auto const& output : outputs)
+    {
+      Rational& result = m_plane[output.m_plane][i | offset[output.m_row]];
+      if (output.m_terms.empty())
+      {
+        result = Rational{};
+        continue;
+      }
+      bool first = true;
+      for (auto const& term : output.m_terms)
+      {
+        Rational const& x = gathered[term.m_input];
+        if (first)
+        {
+          if (term.m_sign == 1)
+            result = x;
+          else if (term.m_sign == -1)
+            result = -x;
+          else
+            result = term.m_factor * x;
+        }
+        else if (term.m_sign == 1)
+          result += x;
+        else if (term.m_sign == -1)
+          result -= x;
+        else
+          result += term.m_factor * x;
+        first = false;
+      }
+    }
+  }
+
+  for (int p = 0; p < number_of_planes; ++p)
+    if ((m_non_zero_planes & ~new_non_zero_planes & (1U << p)))
+      m_plane[p] = std::vector<Rational>();
+  m_non_zero_planes = new_non_zero_planes;
+}
+
+} // namespace quantum
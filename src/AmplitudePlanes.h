@@ -0,0 +1,111 @@
+#pragma once
+
+#include "QuBitField.h"
+#include <array>
+#include <utility>
+#include <vector>
+
+namespace quantum {
+
+// The coefficients of an EntangledState, stored as four separate planes of Rationals:
+// one for each component k, l, m and n of the QuBitField k + l·i + (m + n·i)·√½.
+//
+// A plane that is identically zero is not stored at all (the vector is empty) and
+// is skipped by the kernels. States of circuits that stay in a subfield, like the
+// real states of H, X, Z and CX circuits, therefore only ever touch one or two planes.
+//
+// Gates are applied component-wise: multiplying with a gate entry is a ℚ-linear map
+// on (k, l, m, n), so every component of the result is a short sum of input components
+// times a rational factor; factors ±1 are added or subtracted without multiplying.
+class AmplitudePlanes
+{
+ public:
+  static constexpr int number_of_planes = 4;    // Indexed by QuBitField::nr_, ni_, rr_ and ri_.
+
+ private:
+  std::size_t m_size;                                           // The number of coefficients.
+  std::array<std::vector<Rational>, number_of_planes> m_plane;  // m_plane[p][i] is component p of coefficient i.
+  unsigned int m_non_zero_planes;                               // Bit p is set iff m_plane[p] is stored. Unstored planes are zero.
+
+  // One term of a component of a coefficient of the result: m_factor times a component of one of the inputs.
+  struct Term
+  {
+    int m_input;                // The index into the gathered inputs (col * number_of_planes + input_plane).
+    int m_sign;                 // 1 or -1 if m_factor is 1 or -1 respectively, otherwise 0.
+    Rational m_factor;
+  };
+
+  struct Output
+  {
+    int m_row;                  // The row of the gate.
+    int m_plane;                // The plane of the result.
+    std::vector<Term> m_terms;  // The result is the sum of these terms (zero if there are none).
+  };
+
+  // Build the terms of the entry of a gate at (row, col).
+  void add_terms(std::vector<Output>& outputs, QuBitField const& entry, int row, int col) const;
+  // Apply the outputs to every group of coefficients whose indices only differ in the bits of masks.
+  void apply(std::vector<Output> const& outputs, int number_of_rows, std::vector<unsigned long> const& masks);
+
+ public:
+  // Construct the planes from the coefficients in AoS layout.
+  explicit AmplitudePlanes(std::vector<QuBitField> const& coefficients);
+
+  // Return a bit mask of the components that are non-zero in at least one of coefficients.
+  static unsigned int non_zero_planes(std::vector<QuBitField> const& coefficients);
+
+  // Return the number of coefficients.
+  std::size_t size() const { return m_size; }
+  // Return a bit mask of the planes that are stored.
+  unsigned int non_zero_planes() const { return m_non_zero_planes; }
+  // Return the number of planes that are stored.
+  int number_of_non_zero_planes() const { return count(m_non_zero_planes); }
+  // Return the number of bits set in the bit mask planes.
+  static int count(unsigned int planes);
+
+  // Return coefficient i.
+  QuBitField operator[](std::size_t i) const;
+  // Return true if coefficient i is zero.
+  bool is_zero(std::size_t i) const;
+  // Exchange coefficients i and j.
+  void swap_coefficients(std::size_t i, std::size_t j)
+  {
+    for (int p = 0; p < number_of_planes; ++p)
+      if ((m_non_zero_planes & (1U << p)))
+        std::swap(m_plane[p][i], m_plane[p][j]);
+  }
+
+  // Replace every coefficient c by op(c).
+  template<typename Op>
+  void transform(Op op);
+
+  // Return all coefficients in AoS layout.
+  std::vector<QuBitField> expand() const;
+
+  // Apply matrix to every group of coefficients whose indices only differ in the bits of masks;
+  // masks[j] is the rowbit mask of input j of the gate.
+  template<typename Matrix>
+  void apply(Matrix const& matrix, std::vector<unsigned long> const& masks);
+};
+
+template<typename Op>
+void AmplitudePlanes::transform(Op op)
+{
+  std::vector<QuBitField> coefficients = expand();
+  for (auto& coefficient : coefficients)
+    coefficient = op(coefficient);
+  *this = AmplitudePlanes(coefficients);
+}
+
+template<typename Matrix>
+void AmplitudePlanes::apply(Matrix const& matrix, std::vector<unsigned long> const& masks)
+{
+  int const size = matrix.rows();
+  std::vector<Output> outputs;
+  for (int row = 0; row < size; ++row)
+    for (int col = 0; col < size; ++col)
+      add_terms(outputs, matrix(row, col), row, col);
+  apply(outputs, size, masks);
+}
+
+} // namespace quantum
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <vector>
+
+namespace quantum {
+
+// Return the index i0 of the pair with number pair: pair with a zero bit inserted at rowbit_mask.
+inline unsigned long butterfly_pair(unsigned long pair, unsigned long rowbit_mask)
+{
+  return ((pair & ~(rowbit_mask - 1)) << 1) | (pair & (rowbit_mask - 1));
+}
+
+// Call f(i0) for every pair with a number in [begin, end), where i0 is the index of its first coefficient.
+template<typename F>
+void for_each_butterfly_pair(unsigned long begin, unsigned long end, unsigned long rowbit_mask, F f)
+{
+  // Run over all pairs of a block without having to test which bit is set.
+  for (unsigned long pair = begin; pair < end;)
+  {
+    unsigned long const i0 = butterfly_pair(pair, rowbit_mask);
+    unsigned long const n = std::min(end - pair, rowbit_mask - (pair & (rowbit_mask - 1)));
+    for (unsigned long i = i0; i < i0 + n; ++i)
+      f(i);
+    pair += n;
+  }
+}
+
+// Apply a dense 2x2 matrix in place to the pairs of coefficients (coefficients[i0], coefficients[i1])
+// where i1 = i0 | rowbit_mask, and i0 is the pair number with a zero bit inserted at rowbit_mask,
+// for every pair number in [begin, end).
+//
+// Every pair is read and written in place, reusing the storage of the coefficients
+// and of a single scratch value; no Eigen temporaries are created. When all entries
+// of the matrix are ±1 (H without its factor √½) only additions and subtractions are done.
+template<typename Scalar>
+void apply_butterfly(std::vector<Scalar>& coefficients, Eigen::Matrix<Scalar, 2, 2> const& matrix, unsigned long rowbit_mask,
+    unsigned long begin, unsigned long end)
+{
+  Scalar scratch;
+
+  bool const unit_entries = matrix(0, 0).is_unity() && matrix(0, 1).is_unity() && matrix(1, 0).is_unity() && matrix(1, 1).is_unity();
+  if (unit_entries)
+  {
+    bool const negate00 = matrix(0, 0).starts_with_a_minus();
+    bool const negate01 = matrix(0, 1).starts_with_a_minus();
+    bool const negate10 = matrix(1, 0).starts_with_a_minus();
+    bool const negate11 = matrix(1, 1).starts_with_a_minus();
+    for_each_butterfly_pair(begin, end, rowbit_mask, [&](unsigned long i0){
+      Scalar& c0 = coefficients[i0];
+      Scalar& c1 = coefficients[i0 | rowbit_mask];
+      scratch = c0;
+      // c0 = ±c0 ± c1.
+      if (negate00)
+        c0 = -c0;
+      if (negate01)
+        c0 -= c1;
+      else
+        c0 += c1;
+      // c1 = ±scratch ± c1.
+      if (negate11)
+        c1 = -c1;
+      if (negate10)
+        c1 -= scratch;
+      else
+        c1 += scratch;
+    });
+    return;
+  }
+
+  for_each_butterfly_pair(begin, end, rowbit_mask, [&](unsigned long i0){
+    Scalar& c0 = coefficients[i0];
+    Scalar& c1 = coefficients[i0 | rowbit_mask];
+    scratch = c0;
+    c0 = mul_add(matrix(0, 0), c0, matrix(0, 1), c1);
+    c1 = mul_add(matrix(1, 0), scratch, matrix(1, 1), c1);
+  });
+}
+
+// The same, for all pairs.
+template<typename Scalar>
+void apply_butterfly(std::vector<Scalar>& coefficients, Eigen::Matrix<Scalar, 2, 2> const& matrix, unsigned long rowbit_mask)
+{
+  apply_butterfly(coefficients, matrix, rowbit_mask, 0, coefficients.size() / 2);
+}
+
+} // namespace quantum
@@ -1,6 +1,7 @@
 #include "sys.h"
 #include "Circuit.h"
 #include "State.h"
+#include "CircuitGraph.h"
 #include "utils/reversed.h"
 #include <iostream>
 #include <vector>
@@ -80,6 +81,7 @@ void Circuit::reset(size_t number_of_quantum_bits, size_t number_of_classical_bi
   m_quantum_register.clear();
   for (size_t index = 0; index < number_of_quantum_bits; ++index)
     m_quantum_register.emplace_back(this, q_index_type{index});
+  m_measurement_mask = QIndexMask::range(q_index_type{m_number_of_quantum_bits}, m_quantum_register.iend());
   m_state.reset();
   for (auto&& m : m_map)
     m.clear();
@@ -114,6 +116,11 @@ QMatrix const& Standard::matrix() const
   return gate[m_gate];
 }
 
+GateMatrix<QMatrix> const& Standard::gate_matrix() const
+{
+  return gate_matrices[m_gate];
+}
+
 void Standard::print_on(std::ostream& os) const
 {
   switch (m_gate)
@@ -207,14 +214,11 @@ q_index_type Circuit::next_chain(int id, int rowbit) const
   return m_map[1 - rowbit].at(id);
 }
 
-void Circuit::execute()
+void Circuit::parse(State& state)
 {
   size_t const number_of_quantum_bits = m_quantum_register.size();
   //size_t const number_of_classical_bits = m_classical_register.size();
 
-  // Create the circuit matrix.
-  m_state = std::make_shared<State>(this);
-
   // Initialize all qubit pointers.
   utils::Vector<QuBit::iterator, q_index_type> node;
   utils::Vector<QuBit::iterator, q_index_type> end;
@@ -233,7 +237,7 @@ void Circuit::execute()
     while (node[chain] != end[chain])
     {
       q_index_type prev_chain = chain;
-      int switched_chain = m_state->apply(chain, node[chain]);  // Might change `chain'.
+      int switched_chain = state.apply(chain, node[chain]);  // Might change `chain'.
       total_switched_chain += switched_chain;
       if (switched_chain != 1)
         ++node[prev_chain];
@@ -243,4 +247,24 @@ void Circuit::execute()
   }
 }
 
+template<typename Scalar>
+void Circuit::execute(bool concurrent)
+{
+  // Create the circuit matrix.
+  auto state = std::make_shared<BasicState<Scalar>>(this);
+  m_state = state;
+  if (concurrent)
+    state->execute(CircuitGraph(this));
+  else
+    parse(*state);
+}
+
+void Circuit::execute(precision_type precision, schedule_type schedule)
+{
+  if (precision == exact)
+    execute<QuBitField>(schedule == concurrent);
+  else
+    execute<QuBitComplex>(schedule == concurrent);
+}
+
 } // namespace quantum
@@ -2,6 +2,7 @@
 
 #include "Gates.h"
 #include "QuBit.h"
+#include "QIndexMask.h"
 #include "utils/Vector.h"
 #include <iosfwd>
 #include <memory>
@@ -9,14 +10,8 @@
 
 namespace quantum {
 
-namespace index_category {
-enum qubits {};         // Index into quantum register.
-} // namespace category
-
 class Circuit;
 
-using q_index_type = utils::VectorIndex<index_category::qubits>;
-
 namespace gates {
 
 // Base class for gate inputs.
@@ -30,6 +25,9 @@ class GateInput
   virtual q_index_type next_chain(Circuit const* UNUSED_ARG(circuit), int UNUSED_ARG(rowbit)) const { assert(false); }
   virtual QMatrix const& matrix() const = 0;
   virtual QMatrixX const& matrixX() const { assert(false); }
+  virtual GateMatrix<QMatrix> const& gate_matrix() const = 0;
+  virtual GateMatrix<QMatrixX> const& gate_matrixX() const { assert(false); }
+  virtual gate_t gate_index() const { assert(false); }
   virtual void print_on(std::ostream& os) const = 0;
 
   friend std::ostream& operator<<(std::ostream& os, GateInput const& gate_input) { gate_input.print_on(os); return os; }
@@ -40,6 +38,7 @@ class MultiInput : public GateInput
 {
   int number_of_inputs() const override { return n; }
   QMatrix const& matrix() const override { assert(false); }
+  GateMatrix<QMatrix> const& gate_matrix() const override { assert(false); }
 };
 
 using SingleInput = MultiInput<1>;
@@ -54,6 +53,7 @@ class ControlledNOT : public MultiInput<2>
   int number_of_inputs() const override { return 2; }
   q_index_type next_chain(Circuit const* circuit, int rowbit) const override;
   QMatrixX const& matrixX() const override { return gates::Controlled_X; }
+  GateMatrix<QMatrixX> const& gate_matrixX() const override { return gates::Controlled_X_matrix; }
 
  public:
   ControlledNOT(int id) : m_id(id) { }
@@ -112,6 +112,8 @@ class Standard : public SingleInput
   gate_t m_gate;
 
   QMatrix const& matrix() const override;
+  GateMatrix<QMatrix> const& gate_matrix() const override;
+  gate_t gate_index() const override { return m_gate; }
   void print_on(std::ostream& os) const override;
 
  public:
@@ -138,11 +140,13 @@ class measure : public ControlledNOT
 } // namespace gates
 
 class State;
+class CircuitGraph;
 
 class Circuit
 {
  private:
   friend class State;
+  friend class CircuitGraph;
 
   class Node
   {
@@ -203,11 +207,16 @@ class Circuit
 
   size_t m_number_of_quantum_bits;              // The real number of quantum bits.
   quantum_register_type m_quantum_register;     // A QuBit for each quantum bit and one for each classical bit.
+  QIndexMask m_measurement_mask;                // The q_index of each classical bit.
   std::shared_ptr<State> m_state;
   std::array<map_type, 2> m_map;
 
  private:
   void saw(gates::ControlledNOT const& input, q_index_type quantum_register_index);
+  // Feed all gates to state, in the order of a sequential execution.
+  void parse(State& state);
+  template<typename Scalar>
+  void execute(bool concurrent);
 
  public:
   class Result
@@ -228,11 +237,26 @@ class Circuit
   q_index_type q_ibegin() const { return m_quantum_register.ibegin(); }
   q_index_type q_iend() const { return m_quantum_register.iend(); }
   q_index_type next_chain(int id, int rowbit) const;
-  unsigned long get_measurement_mask() const { return (1UL << m_quantum_register.size()) - (1UL << m_number_of_quantum_bits); }
+  QIndexMask const& get_measurement_mask() const { return m_measurement_mask; }
   bool is_measurement(q_index_type q_index) const { return q_index.get_value() >= m_number_of_quantum_bits; }
   size_t classical_index(q_index_type q_index) const { return q_index.get_value() - m_number_of_quantum_bits; }
 
-  void execute();
+  // The scalar type that execute uses for the amplitudes.
+  enum precision_type
+  {
+    exact,      // QuBitField: exact, printed as formulas.
+    fast        // QuBitComplex: double precision, printed as decimal numbers.
+  };
+
+  // How execute applies the gates.
+  enum schedule_type
+  {
+    sequential, // One gate at a time, qubit chain by qubit chain.
+    concurrent  // Gates on different EntangledStates at the same time (see CircuitGraph); the
+                // qubits of each resulting EntangledState are printed in order of their index.
+  };
+
+  void execute(precision_type precision = exact, schedule_type schedule = sequential);
   std::shared_ptr<State> state() const;
   Result result() const;
 
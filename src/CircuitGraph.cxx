@@ -0,0 +1,83 @@
+#include "sys.h"
+#include "CircuitGraph.h"
+#include "State.h"
+#include "debug.h"
+#include <iostream>
+
+namespace quantum {
+
+// A State that records the gates that the parser feeds it as operations of a CircuitGraph.
+class CircuitGraph::Recorder : public State
+{
+ private:
+  CircuitGraph& m_graph;
+  std::vector<int> m_last_operation;    // The last recorded operation on each qubit, or -1.
+
+  void add(Operation&& operation, QIndexMask const& q_index_mask);
+
+  void apply(gates::GateInput const& gate_input, q_index_type chain) override
+  {
+    add({&gate_input, chain, {}}, QIndexMask{chain});
+  }
+
+  void apply(gates::GateInput const& gate_input, InputCollector const& collector) override
+  {
+    add({&gate_input, {}, collector}, collector.q_index_mask());
+  }
+
+ public:
+  Recorder(Circuit const* circuit, CircuitGraph& graph) :
+    State(circuit), m_graph(graph), m_last_operation(circuit->q_iend().get_value(), -1) { }
+
+  void print_on(std::ostream& os) const override { os << m_graph.m_operations.size() << " operations"; }
+};
+
+void CircuitGraph::Recorder::add(Operation&& operation, QIndexMask const& q_index_mask)
+{
+  int const operation_index = m_graph.m_operations.size();
+  m_graph.m_operations.push_back(std::move(operation));
+  m_graph.m_successors.emplace_back();
+  q_index_mask.for_each([&](q_index_type q_index){
+    int& last_operation = m_last_operation[q_index.get_value()];
+    // Don't add the same edge twice, when the previous operation also acted on both qubits.
+    if (last_operation != -1 && (m_graph.m_successors[last_operation].empty() || m_graph.m_successors[last_operation].back() != operation_index))
+      m_graph.m_successors[last_operation].push_back(operation_index);
+    last_operation = operation_index;
+  });
+}
+
+CircuitGraph::CircuitGraph(Circuit* circuit)
+{
+  Recorder recorder(circuit, *this);
+  circuit->parse(recorder);
+  Dout(dc::notice, "CircuitGraph: " << *this);
+}
+
+std::ostream& operator<<(std::ostream& os, CircuitGraph const& graph)
+{
+  for (std::size_t i = 0; i < graph.m_operations.size(); ++i)
+  {
+    CircuitGraph::Operation const& operation = graph.m_operations[i];
+    os << '\n' << i << ": " << *operation.gate_input << ' ';
+    if (operation.inputs.number_of_inputs() == 0)
+      os << operation.chain;
+    else
+    {
+      char const* separator = "(";
+      operation.inputs.q_index_mask().for_each([&](q_index_type q_index){
+        os << separator << q_index.get_value();
+        separator = ", ";
+      });
+      os << ')';
+    }
+    char const* prefix = " -> ";
+    for (int successor : graph.m_successors[i])
+    {
+      os << prefix << successor;
+      prefix = ", ";
+    }
+  }
+  return os;
+}
+
+} // namespace quantum
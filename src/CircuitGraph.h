@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Circuit.h"
+#include "InputCollector.h"
+#include "TaskScheduler.h"
+#include <iosfwd>
+#include <vector>
+
+namespace quantum {
+
+// The gates of a Circuit as a dependency graph (DAG).
+//
+// The operations are the gates in the order in which a sequential Circuit::execute applies
+// them: the circuit is parsed exactly like that (including the CX links of Circuit::m_map),
+// but the gates are recorded instead of applied. An operation depends on the previous operation
+// on each of its qubits; a measurement also on the previous operation on its measurement qubit.
+// Operations that don't depend on each other, directly or indirectly, act on different qubits
+// and can be applied in any order.
+class CircuitGraph
+{
+ public:
+  struct Operation
+  {
+    gates::GateInput const* gate_input; // The gate.
+    q_index_type chain;                 // The qubit of a single-input gate.
+    InputCollector inputs;              // The inputs of a multi-input gate or measurement; empty for single-input gates.
+  };
+
+ private:
+  class Recorder;
+
+  std::vector<Operation> m_operations;                  // All operations, in the order of a sequential execution.
+  TaskScheduler::successors_type m_successors;          // The operations that directly depend on each operation.
+
+ public:
+  CircuitGraph(Circuit* circuit);
+
+  // Accessors.
+  std::vector<Operation> const& operations() const { return m_operations; }
+  TaskScheduler::successors_type const& successors() const { return m_successors; }
+
+  friend std::ostream& operator<<(std::ostream& os, CircuitGraph const& graph);
+};
+
+} // namespace quantum
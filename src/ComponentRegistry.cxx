@@ -0,0 +1,60 @@
+#include "sys.h"
+#include "ComponentRegistry.h"
+#include "debug.h"
+#include <utility>
+
+namespace quantum {
+
+q_index_type ComponentRegistry::root(q_index_type q_index)
+{
+  // Find the root, and the rowbit of q_index (the sum of the shifts on the way).
+  q_index_type root = q_index;
+  int rowbit = 0;
+  while (m_nodes[root].parent != root)
+  {
+    rowbit += m_nodes[root].shift;
+    root = m_nodes[root].parent;
+  }
+  rowbit += m_nodes[root].shift;
+  // Point every node on the way directly to the root.
+  int const root_shift = m_nodes[root].shift;
+  while (q_index != root && m_nodes[q_index].parent != root)
+  {
+    Node& node = m_nodes[q_index];
+    q_index_type const parent = node.parent;
+    int const parent_rowbit = rowbit - node.shift;
+    node.parent = root;
+    node.shift = rowbit - root_shift;
+    q_index = parent;
+    rowbit = parent_rowbit;
+  }
+  return root;
+}
+
+void ComponentRegistry::merge(q_index_type first, q_index_type second, int number_of_first_rowbits)
+{
+  q_index_type first_root = root(first);
+  q_index_type second_root = root(second);
+  ASSERT(first_root != second_root);
+  int const component = m_nodes[first_root].component;
+  // The rowbits of second come after those of first now.
+  m_nodes[second_root].shift += number_of_first_rowbits;
+  // Attach the smaller tree to the root of the larger one.
+  if (m_nodes[first_root].size < m_nodes[second_root].size)
+    std::swap(first_root, second_root);
+  Node& root_node = m_nodes[first_root];
+  Node& child_node = m_nodes[second_root];
+  child_node.parent = first_root;
+  child_node.shift -= root_node.shift;
+  root_node.size += child_node.size;
+  root_node.component = component;
+}
+
+ComponentRegistry::Location ComponentRegistry::find(q_index_type q_index)
+{
+  q_index_type const root = this->root(q_index);
+  Node const& root_node = m_nodes[root];
+  return { root_node.component, q_index == root ? root_node.shift : m_nodes[q_index].shift + root_node.shift };
+}
+
+} // namespace quantum
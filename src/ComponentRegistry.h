@@ -0,0 +1,70 @@
+#pragma once
+
+#include "QIndexMask.h"
+#include "utils/Vector.h"
+
+namespace quantum {
+
+// Maps every qubit to the component (the index of the EntangledState in BasicState::m_separable_states)
+// that holds it and to its rowbit in there, in (amortized) constant time.
+//
+// The qubits of a component form a tree (union-find, by size, with path compression). Merging a component
+// into another appends its rowbits (see BasicEntangledState::merge), which is recorded as a shift of the
+// rowbits of its root: the rowbit of a qubit is the sum of the shifts from the qubit up till the root.
+// Only the component of the root is valid.
+//
+// Anything else that changes the rowbits of a component (separate, sort_quantum_bits, maybe_relabel) must add it again.
+class ComponentRegistry
+{
+ public:
+  struct Location
+  {
+    int component;                      // The index of the EntangledState that holds the qubit.
+    int rowbit;                         // The rowbit of the qubit in that EntangledState.
+  };
+
+ private:
+  struct Node
+  {
+    q_index_type parent;                // The parent in the tree, or the node itself if it is the root.
+    int shift;                          // The rowbit of the qubit minus the rowbit of parent (the rowbit itself for the root).
+    int size;                           // The number of qubits in the tree, if this is the root.
+    int component;                      // The component of the qubits in the tree, if this is the root.
+  };
+
+  utils::Vector<Node, q_index_type> m_nodes;    // The node of each qubit.
+
+  // Return the root of the tree of q_index, pointing every node on the way directly to the root.
+  q_index_type root(q_index_type q_index);
+
+ public:
+  ComponentRegistry() = default;
+  // Construct a registry for the qubits up till (but not including) end, none of which are added yet.
+  ComponentRegistry(q_index_type end) : m_nodes(end.get_value()) { }
+
+  // Register the qubits of entangled_state as component component.
+  template<typename EntangledState>
+  void add(int component, EntangledState const& entangled_state)
+  {
+    q_index_type const root = entangled_state.q_index(0);
+    for (int rowbit = 0; rowbit < entangled_state.number_of_quantum_bits(); ++rowbit)
+      m_nodes[entangled_state.q_index(rowbit)] = { root, rowbit, 0, 0 };
+    m_nodes[root].size = entangled_state.number_of_quantum_bits();
+    m_nodes[root].component = component;
+  }
+
+  // Record that the component of second was merged into that of first, which had number_of_first_rowbits
+  // rowbits before the merge. The result keeps the component of first.
+  void merge(q_index_type first, q_index_type second, int number_of_first_rowbits);
+
+  // Record that the component of q_index moved to index component.
+  void move(q_index_type q_index, int component) { m_nodes[root(q_index)].component = component; }
+
+  // Return the component that holds q_index and its rowbit in there.
+  Location find(q_index_type q_index);
+
+  // Return the component that holds q_index.
+  int component(q_index_type q_index) { return m_nodes[root(q_index)].component; }
+};
+
+} // namespace quantum
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace quantum {
+
+// A vector of Scalar values that stores every distinct value only once.
+//
+// Each element is an index into a table with the interned values (m_values).
+// In Clifford+T circuits a state of many qubits typically only has a handful
+// of distinct amplitudes, so that most elements cost one byte instead of a
+// whole Scalar. The indices are 8, 16 or 32 bit wide, depending on the number
+// of values in the table; they are widened automatically as that grows.
+// The value with index zero is always zero.
+//
+// Scalar must have a hash() member function.
+template<typename Scalar>
+class DictionaryVector
+{
+ public:
+  using index_type = uint32_t;
+
+ private:
+  struct Hash
+  {
+    std::size_t operator()(Scalar const& value) const { return value.hash(); }
+  };
+
+  std::vector<Scalar> m_values;                           // The interned values.
+  std::unordered_map<Scalar, index_type, Hash> m_lookup;  // Maps each element of m_values back to its index.
+  std::size_t m_size;                                     // The number of elements.
+  int m_index_width;                                      // The size of one index in bytes: 1, 2 or 4.
+  std::vector<uint8_t> m_indices8;                        // The indices, if m_index_width == 1.
+  std::vector<uint16_t> m_indices16;                      // The indices, if m_index_width == 2.
+  std::vector<uint32_t> m_indices32;                      // The indices, if m_index_width == 4.
+
+  // Make room for indices up till and including largest_index.
+  void widen(index_type largest_index);
+
+ public:
+  // Construct a vector with size zeroes.
+  explicit DictionaryVector(std::size_t size);
+
+  // Replace the contents with dense (a std::vector<Scalar>, or anything else with a size() and an operator[]).
+  // Returns false, leaving this object in an unspecified state, when dense contains more than max_values distinct values.
+  template<typename Dense>
+  bool assign(Dense const& dense, std::size_t max_values);
+
+  // Return the number of elements.
+  std::size_t size() const { return m_size; }
+  // Return the number of values in the table (including zero and values that are no longer used).
+  std::size_t number_of_values() const { return m_values.size(); }
+
+  // Return the index into the table of element i.
+  index_type index(std::size_t i) const
+  {
+    switch (m_index_width)
+    {
+      case 1:
+        return m_indices8[i];
+      case 2:
+        return m_indices16[i];
+    }
+    return m_indices32[i];
+  }
+
+  // Let element i refer to the value with index value_index.
+  void set_index(std::size_t i, index_type value_index)
+  {
+    switch (m_index_width)
+    {
+      case 1:
+        m_indices8[i] = value_index;
+        return;
+      case 2:
+        m_indices16[i] = value_index;
+        return;
+    }
+    m_indices32[i] = value_index;
+  }
+
+  // Exchange elements i and j.
+  void swap_elements(std::size_t i, std::size_t j)
+  {
+    index_type const value_index = index(i);
+    set_index(i, index(j));
+    set_index(j, value_index);
+  }
+
+  // Return the value with index value_index.
+  Scalar const& value(index_type value_index) const { return m_values[value_index]; }
+  // Return element i.
+  Scalar const& operator[](std::size_t i) const { return m_values[index(i)]; }
+
+  // Return the index of value, adding it to the table if it isn't there yet.
+  index_type intern(Scalar const& value);
+
+  // Remove all values that are no longer used from the table.
+  void compact();
+
+  // Replace every value v in the table with op(v). Distinct values must remain distinct.
+  template<typename Op>
+  void transform_values(Op op);
+
+  // Return all elements as a std::vector.
+  std::vector<Scalar> expand() const;
+};
+
+template<typename Scalar>
+DictionaryVector<Scalar>::DictionaryVector(std::size_t size) : m_values(1), m_size(size), m_index_width(1), m_indices8(size, 0)
+{
+  m_lookup.emplace(m_values[0], 0);
+}
+
+template<typename Scalar>
+void DictionaryVector<Scalar>::widen(index_type largest_index)
+{
+  if (m_index_width == 1 && largest_index > UINT8_MAX)
+  {
+    m_indices16.assign(m_indices8.begin(), m_indices8.end());
+    m_indices8 = std::vector<uint8_t>();
+    m_index_width = 2;
+  }
+  if (m_index_width == 2 && largest_index > UINT16_MAX)
+  {
+    m_indices32.assign(m_indices16.begin(), m_indices16.end());
+    m_indices16 = std::vector<uint16_t>();
+    m_index_width = 4;
+  }
+}
+
+template<typename Scalar>
+typename DictionaryVector<Scalar>::index_type DictionaryVector<Scalar>::intern(Scalar const& value)
+{
+  auto ibp = m_lookup.emplace(value, m_values.size());
+  if (ibp.second)
+  {
+    m_values.push_back(value);
+    widen(ibp.first->second);
+  }
+  return ibp.first->second;
+}
+
+template<typename Scalar>
+template<typename Dense>
+bool DictionaryVector<Scalar>::assign(Dense const& dense, std::size_t max_values)
+{
+  *this = DictionaryVector(dense.size());
+  for (std::size_t i = 0; i < dense.size(); ++i)
+  {
+    index_type const value_index = intern(dense[i]);
+    if (m_values.size() > max_values)
+      return false;
+    set_index(i, value_index);
+  }
+  return true;
+}
+
+template<typename Scalar>
+void DictionaryVector<Scalar>::compact()
+{
+  index_type const unused = static_cast<index_type>(-1);
+  std::vector<index_type> new_index(m_values.size(), unused);
+  std::vector<Scalar> new_values;
+  // Keep zero at index zero.
+  new_index[0] = 0;
+  new_values.push_back(m_values[0]);
+  for (std::size_t i = 0; i < m_size; ++i)
+  {
+    index_type const old_index = index(i);
+    if (new_index[old_index] == unused)
+    {
+      new_index[old_index] = new_values.size();
+      new_values.push_back(std::move(m_values[old_index]));
+    }
+    set_index(i, new_index[old_index]);
+  }
+  m_values.swap(new_values);
+  m_lookup.clear();
+  for (index_type value_index = 0; value_index < m_values.size(); ++value_index)
+    m_lookup.emplace(m_values[value_index], value_index);
+}
+
+template<typename Scalar>
+template<typename Op>
+void DictionaryVector<Scalar>::transform_values(Op op)
+{
+  m_lookup.clear();
+  for (index_type value_index = 0; value_index < m_values.size(); ++value_index)
+  {
+    m_values[value_index] = op(m_values[value_index]);
+    m_lookup.emplace(m_values[value_index], value_index);
+  }
+}
+
+template<typename Scalar>
+std::vector<Scalar> DictionaryVector<Scalar>::expand() const
+{
+  std::vector<Scalar> result;
+  result.reserve(m_size);
+  for (std::size_t i = 0; i < m_size; ++i)
+    result.push_back(m_values[index(i)]);
+  return result;
+}
+
+} // namespace quantum
@@ -1,14 +1,92 @@
 #include "sys.h"
 #include "EntangledState.h"
+#include "QuBitRing.h"
+#include "QuBitModular.h"
+#include "QuBitComplex.h"
+#include "Butterfly.h"
+#include "ThreadPool.h"
+#include "Gates.h"
 #include "utils/is_power_of_two.h"
 #include "utils/BitSet.h"
 #include "utils/reversed.h"
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <numeric>
 #include <set>
+#include <unordered_map>
 
 namespace quantum {
 
-int EntangledState::rowbit(q_index_type q_index) const
+namespace {
+
+// Memoizes the products of the values of a DictionaryVector with the entries of a gate matrix.
+template<typename Scalar, typename Matrix>
+class ProductMemo
+{
+  using index_type = typename DictionaryVector<Scalar>::index_type;
+
+  DictionaryVector<Scalar>& m_dictionary;
+  Matrix const& m_matrix;
+  std::vector<std::vector<Eigen::Index>> m_non_zero_columns;    // The columns of the non-zero entries, per row of m_matrix.
+  std::unordered_map<uint64_t, Scalar> m_products;              // Maps (value index, entry) to their product.
+
+ public:
+  ProductMemo(DictionaryVector<Scalar>& dictionary, Matrix const& matrix) : m_dictionary(dictionary), m_matrix(matrix), m_non_zero_columns(matrix.rows())
+  {
+    for (Eigen::Index row = 0; row < matrix.rows(); ++row)
+      for (Eigen::Index col = 0; col < matrix.cols(); ++col)
+        if (!matrix(row, col).is_zero())
+          m_non_zero_columns[row].push_back(col);
+  }
+
+  // Return the value index of row `row` of the matrix, times the column vector of value indices column.
+  index_type row_times(Eigen::Index row, index_type const* column)
+  {
+    Scalar sum;
+    for (Eigen::Index col : m_non_zero_columns[row])
+    {
+      if (column[col] == 0)
+        continue;
+      uint64_t const key = static_cast<uint64_t>(column[col]) << 32 | (row * m_matrix.cols() + col);
+      auto ibp = m_products.try_emplace(key);
+      if (ibp.second)
+        ibp.first->second = m_dictionary.value(column[col]) * m_matrix(row, col);
+      sum += ibp.first->second;
+    }
+    return m_dictionary.intern(sum);
+  }
+};
+
+// Memoizes the value indices of the values of a DictionaryVector times the non-zero entries of a monomial gate matrix.
+template<typename Scalar, typename Matrix>
+class MonomialMemo
+{
+  using index_type = typename DictionaryVector<Scalar>::index_type;
+
+  DictionaryVector<Scalar>& m_dictionary;
+  GateMatrix<Matrix> const& m_gate;
+  std::vector<std::unordered_map<index_type, index_type>> m_scaled;     // Maps value indices to the value index of their product with the non-zero entry, per row.
+
+ public:
+  MonomialMemo(DictionaryVector<Scalar>& dictionary, GateMatrix<Matrix> const& gate) : m_dictionary(dictionary), m_gate(gate), m_scaled(gate.size()) { }
+
+  // Return the value index of the value with index value_index times the non-zero entry of row.
+  index_type scaled(int row, index_type value_index)
+  {
+    if (value_index == 0 || m_gate.factor_is_one(row))
+      return value_index;
+    auto ibp = m_scaled[row].try_emplace(value_index);
+    if (ibp.second)
+      ibp.first->second = m_dictionary.intern(m_gate.times_factor(row, m_dictionary.value(value_index)));
+    return ibp.first->second;
+  }
+};
+
+} // namespace
+
+template<typename Scalar>
+int BasicEntangledState<Scalar>::rowbit(q_index_type q_index) const
 {
   int rowbit = 0;
   for (auto qi : m_q_index)
@@ -22,29 +100,446 @@ int EntangledState::rowbit(q_index_type q_index) const
   return -1;
 }
 
-void EntangledState::apply(QMatrix const& matrix, q_index_type chain)
+template<typename Scalar>
+void BasicEntangledState<Scalar>::reduce()
+{
+  // Find the largest number of factors √2 that can be divided out of every coefficient.
+  int n = m_sqrt_half_exponent;
+  if (m_dictionary)
+  {
+    // Only look at the values that are still in use.
+    m_dictionary->compact();
+    for (std::size_t value_index = 1; value_index < m_dictionary->number_of_values() && n > 0; ++value_index)
+      n = m_dictionary->value(value_index).sqrt2_valuation(n);
+    if (n > 0)
+      m_dictionary->transform_values([n](Scalar const& value){ return value.times_sqrt_half(n); });
+  }
+  else if (m_planes)
+  {
+    if constexpr (planes_supported)
+    {
+      for (unsigned long index = 0; index < m_planes->size() && n > 0; ++index)
+        n = (*m_planes)[index].sqrt2_valuation(n);
+      if (n > 0)
+        m_planes->transform([n](Scalar const& value){ return value.times_sqrt_half(n); });
+    }
+  }
+  else if (m_packed)
+  {
+    // Every value can be multiplied with √½^n; the packed numerators are then divided by √2 as much as possible.
+    m_packed->times_sqrt_half(n);
+  }
+  else if (m_small)
+  {
+    unsigned long const size = number_of_coefficients();
+    for (unsigned long index = 0; index < size && n > 0; ++index)
+      n = (*m_small)[index].sqrt2_valuation(n);
+    if (n > 0)
+      for (unsigned long index = 0; index < size; ++index)
+        (*m_small)[index] = (*m_small)[index].times_sqrt_half(n);
+  }
+  else if (m_sparse)
+  {
+    for (auto&& entry : *m_sparse)
+      if ((n = entry.second.sqrt2_valuation(n)) == 0)
+        break;
+    if (n > 0)
+      for (auto& entry : *m_sparse)
+        entry.second = entry.second.times_sqrt_half(n);
+  }
+  else
+  {
+    for (auto&& coefficient : m_sum)
+      if ((n = coefficient.sqrt2_valuation(n)) == 0)
+        break;
+    if (n > 0)
+      ThreadPool::instance().for_each_block(m_sum.size(), 1, [this, n](unsigned long begin, unsigned long end){
+        for (unsigned long index = begin; index < end; ++index)
+          m_sum[index] = m_sum[index].times_sqrt_half(n);
+      });
+  }
+  m_sqrt_half_exponent -= n;
+  m_next_reduce_exponent = m_sqrt_half_exponent + reduce_interval;
+}
+
+template<typename Scalar>
+Scalar const* BasicEntangledState<Scalar>::find_sparse(unsigned long index) const
+{
+  auto entry = std::lower_bound(m_sparse->begin(), m_sparse->end(), index,
+      [](typename sparse_type::value_type const& entry, unsigned long index){ return entry.first < index; });
+  return entry != m_sparse->end() && entry->first == index ? &entry->second : nullptr;
+}
+
+template<typename Scalar>
+Scalar const& BasicEntangledState<Scalar>::sparse_coefficient(unsigned long index) const
+{
+  static Scalar const zero;
+  Scalar const* coefficient = find_sparse(index);
+  return coefficient ? *coefficient : zero;
+}
+
+template<typename Scalar>
+Scalar BasicEntangledState<Scalar>::converted_coefficient(unsigned long index) const
+{
+  if constexpr (planes_supported)
+    return m_planes ? (*m_planes)[index] : (*m_packed)[index];
+  else
+    return {};  // Never used.
+}
+
+template<typename Scalar>
+template<typename F>
+void BasicEntangledState<Scalar>::for_each_non_zero(F f) const
+{
+  if (m_sparse)
+  {
+    for (auto const& entry : *m_sparse)
+      f(entry.first, entry.second);
+    return;
+  }
+  unsigned long const size = number_of_coefficients();
+  if (is_converted())
+  {
+    for (unsigned long index = 0; index < size; ++index)
+      if (!is_zero_coefficient(index))
+        f(index, converted_coefficient(index));
+    return;
+  }
+  for (unsigned long index = 0; index < size; ++index)
+  {
+    Scalar const& coefficient = stored(index);
+    if (!coefficient.is_zero())
+      f(index, coefficient);
+  }
+}
+
+template<typename Scalar>
+unsigned long BasicEntangledState<Scalar>::number_of_non_zero_coefficients() const
+{
+  if (m_sparse)
+    return m_sparse->size();
+  unsigned long count = 0;
+  unsigned long const size = number_of_coefficients();
+  if (m_dictionary)
+  {
+    // Zero always has index zero.
+    for (unsigned long index = 0; index < size; ++index)
+      if (m_dictionary->index(index) != 0)
+        ++count;
+  }
+  else
+  {
+    for (unsigned long index = 0; index < size; ++index)
+      if (!is_zero_coefficient(index))
+        ++count;
+  }
+  return count;
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::use_dictionary(DictionaryVector<Scalar>&& dictionary)
+{
+  m_dictionary = std::move(dictionary);
+  m_sum = std::vector<Scalar>();
+  m_planes.reset();
+  m_packed.reset();
+  m_small.reset();
+  m_compact_at = 2 * m_dictionary->number_of_values() + 16;
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::make_sparse()
+{
+  sparse_type sparse;
+  for_each_non_zero([&](unsigned long index, Scalar const& coefficient){ sparse.emplace_back(index, coefficient); });
+  m_sum = std::vector<Scalar>();
+  m_dictionary.reset();
+  m_planes.reset();
+  m_packed.reset();
+  m_small.reset();
+  m_sparse = std::move(sparse);
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::make_planes()
+{
+  if constexpr (planes_supported)
+  {
+    // Only worth it when the state is in a subfield.
+    if (AmplitudePlanes::count(AmplitudePlanes::non_zero_planes(m_sum)) > planes_max_non_zero)
+      return;
+    m_planes.emplace(m_sum);
+    m_sum = std::vector<Scalar>();
+  }
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::make_packed()
+{
+  if constexpr (packed_supported)
+  {
+    PackedAmplitudes packed;
+    if (!packed.assign(m_sum))
+      return;
+    m_packed = std::move(packed);
+    m_sum = std::vector<Scalar>();
+  }
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::make_small()
+{
+  m_small.emplace();
+  std::move(m_sum.begin(), m_sum.end(), m_small->begin());
+  m_sum = std::vector<Scalar>();
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::make_dense()
+{
+  if (m_small)
+  {
+    unsigned long const size = number_of_coefficients();
+    m_sum.assign(std::make_move_iterator(m_small->begin()), std::make_move_iterator(m_small->begin() + size));
+    m_small.reset();
+  }
+  else if (m_dictionary)
+  {
+    m_sum = m_dictionary->expand();
+    m_dictionary.reset();
+  }
+  else if (m_sparse)
+  {
+    m_sum.assign(number_of_coefficients(), Scalar{});
+    for (auto& entry : *m_sparse)
+      m_sum[entry.first] = std::move(entry.second);
+    m_sparse.reset();
+  }
+  else if (m_planes)
+  {
+    if constexpr (planes_supported)
+      m_sum = m_planes->expand();
+    m_planes.reset();
+  }
+  else if (m_packed)
+  {
+    if constexpr (packed_supported)
+      m_sum = m_packed->expand();
+    m_packed.reset();
+  }
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::update_storage()
 {
+  // Small states are always stored inline.
+  if (m_small)
+    return;
+  unsigned long const size = number_of_coefficients();
+  if (m_sparse)
+  {
+    // Too many non-zero coefficients; go back to storing all coefficients in m_sum.
+    if (m_sparse->size() * sparse_ratio > 2 * size)
+    {
+      make_dense();
+      m_storage_check_countdown = storage_check_interval;
+    }
+  }
+  else if (m_dictionary)
+  {
+    // Get rid of unused values once the table grew large enough.
+    if (m_dictionary->number_of_values() < m_compact_at)
+      return;
+    m_dictionary->compact();
+    if (number_of_non_zero_coefficients() * sparse_ratio <= size)
+      make_sparse();
+    else if (m_dictionary->number_of_values() <= 2 * size / dictionary_ratio)
+      m_compact_at = 2 * m_dictionary->number_of_values() + 16;
+    else
+    {
+      // Too many distinct values.
+      make_dense();
+      m_storage_check_countdown = storage_check_interval;
+    }
+  }
+  else if (m_planes)
+  {
+    if (--m_storage_check_countdown > 0)
+      return;
+    m_storage_check_countdown = storage_check_interval;
+    if (number_of_non_zero_coefficients() * sparse_ratio <= size)
+      make_sparse();
+    else if (m_planes->number_of_non_zero_planes() > planes_max_non_zero)
+      make_dense();     // Left the subfield.
+    else if constexpr (planes_supported)
+    {
+      DictionaryVector<Scalar> dictionary(0);
+      if (size >= dictionary_min_size && dictionary.assign(*m_planes, size / dictionary_ratio))
+        use_dictionary(std::move(dictionary));
+    }
+  }
+  else if (m_packed)
+  {
+    if (--m_storage_check_countdown > 0)
+      return;
+    m_storage_check_countdown = storage_check_interval;
+    if (number_of_non_zero_coefficients() * sparse_ratio <= size)
+      make_sparse();
+    else if constexpr (packed_supported)
+    {
+      DictionaryVector<Scalar> dictionary(0);
+      if (size >= dictionary_min_size && dictionary.assign(*m_packed, size / dictionary_ratio))
+        use_dictionary(std::move(dictionary));
+    }
+  }
+  else if (size <= small_amplitudes::max_size)
+    make_small();
+  else if (size >= sparse_min_size && --m_storage_check_countdown <= 0)
+  {
+    m_storage_check_countdown = storage_check_interval;
+    if (number_of_non_zero_coefficients() * sparse_ratio <= size)
+      make_sparse();
+    else
+    {
+      DictionaryVector<Scalar> dictionary(0);
+      if (size >= dictionary_min_size && dictionary.assign(m_sum, size / dictionary_ratio))
+        use_dictionary(std::move(dictionary));
+      else
+      {
+        if (size >= packed_min_size)
+          make_packed();
+        if (!m_packed && size >= planes_min_size)
+          make_planes();
+      }
+    }
+  }
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply(GateMatrix<matrix_type> const& gate, q_index_type chain, int chain_rowbit)
+{
+  matrix_type const& matrix = gate.unscaled();
   Eigen::IOFormat MatLabFmt(Eigen::FullPrecision, 0, " ", ";", "", "", "[", "]");
 //  DoutEntering(dc::notice, "EntangledState::apply(" << matrix.format(MatLabFmt) << ", " << chain << ")");
-  unsigned long rowbit_mask = 1UL << rowbit(chain);
+  if (!m_measurements.empty())
+    update_measurements(gate, { chain });
+  unsigned long rowbit_mask = 1UL << chain_rowbit;
   unsigned long coefficients = 1UL << m_number_of_quantum_bits;
-  for (unsigned long i0 = 0; i0 < coefficients; ++i0)
+  count_uses(rowbit_mask);
+  if constexpr (packed_supported)
   {
-    if ((i0 & rowbit_mask))
-      continue; // Already handled as i1.
-    unsigned long i1 = i0 | rowbit_mask;
-    QVector v1{m_sum[i0], m_sum[i1]};
-    QVector v2{matrix * v1};
-    m_sum[i0] = v2[0];
-    m_sum[i1] = v2[1];
+    // Gates whose entries aren't powers of ω (after pulling out the factor √½) need exact arithmetic.
+    if (m_packed && !PackedAmplitudes::supports(gate))
+      make_dense();
+  }
+  if (m_small)
+  {
+    if (gate.kind() == identity_matrix)
+      ;
+    else if (gate.is_monomial())
+      small_amplitudes::apply_monomial(*m_small, m_number_of_quantum_bits, gate, chain_rowbit);
+    else
+      small_amplitudes::apply_dense(*m_small, m_number_of_quantum_bits, matrix, chain_rowbit);
+  }
+  else if (m_packed)
+  {
+    if constexpr (packed_supported)
+      if (gate.kind() != identity_matrix)
+      {
+        unsigned long const first = m_packed->apply(gate, { rowbit_mask });
+        if (first < coefficients)
+        {
+          // Overflow: calculate the remaining pairs exactly.
+          make_dense();
+          apply_pairs(matrix, rowbit_mask, first);
+        }
+      }
+  }
+  else if (m_planes)
+  {
+    if constexpr (planes_supported)
+      if (gate.kind() != identity_matrix)
+        m_planes->apply(matrix, { rowbit_mask });
+  }
+  else if (gate.is_monomial())
+  {
+    // X, Y, Z, S, T, ...
+    if (gate.kind() != identity_matrix)
+      apply_monomial(gate, index_table({ rowbit_mask }));
   }
+  else if (m_dictionary)
+  {
+    using index_type = typename DictionaryVector<Scalar>::index_type;
+    ProductMemo<Scalar, matrix_type> products(*m_dictionary, matrix);
+    // Every distinct pair of input values only has to be calculated once.
+    std::unordered_map<uint64_t, uint64_t> results;     // Maps a pair of input value indices to the pair of resulting value indices.
+    for (unsigned long i0 = 0; i0 < coefficients; ++i0)
+    {
+      if ((i0 & rowbit_mask))
+        continue; // Already handled as i1.
+      unsigned long i1 = i0 | rowbit_mask;
+      index_type const column[2] = { m_dictionary->index(i0), m_dictionary->index(i1) };
+      if (column[0] == 0 && column[1] == 0)
+        continue;
+      auto ibp = results.try_emplace(static_cast<uint64_t>(column[0]) << 32 | column[1]);
+      if (ibp.second)
+        ibp.first->second = static_cast<uint64_t>(products.row_times(0, column)) << 32 | products.row_times(1, column);
+      m_dictionary->set_index(i0, ibp.first->second >> 32);
+      m_dictionary->set_index(i1, ibp.first->second & 0xffffffff);
+    }
+  }
+  else if (m_sparse)
+  {
+    sparse_type new_coef;
+    Scalar const zero;
+    for (auto const& entry : *m_sparse)
+    {
+      Scalar const* partner = find_sparse(entry.first ^ rowbit_mask);
+      bool const is_i1 = (entry.first & rowbit_mask);
+      if (is_i1 && partner)
+        continue; // Already handled as i1.
+      unsigned long i0 = entry.first & ~rowbit_mask;
+      unsigned long i1 = i0 | rowbit_mask;
+      Eigen::Matrix<Scalar, 2, 1> v1;
+      if (is_i1)
+        v1 << zero, entry.second;
+      else
+        v1 << entry.second, (partner ? *partner : zero);
+      Eigen::Matrix<Scalar, 2, 1> v2{matrix * v1};
+      if (!v2[0].is_zero())
+        new_coef.emplace_back(i0, v2[0]);
+      if (!v2[1].is_zero())
+        new_coef.emplace_back(i1, v2[1]);
+    }
+    std::sort(new_coef.begin(), new_coef.end(), [](auto const& entry1, auto const& entry2){ return entry1.first < entry2.first; });
+    m_sparse->swap(new_coef);
+  }
+  else
+  {
+    // Large states are split over the threads of the ThreadPool, a block of pairs at a time.
+    ThreadPool::instance().for_each_block(coefficients / 2, 2, [&](unsigned long begin, unsigned long end){
+      apply_butterfly(m_sum, matrix, rowbit_mask, begin, end);
+    });
+  }
+  m_sqrt_half_exponent += gate.sqrt_half_exponent();
+  maybe_reduce();
+  update_storage();
   Dout(dc::notice, "Result: " << *this);
 }
 
-void EntangledState::apply(QMatrixX const& matrix, InputCollector const& inputs)
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply(GateMatrix<matrixX_type> const& gate, InputCollector const& inputs)
 {
+  matrixX_type const& matrix = gate.unscaled();
   Eigen::IOFormat MatLabFmt(Eigen::FullPrecision, 0, " ", ";", "", "", "[", "]");
 //  DoutEntering(dc::notice, "EntangledState::apply(" << matrix.format(MatLabFmt) << ", " << inputs << ")");
+  if (!m_measurements.empty())
+  {
+    std::vector<q_index_type> input_q_indices;
+    for (int input = 0; input < static_cast<int>(inputs.number_of_inputs()); ++input)
+      input_q_indices.push_back(inputs.rowbit_to_chain(input));
+    update_measurements(gate, input_q_indices);
+  }
 
   unsigned long const number_of_matrix_product_states = matrix.cols();  // The number of product states that the matrix works on;
   assert(utils::is_power_of_two(number_of_matrix_product_states));      // the matrix works on log2(number_of_matrix_product_states) qubits.
@@ -111,82 +606,338 @@ void EntangledState::apply(QMatrixX const& matrix, InputCollector const& inputs)
   //            210      12 0     12 0     12 0     12 0
 
   // In order to generate the above matrix (or four vectors, one for each column),
-  // we start with generating a vector of size m_number_of_quantum_bits (5) and
-  // fill that with the following values (in binary): 00010, 10000, 01000, 00001 and 00100.
-  // Where the last 2 are the unused bits and the first number_of_inputs (3) are the used
-  // bits in the order i0, i1, i2.
-  unsigned long used_mask = 0;
-  unsigned long unused_mask = 0;
-  std::vector<unsigned long> masks(m_number_of_quantum_bits);
+  // we start with generating a vector of size number_of_inputs (3) and fill that
+  // with the rowbit masks of the used bits in the order i0, i1, i2: 00010, 10000 and 01000.
+  // The IndexTable of those masks then lists the indices of each column: the unused bits
+  // of column c are c scattered over the unused bits 00101 (PDEP), and the used bits of
+  // row r are the bits of r scattered over the masks.
+  std::vector<unsigned long> masks(number_of_inputs);
   for (int entangled_rowbit = 0; entangled_rowbit < m_number_of_quantum_bits; ++entangled_rowbit)
   {
     int matrix_rowbit = inputs.chain_to_rowbit(m_q_index[entangled_rowbit]);
     if (matrix_rowbit != -1)    // Is this a used bit?
-    {
       masks[matrix_rowbit] = 1UL << entangled_rowbit;
-      used_mask |= 1UL << entangled_rowbit;             // Eventually becomes 11010.
+  }
+  for (unsigned long mask : masks)
+    count_uses(mask);
+
+  // Small states only have kernels for monomial gates with two inputs (like CX); use m_sum for anything else.
+  // update_storage() makes it small again afterwards.
+  if (m_small && !(gate.is_monomial() && number_of_inputs == 2))
+    make_dense();
+  if constexpr (packed_supported)
+  {
+    if (m_packed && !PackedAmplitudes::supports(gate))
+      make_dense();
+  }
+  if (m_small)
+  {
+    if (gate.kind() != identity_matrix)
+      small_amplitudes::apply_monomial(*m_small, m_number_of_quantum_bits, gate, __builtin_ctzl(masks[0]), __builtin_ctzl(masks[1]));
+  }
+  else if (m_packed)
+  {
+    if constexpr (packed_supported)
+      if (gate.kind() != identity_matrix)
+      {
+        // Only monomial gates with more than one input are supported, and those can't overflow.
+        [[maybe_unused]] unsigned long const first = m_packed->apply(gate, masks);
+        ASSERT(first == m_packed->size());
+      }
+  }
+  else if (m_planes)
+  {
+    if constexpr (planes_supported)
+      if (gate.kind() != identity_matrix)
+        m_planes->apply(matrix, masks);
+  }
+  else if (gate.is_monomial())
+  {
+    if (gate.kind() != identity_matrix)
+      apply_monomial(gate, index_table(masks));
+  }
+  else if (m_sparse)
+    apply_sparse(matrix, index_table(masks));
+  else
+    apply_columns(matrix, index_table(masks));
+  m_sqrt_half_exponent += gate.sqrt_half_exponent();
+  maybe_reduce();
+  update_storage();
+  Dout(dc::notice, "Result: " << *this);
+}
+
+template<typename Scalar>
+template<typename Matrix>
+void BasicEntangledState<Scalar>::update_measurements(GateMatrix<Matrix> const& gate, std::vector<q_index_type> const& input_q_indices)
+{
+  if (gate.kind() == identity_matrix || gate.kind() == diagonal_matrix)
+    return;
+  QIndexMask input_mask;
+  for (q_index_type q_index : input_q_indices)
+    input_mask.set(q_index);
+  int const number_of_inputs = input_q_indices.size();
+  // Row r of a monomial gate is a multiple of column(r), so the outcome of a measurement in product state r afterwards
+  // is the outcome that it had in product state column(r). If column(r) = A·r ⊕ c over GF(2), where column A_i is
+  // column(2^i) ⊕ c, then the parity of the bits m of column(r) is the parity of the bits Aᵀm of r, inverted if c·m is odd.
+  bool affine = gate.is_monomial();
+  unsigned long const offset = affine ? gate.column(0) : 0;
+  for (unsigned long r = 1; affine && r < (1UL << number_of_inputs); ++r)
+  {
+    unsigned long linear = 0;
+    for (int i = 0; i < number_of_inputs; ++i)
+      if ((r & (1UL << i)))
+        linear ^= gate.column(1 << i) ^ offset;
+    affine = (gate.column(r) ^ offset) == linear;
+  }
+  std::vector<Measurement> materialize_measurements;
+  for (auto measurement = m_measurements.begin(); measurement != m_measurements.end();)
+  {
+    if (!measurement->q_index_mask.intersects(input_mask))
+    {
+      ++measurement;
+      continue;
     }
-    else
-      unused_mask |= 1UL << entangled_rowbit;           // Eventually becomes 00101.
+    if (!affine)
+    {
+      materialize_measurements.push_back(*measurement);
+      measurement = m_measurements.erase(measurement);
+      continue;
+    }
+    unsigned long bits = 0;           // m, the bits of the gate inputs that the outcome depends on.
+    for (int i = 0; i < number_of_inputs; ++i)
+      if (measurement->q_index_mask.test(input_q_indices[i]))
+        bits |= 1UL << i;
+    measurement->q_index_mask -= input_mask;
+    for (int i = 0; i < number_of_inputs; ++i)
+      if (__builtin_parityl((gate.column(1 << i) ^ offset) & bits))
+        measurement->q_index_mask.set(input_q_indices[i]);
+    measurement->negated ^= __builtin_parityl(offset & bits);
+    ++measurement;
   }
-  // Add the unused bits too.
-  int extended_matrix_rowbit = number_of_inputs;
-  for (int entangled_rowbit = 0; entangled_rowbit < m_number_of_quantum_bits; ++entangled_rowbit)
+  for (Measurement const& measurement : materialize_measurements)
+    materialize(measurement);
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::materialize(Measurement const& measurement)
+{
+  gates::GateMatrices<Scalar> const& gate_matrices = gates::GateMatrices<Scalar>::instance();
+  merge(BasicEntangledState(measurement.q_index));
+  // The outcome is the parity of the qubits in measurement.q_index_mask: apply a CNOT from each of them.
+  measurement.q_index_mask.for_each([&](q_index_type q_index){
+    InputCollector inputs;
+    inputs.add(measurement.q_index, 0);         // Normal input.
+    inputs.add(q_index, 1);                     // Control input.
+    apply(gate_matrices.Controlled_X, inputs);
+  });
+  if (measurement.negated)
+    apply(gate_matrices.gate[gates::X], measurement.q_index);
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::measure(q_index_type q_index, q_index_type measurement_q_index)
+{
+  m_measurements.push_back({measurement_q_index, QIndexMask{q_index}, false});
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::materialize_measurements()
+{
+  std::vector<Measurement> measurements;
+  measurements.swap(m_measurements);
+  for (Measurement const& measurement : measurements)
+    materialize(measurement);
+}
+
+template<typename Scalar>
+IndexTable const& BasicEntangledState<Scalar>::index_table(std::vector<unsigned long> const& masks)
+{
+  auto table = std::find_if(m_index_tables.begin(), m_index_tables.end(),
+      [&](auto const& index_table){ return index_table->matches(masks, m_number_of_quantum_bits); });
+  if (table == m_index_tables.end())
   {
-    unsigned long mask = 1UL << entangled_rowbit;
-    if ((unused_mask & mask))
-      masks[extended_matrix_rowbit++] = mask;
+    if (m_index_tables.size() == index_table_cache_size)
+      m_index_tables.pop_back();
+    m_index_tables.insert(m_index_tables.begin(), std::make_shared<IndexTable const>(masks, m_number_of_quantum_bits));
   }
+  else
+    std::rotate(m_index_tables.begin(), table, table + 1);      // Move it to the front.
+  return *m_index_tables.front();
+}
 
-  // Temporary copy for coefficients.
-  Eigen::Matrix<QuBitField, Eigen::Dynamic, 1> v1;
-  v1.resize(number_of_matrix_product_states);
+template<typename Scalar>
+template<typename Matrix>
+void BasicEntangledState<Scalar>::apply_monomial(GateMatrix<Matrix> const& gate, IndexTable const& table)
+{
+  int const size = gate.size();
 
-  // This allows us to generate the index into m_sum starting at the top of the first
-  // column and then going down first and left to right second.
-  unsigned long vi = 0;
-  for (unsigned long i = 0;;)
+  // Row r of the result is gate.factor(r) times row gate.column(r) of the input.
+  if (m_sparse)
   {
-    unsigned long mask;
-    // Copy coefficients to the temporary vector.
-    v1[vi++] = m_sum[i];
-    vi %= number_of_matrix_product_states;
-    // Do we have a complete vector/column?
-    if (vi == 0)
+    unsigned long const used_mask = table.used_mask();
+    for (auto& entry : *m_sparse)
     {
-      // Apply matrix on this vector and store the result in v2.
-      Eigen::Matrix<QuBitField, Eigen::Dynamic, 1> v2;
-      v2.resize(number_of_matrix_product_states);
-      v2 = matrix * v1;
-      // Copy v2 back to m_sum.
-      unsigned long i2 = i & ~used_mask;        // Reset to top of the column.
-      for (unsigned long vi2 = 0; vi2 < number_of_matrix_product_states; ++vi2)
+      int const new_row = gate.row(table.row_of(entry.first));
+      entry.first = (entry.first & ~used_mask) | table.offset(new_row);
+      if (!gate.factor_is_one(new_row))
+        entry.second = gate.times_factor(new_row, entry.second);
+    }
+    // A diagonal matrix doesn't change the order.
+    if (gate.kind() != diagonal_matrix)
+      std::sort(m_sparse->begin(), m_sparse->end(), [](auto const& entry1, auto const& entry2){ return entry1.first < entry2.first; });
+    return;
+  }
+
+  unsigned long const columns = table.columns();
+  if (m_dictionary)
+  {
+    using index_type = typename DictionaryVector<Scalar>::index_type;
+    MonomialMemo<Scalar, Matrix> products(*m_dictionary, gate);
+    std::vector<index_type> v1(size);
+    for (unsigned long column = 0; column < columns; ++column)
+    {
+      unsigned long const base = table.base(column);
+      for (int row = 0; row < size; ++row)
+        v1[row] = m_dictionary->index(base | table.offset(row));
+      for (int row = 0; row < size; ++row)
+        m_dictionary->set_index(base | table.offset(row), products.scaled(row, v1[gate.column(row)]));
+    }
+    return;
+  }
+
+  ThreadPool::instance().for_each_block(columns, size, [&](unsigned long begin, unsigned long end){
+    for (unsigned long column = begin; column < end; ++column)
+    {
+      unsigned long const base = table.base(column);
+      // Permute the coefficients, one cycle at a time.
+      for (int start : gate.cycle_starts())
       {
-        m_sum[i2] = v2[vi2];
-        // "Increment" i2.
-        int j = 0;
-        while (j < m_number_of_quantum_bits && ((mask = masks[j]) & i2))
-        {
-          i2 ^= mask;
-          ++j;
-        }
-        if (j == m_number_of_quantum_bits)
-          break;
-        i2 ^= masks[j];
+        Scalar first = std::move(m_sum[base | table.offset(start)]);
+        int row = start;
+        for (int col; (col = gate.column(row)) != start; row = col)
+          m_sum[base | table.offset(row)] = std::move(m_sum[base | table.offset(col)]);
+        m_sum[base | table.offset(row)] = std::move(first);
+      }
+      // Multiply with the non-zero entries, skipping those that are one.
+      for (int row = 0; row < size; ++row)
+      {
+        Scalar& coefficient = m_sum[base | table.offset(row)];
+        if (!gate.factor_is_one(row) && !coefficient.is_zero())
+          coefficient = gate.times_factor(row, coefficient);
       }
     }
-    // "Increment" i.
-    int j = 0; // Index into masks[];
-    while (j < m_number_of_quantum_bits && ((mask = masks[j]) & i))
+  });
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply_columns(matrixX_type const& matrix, IndexTable const& table)
+{
+  if (!m_dictionary)
+  {
+    apply_dense(matrix, table);
+    return;
+  }
+
+  using index_type = typename DictionaryVector<Scalar>::index_type;
+  ProductMemo<Scalar, matrixX_type> products(*m_dictionary, matrix);
+  unsigned long const rows = table.rows();
+  std::vector<index_type> v1(rows), v2(rows);
+  for (unsigned long column = 0; column < table.columns(); ++column)
+  {
+    unsigned long const base = table.base(column);
+    for (unsigned long row = 0; row < rows; ++row)
+      v1[row] = m_dictionary->index(base | table.offset(row));
+    for (unsigned long row = 0; row < rows; ++row)
+      v2[row] = products.row_times(row, v1.data());
+    for (unsigned long row = 0; row < rows; ++row)
+      m_dictionary->set_index(base | table.offset(row), v2[row]);
+  }
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply_dense(matrixX_type const& matrix, IndexTable const& table)
+{
+  unsigned long const rows = table.rows();
+  // The columns of the non-zero entries of each row of matrix.
+  std::vector<std::vector<unsigned long>> non_zero_columns(rows);
+  for (unsigned long row = 0; row < rows; ++row)
+    for (unsigned long col = 0; col < rows; ++col)
+      if (!matrix(row, col).is_zero())
+        non_zero_columns[row].push_back(col);
+
+  // Copy each column of coefficients to v1, and write matrix times v1 back to m_sum.
+  ThreadPool::instance().for_each_block(table.columns(), rows, [&](unsigned long begin, unsigned long end){
+    std::vector<Scalar> v1(rows);
+    for (unsigned long column = begin; column < end; ++column)
     {
-      i ^= mask;
-      ++j;
+      unsigned long const base = table.base(column);
+      for (unsigned long row = 0; row < rows; ++row)
+        v1[row] = std::move(m_sum[base | table.offset(row)]);
+      for (unsigned long row = 0; row < rows; ++row)
+      {
+        Scalar& result = m_sum[base | table.offset(row)];
+        result = Scalar{};
+        for (unsigned long col : non_zero_columns[row])
+          if (!v1[col].is_zero())
+            result += matrix(row, col) * v1[col];
+      }
     }
-    if (j == m_number_of_quantum_bits)
-      break;
-    i ^= masks[j];
+  });
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply_pairs(matrix_type const& matrix, unsigned long rowbit_mask, unsigned long first)
+{
+  for (unsigned long i0 = first; i0 < m_sum.size(); ++i0)
+  {
+    if ((i0 & rowbit_mask))
+      continue; // Handled as i1.
+    unsigned long const i1 = i0 | rowbit_mask;
+    Scalar result0 = mul_add(matrix(0, 0), m_sum[i0], matrix(0, 1), m_sum[i1]);
+    m_sum[i1] = mul_add(matrix(1, 0), m_sum[i0], matrix(1, 1), m_sum[i1]);
+    m_sum[i0] = std::move(result0);
   }
-  Dout(dc::notice, "Result: " << *this);
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::apply_sparse(matrixX_type const& matrix, IndexTable const& table)
+{
+  // Group the non-zero coefficients per column, where a column is determined by the unused bits
+  // and the used bits determine the row in the vector that the matrix works on.
+  struct Element
+  {
+    unsigned long column;               // The unused bits of the index.
+    unsigned long row;                  // The used bits of the index, in the order of the inputs.
+    Scalar const* coefficient;
+  };
+  unsigned long const used_mask = table.used_mask();
+  std::vector<Element> elements;
+  elements.reserve(m_sparse->size());
+  for (auto const& entry : *m_sparse)
+    elements.push_back({entry.first & ~used_mask, table.row_of(entry.first), &entry.second});
+  std::sort(elements.begin(), elements.end(), [](Element const& e1, Element const& e2){ return e1.column < e2.column; });
+
+  sparse_type new_coef;
+  unsigned long const rows = table.rows();
+  std::vector<Scalar const*> v1(rows);
+  for (auto element = elements.begin(); element != elements.end();)
+  {
+    unsigned long const column = element->column;
+    std::fill(v1.begin(), v1.end(), nullptr);
+    for (; element != elements.end() && element->column == column; ++element)
+      v1[element->row] = element->coefficient;
+    for (unsigned long row = 0; row < rows; ++row)
+    {
+      Scalar result;
+      for (unsigned long col = 0; col < rows; ++col)
+        if (v1[col] && !matrix(row, col).is_zero())
+          result += matrix(row, col) * *v1[col];
+      if (!result.is_zero())
+        new_coef.emplace_back(column | table.offset(row), std::move(result));
+    }
+  }
+  std::sort(new_coef.begin(), new_coef.end(), [](auto const& entry1, auto const& entry2){ return entry1.first < entry2.first; });
+  m_sparse->swap(new_coef);
 }
 
 static std::array<char const*, 10> subscript = { "\u2080", "\u2081", "\u2082", "\u2083", "\u2084", "\u2085", "\u2086", "\u2087", "\u2088", "\u2089" };
@@ -213,21 +964,547 @@ void print_subscript_on(std::ostream& os, int val)
   os << subscript[val];
 }
 
-void EntangledState::merge(EntangledState const& entangled_state)
+template<typename Scalar>
+void BasicEntangledState<Scalar>::merge(BasicEntangledState const& entangled_state)
+{
+  if (m_small && entangled_state.m_small && m_number_of_quantum_bits + entangled_state.m_number_of_quantum_bits <= small_amplitudes::max_qubits)
+  {
+    small_amplitudes::merge(*m_small, m_number_of_quantum_bits, *entangled_state.m_small, entangled_state.m_number_of_quantum_bits);
+    append_quantum_bits(entangled_state);
+    return;
+  }
+  if (entangled_state.is_converted() || entangled_state.m_small)
+  {
+    BasicEntangledState dense_copy(entangled_state);
+    dense_copy.make_dense();
+    merge(dense_copy);
+    return;
+  }
+  // Components that grow beyond small_amplitudes::max_qubits are promoted to the dynamic representation.
+  if (is_converted() || m_small)
+    make_dense();
+
+  unsigned long const rowbit_mod = 1UL << m_number_of_quantum_bits;
+  unsigned long const number_of_states = rowbit_mod << entangled_state.m_number_of_quantum_bits;
+
+  // The Kronecker product only has non-zero coefficients where both factors have one.
+  if (number_of_states >= sparse_min_size &&
+      number_of_non_zero_coefficients() * entangled_state.number_of_non_zero_coefficients() * sparse_ratio <= number_of_states)
+  {
+    sparse_type new_coef;
+    entangled_state.for_each_non_zero([&](unsigned long index2, Scalar const& coefficient2){
+      for_each_non_zero([&](unsigned long index1, Scalar const& coefficient1){
+        new_coef.emplace_back(index2 * rowbit_mod + index1, coefficient1 * coefficient2);
+      });
+    });
+    m_sum = std::vector<Scalar>();
+    m_dictionary.reset();
+    m_sparse = std::move(new_coef);
+  }
+  else
+  {
+    if (m_sparse)
+      make_dense();
+    // The result has at most lhs.number_of_values() * rhs.number_of_values() distinct values.
+    bool merged = false;
+    if (number_of_states >= dictionary_min_size)
+    {
+      unsigned long const max_values = number_of_states / dictionary_ratio;
+      DictionaryVector<Scalar> lhs(0), rhs_copy(0);
+      DictionaryVector<Scalar> const& rhs = entangled_state.m_dictionary ? *entangled_state.m_dictionary : rhs_copy;
+      bool fits = true;
+      if (m_dictionary)
+        lhs = std::move(*m_dictionary);
+      else
+        fits = lhs.assign(m_sum, max_values);
+      if (fits && entangled_state.m_sparse)
+      {
+        BasicEntangledState dense_copy(entangled_state);
+        dense_copy.make_dense();
+        fits = rhs_copy.assign(dense_copy.m_sum, max_values);
+      }
+      else if (fits && !entangled_state.m_dictionary)
+        fits = rhs_copy.assign(entangled_state.m_sum, max_values);
+      if (fits && lhs.number_of_values() * rhs.number_of_values() <= max_values)
+      {
+        using index_type = typename DictionaryVector<Scalar>::index_type;
+        index_type const unknown = static_cast<index_type>(-1);
+        std::vector<index_type> products(lhs.number_of_values() * rhs.number_of_values(), unknown);
+        DictionaryVector<Scalar> result(number_of_states);
+        for (unsigned long si = 0; si < number_of_states; ++si)
+        {
+          std::size_t const pi = lhs.index(si % rowbit_mod) * rhs.number_of_values() + rhs.index(si / rowbit_mod);
+          if (products[pi] == unknown)
+            products[pi] = result.intern(lhs[si % rowbit_mod] * rhs[si / rowbit_mod]);
+          result.set_index(si, products[pi]);
+        }
+        use_dictionary(std::move(result));
+        merged = true;
+      }
+      else if (m_dictionary)
+      {
+        m_sum = lhs.expand();
+        m_dictionary.reset();
+      }
+    }
+    if (!merged)
+    {
+      // Expand m_sum in place: resizing moves the existing coefficients (rather than copying them), and the new
+      // coefficients only read the first rowbit_mod coefficients, which are therefore overwritten last.
+      m_sum.resize(number_of_states);
+      ThreadPool::instance().for_each_block(number_of_states - rowbit_mod, 1, [&](unsigned long begin, unsigned long end){
+        for (unsigned long si = rowbit_mod + begin; si < rowbit_mod + end; ++si)
+          m_sum[si] = m_sum[si % rowbit_mod] * entangled_state.stored(si / rowbit_mod);
+      });
+      Scalar const& first_coefficient = entangled_state.stored(0);
+      for (unsigned long si = 0; si < rowbit_mod; ++si)
+        m_sum[si] *= first_coefficient;
+    }
+  }
+
+  append_quantum_bits(entangled_state);
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::append_quantum_bits(BasicEntangledState const& entangled_state)
 {
   for (q_index_type q_index : entangled_state.m_q_index)
     m_q_index.push_back(q_index);
-  unsigned long const rowbit_mod = 1UL << m_number_of_quantum_bits;
   m_number_of_quantum_bits += entangled_state.m_number_of_quantum_bits;
-  unsigned long const number_of_states = 1UL << m_number_of_quantum_bits;
-  std::vector<QuBitField> new_coef;
-  for (unsigned long si = 0; si < number_of_states; ++si)
-    new_coef.push_back(m_sum[si % rowbit_mod] * entangled_state.m_sum[si / rowbit_mod]);
-  m_sum.swap(new_coef);
   m_q_index_mask |= entangled_state.m_q_index_mask;
+  m_measurements.insert(m_measurements.end(), entangled_state.m_measurements.begin(), entangled_state.m_measurements.end());
+  m_sqrt_half_exponent += entangled_state.m_sqrt_half_exponent;
+  m_storage_check_countdown = storage_check_interval;
+  maybe_reduce();
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::sort_quantum_bits()
+{
+  // Also put the measurements in the order of their measurement qubit, that they will get when they are materialized.
+  std::stable_sort(m_measurements.begin(), m_measurements.end(), [](Measurement const& measurement1, Measurement const& measurement2){
+      return measurement1.q_index < measurement2.q_index; });
+  if (std::is_sorted(m_q_index.begin(), m_q_index.end()))
+    return;
+  int const number_of_quantum_bits = m_number_of_quantum_bits;
+  // The new rowbit i is the old rowbit from_rowbit[i].
+  std::vector<int> from_rowbit(number_of_quantum_bits);
+  std::iota(from_rowbit.begin(), from_rowbit.end(), 0);
+  std::sort(from_rowbit.begin(), from_rowbit.end(), [this](int rowbit1, int rowbit2){ return m_q_index[rowbit1] < m_q_index[rowbit2]; });
+  auto new_index = [&](unsigned long index){
+    unsigned long result = 0;
+    for (int i = 0; i < number_of_quantum_bits; ++i)
+      result |= ((index >> from_rowbit[i]) & 1UL) << i;
+    return result;
+  };
+  unsigned long const size = number_of_coefficients();
+  if (m_sparse)
+  {
+    for (auto& entry : *m_sparse)
+      entry.first = new_index(entry.first);
+    std::sort(m_sparse->begin(), m_sparse->end(), [](auto const& entry1, auto const& entry2){ return entry1.first < entry2.first; });
+  }
+  else if (m_small)
+  {
+    small_amplitudes::array_type<Scalar> small;
+    for (unsigned long index = 0; index < size; ++index)
+      small[new_index(index)] = std::move((*m_small)[index]);
+    m_small = std::move(small);
+  }
+  else
+  {
+    make_dense();
+    std::vector<Scalar> sum(size);
+    for (unsigned long index = 0; index < size; ++index)
+      sum[new_index(index)] = std::move(m_sum[index]);
+    m_sum.swap(sum);
+    // Let update_storage pick the storage mode again.
+    m_storage_check_countdown = 1;
+    update_storage();
+  }
+  q_index_container_type q_index;
+  for (int rowbit : from_rowbit)
+    q_index.push_back(m_q_index[rowbit]);
+  m_q_index = std::move(q_index);
+  m_rowbit_uses.clear();
 }
 
-void EntangledState::print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::maybe_relabel()
+{
+  // Gates on small states are cheap anyway, and m_sparse and m_small aren't indexed by product state.
+  if (m_number_of_quantum_bits < relabel_min_qubits || m_sparse || m_small || --m_relabel_countdown > 0)
+    return false;
+  m_relabel_countdown = relabel_interval;
+  m_rowbit_uses.resize(m_number_of_quantum_bits);
+  int const first_high_rowbit = m_number_of_quantum_bits - relabel_rowbits;
+  // The other rowbits from the most used to the least used, and the highest rowbits from the least used to the most used.
+  std::vector<int> low(first_high_rowbit);
+  std::vector<int> high(relabel_rowbits);
+  std::iota(low.begin(), low.end(), 0);
+  std::iota(high.begin(), high.end(), first_high_rowbit);
+  std::stable_sort(low.begin(), low.end(), [this](int rowbit1, int rowbit2){ return m_rowbit_uses[rowbit1] > m_rowbit_uses[rowbit2]; });
+  std::stable_sort(high.begin(), high.end(), [this](int rowbit1, int rowbit2){ return m_rowbit_uses[rowbit1] < m_rowbit_uses[rowbit2]; });
+  std::vector<int> low_rowbits;
+  std::vector<int> high_rowbits;
+  for (int j = 0; j < relabel_rowbits; ++j)
+  {
+    unsigned int const uses = m_rowbit_uses[low[j]];
+    if (uses < relabel_min_uses || uses <= 2 * m_rowbit_uses[high[j]])
+      break;
+    low_rowbits.push_back(low[j]);
+    high_rowbits.push_back(high[j]);
+  }
+  // Let older gates count less.
+  for (unsigned int& uses : m_rowbit_uses)
+    uses /= 2;
+  if (low_rowbits.empty())
+    return false;
+  swap_rowbits(low_rowbits, high_rowbits);
+  return true;
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::swap_rowbits(std::vector<int> const& low_rowbits, std::vector<int> const& high_rowbits)
+{
+  // Exchanging the rowbits is a transpose of every column of the IndexTable of those rowbits, seen as a square
+  // matrix with one side (the low rowbits) the row and the other (the high rowbits) the column. The coefficients of a
+  // column are close together along the low rowbits, so that moving a whole column at once is cache friendly.
+  int const number_of_swapped_rowbits = low_rowbits.size();
+  std::vector<unsigned long> masks;
+  for (int rowbit : low_rowbits)
+    masks.push_back(1UL << rowbit);
+  for (int rowbit : high_rowbits)
+    masks.push_back(1UL << rowbit);
+  IndexTable const table(masks, m_number_of_quantum_bits);
+  unsigned long const side = 1UL << number_of_swapped_rowbits;
+  auto transpose = [&](auto swap_coefficients){
+    ThreadPool::instance().for_each_block(table.columns(), table.rows(), [&](unsigned long begin, unsigned long end){
+      for (unsigned long column = begin; column < end; ++column)
+        for (unsigned long low = 0; low < side; ++low)
+          for (unsigned long high = low + 1; high < side; ++high)
+            swap_coefficients(table.index(column, low | high << number_of_swapped_rowbits), table.index(column, high | low << number_of_swapped_rowbits));
+    });
+  };
+  if (m_dictionary)
+    transpose([this](unsigned long i, unsigned long j){ m_dictionary->swap_elements(i, j); });
+  else if (m_planes)
+    transpose([this](unsigned long i, unsigned long j){ m_planes->swap_coefficients(i, j); });
+  else if (m_packed)
+    transpose([this](unsigned long i, unsigned long j){ m_packed->swap_coefficients(i, j); });
+  else
+    transpose([this](unsigned long i, unsigned long j){ std::swap(m_sum[i], m_sum[j]); });
+  for (int j = 0; j < number_of_swapped_rowbits; ++j)
+  {
+    std::swap(m_q_index[low_rowbits[j]], m_q_index[high_rowbits[j]]);
+    std::swap(m_rowbit_uses[low_rowbits[j]], m_rowbit_uses[high_rowbits[j]]);
+  }
+}
+
+template<typename Scalar>
+unsigned long BasicEntangledState<Scalar>::first_non_zero_index() const
+{
+  if (m_sparse)
+    return m_sparse->front().first;
+  unsigned long index = 0;
+  while (is_zero_coefficient(index))
+    ++index;
+  return index;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::factors_out(unsigned long rowbit_mask, unsigned long pivot) const
+{
+  if (is_converted())
+    return factors_out(rowbit_mask, pivot, [this](unsigned long index){ return converted_coefficient(index); });
+  return factors_out(rowbit_mask, pivot, [this](unsigned long index) -> Scalar const& { return stored(index); });
+}
+
+template<typename Scalar>
+template<typename Value>
+bool BasicEntangledState<Scalar>::factors_out(unsigned long rowbit_mask, unsigned long pivot, Value const& value) const
+{
+  // Write index as (s, t), where s are the bits of rowbit_mask and t the other bits; let (s₀, t₀) be the pivot.
+  // The coefficients c are a tensor product iff the matrix c(s, t) has rank one, that is, iff
+  // c(s, t)·c(s₀, t₀) = c(s, t₀)·c(s₀, t) for all s and t. That is checked without any division.
+  unsigned long const other_mask = ((1UL << m_number_of_quantum_bits) - 1) & ~rowbit_mask;
+  unsigned long const pivot_bits = pivot & rowbit_mask;
+  unsigned long const pivot_other_bits = pivot & other_mask;
+  auto const& pivot_coefficient = value(pivot);
+  auto has_rank_one = [&](unsigned long index, Scalar const& coefficient){
+    unsigned long const bits = index & rowbit_mask;
+    unsigned long const other_bits = index & other_mask;
+    if (bits == pivot_bits || other_bits == pivot_other_bits)
+      return true;
+    auto const& coefficient1 = value(bits | pivot_other_bits);
+    auto const& coefficient2 = value(pivot_bits | other_bits);
+    if (coefficient1.is_zero() || coefficient2.is_zero())
+      return coefficient.is_zero();
+    return !coefficient.is_zero() && coefficient * pivot_coefficient == coefficient1 * coefficient2;
+  };
+  if (m_sparse)
+  {
+    // The non-zero coefficients of a tensor product are at all combinations of the non-zero s and t, so
+    // checking those is enough, provided that the number of non-zero coefficients matches.
+    std::vector<unsigned long> all_bits, all_other_bits;
+    for (auto const& entry : *m_sparse)
+    {
+      all_bits.push_back(entry.first & rowbit_mask);
+      all_other_bits.push_back(entry.first & other_mask);
+    }
+    for (auto* bits : { &all_bits, &all_other_bits })
+    {
+      std::sort(bits->begin(), bits->end());
+      bits->erase(std::unique(bits->begin(), bits->end()), bits->end());
+    }
+    if (all_bits.size() * all_other_bits.size() != m_sparse->size())
+      return false;
+    for (auto const& entry : *m_sparse)
+      if (!has_rank_one(entry.first, entry.second))
+        return false;
+    return true;
+  }
+  unsigned long const size = number_of_coefficients();
+  for (unsigned long index = 0; index < size; ++index)
+    if (!has_rank_one(index, value(index)))
+      return false;
+  return true;
+}
+
+template<typename Scalar>
+BasicEntangledState<Scalar> BasicEntangledState<Scalar>::split_off(unsigned long rowbit_mask, unsigned long pivot)
+{
+  BasicEntangledState factor;
+  if constexpr (separation_supported)
+  {
+    unsigned long const other_mask = ((1UL << m_number_of_quantum_bits) - 1) & ~rowbit_mask;
+    unsigned long const pivot_bits = pivot & rowbit_mask;
+    unsigned long const pivot_other_bits = pivot & other_mask;
+    // With c(s, t) = f(s)·r(t), take f(s) = c(s, t₀)/c(s₀, t₀) and r(t) = c(s₀, t).
+    Scalar const pivot_inverse = (is_converted() ? converted_coefficient(pivot) : stored(pivot)).inverse();
+    sparse_type factor_coefficients;
+    sparse_type rest_coefficients;
+    for_each_non_zero([&](unsigned long index, Scalar const& coefficient){
+      if ((index & other_mask) == pivot_other_bits)
+        factor_coefficients.emplace_back(IndexTable::extract_bits(index, rowbit_mask), coefficient * pivot_inverse);
+      if ((index & rowbit_mask) == pivot_bits)
+        rest_coefficients.emplace_back(IndexTable::extract_bits(index, other_mask), coefficient);
+    });
+    // Normalize the factor when its norm is a power of two, moving the same factor √2 to the rest.
+    int factor_exponent = 0;
+    Scalar norm;
+    for (auto const& entry : factor_coefficients)
+      norm += entry.second * entry.second.conjugate();
+    if (!norm.is_power_of_two(factor_exponent))
+      factor_exponent = 0;
+    int rest_exponent = m_sqrt_half_exponent - factor_exponent;
+    for (auto [coefficients, exponent] : { std::make_pair(&factor_coefficients, &factor_exponent), std::make_pair(&rest_coefficients, &rest_exponent) })
+      if (*exponent < 0)
+      {
+        for (auto& entry : *coefficients)
+          entry.second = entry.second.times_sqrt_half(*exponent);
+        *exponent = 0;
+      }
+    q_index_container_type factor_q_index;
+    q_index_container_type rest_q_index;
+    for (int rowbit = 0; rowbit < m_number_of_quantum_bits; ++rowbit)
+      ((rowbit_mask & (1UL << rowbit)) ? factor_q_index : rest_q_index).push_back(m_q_index[rowbit]);
+    factor.assign(std::move(factor_q_index), std::move(factor_coefficients), factor_exponent);
+    assign(std::move(rest_q_index), std::move(rest_coefficients), rest_exponent);
+    // The measurements go with the qubits that their outcome depends on.
+    auto rest_measurements_end = std::stable_partition(m_measurements.begin(), m_measurements.end(),
+        [this](Measurement const& measurement){ return measurement.q_index_mask.intersects(m_q_index_mask); });
+    factor.m_measurements.assign(rest_measurements_end, m_measurements.end());
+    m_measurements.erase(rest_measurements_end, m_measurements.end());
+  }
+  return factor;
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::assign(q_index_container_type&& q_index, sparse_type&& coefficients, int sqrt_half_exponent)
+{
+  m_number_of_quantum_bits = q_index.size();
+  m_q_index = std::move(q_index);
+  m_q_index_mask = QIndexMask{};
+  for (q_index_type qi : m_q_index)
+    m_q_index_mask.set(qi);
+  m_sqrt_half_exponent = sqrt_half_exponent;
+  m_next_reduce_exponent = sqrt_half_exponent + reduce_interval;
+  m_sum = std::vector<Scalar>();
+  m_dictionary.reset();
+  m_sparse.reset();
+  m_planes.reset();
+  m_packed.reset();
+  m_small.reset();
+  m_index_tables.clear();
+  m_rowbit_uses.clear();
+  m_storage_check_countdown = storage_check_interval;
+  unsigned long const size = 1UL << m_number_of_quantum_bits;
+  if (size <= small_amplitudes::max_size)
+  {
+    m_small.emplace();
+    for (auto& entry : coefficients)
+      (*m_small)[entry.first] = std::move(entry.second);
+  }
+  else if (size >= sparse_min_size && coefficients.size() * sparse_ratio <= size)
+    m_sparse = std::move(coefficients);
+  else
+  {
+    m_sum.resize(size);
+    for (auto& entry : coefficients)
+      m_sum[entry.first] = std::move(entry.second);
+    // Let update_storage pick the storage mode.
+    m_storage_check_countdown = 1;
+    update_storage();
+  }
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::has_constant_parity(QIndexMask const& q_index_mask, bool& parity) const
+{
+  unsigned long rowbit_mask = 0;
+  for (int rowbit = 0; rowbit < m_number_of_quantum_bits; ++rowbit)
+    if (q_index_mask.test(m_q_index[rowbit]))
+      rowbit_mask |= 1UL << rowbit;
+  parity = __builtin_parityl(first_non_zero_index() & rowbit_mask);
+  bool constant = true;
+  for_each_non_zero([&](unsigned long index, Scalar const&){ constant = constant && __builtin_parityl(index & rowbit_mask) == parity; });
+  return constant;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::separate_measurements(QIndexMask const& factor_q_index_mask)
+{
+  for (Measurement& measurement : m_measurements)
+  {
+    QIndexMask const factor_part = measurement.q_index_mask & factor_q_index_mask;
+    QIndexMask const rest_part = measurement.q_index_mask - factor_q_index_mask;
+    if (factor_part.empty() || rest_part.empty())
+      continue;
+    bool parity;
+    if (has_constant_parity(factor_part, parity))
+      measurement.q_index_mask = rest_part;
+    else if (has_constant_parity(rest_part, parity))
+      measurement.q_index_mask = factor_part;
+    else
+      return false;
+    measurement.negated ^= parity;
+  }
+  return true;
+}
+
+template<typename Scalar>
+std::vector<BasicEntangledState<Scalar>> BasicEntangledState<Scalar>::separate(InputCollector const& inputs, QIndexMask const& measurement_mask)
+{
+  std::vector<BasicEntangledState> factors;
+  if constexpr (separation_supported)
+  {
+    // A gate can only disentangle the qubits on one side of a cut between its inputs (otherwise it acted on one
+    // side only, which can't change the entanglement between the sides). Try each input on its own, and the cuts
+    // between the lower and higher rowbits that separate the inputs: merge appends the rowbits of the merged state,
+    // so those cuts are between the states that were merged before.
+    bool split = true;
+    while (split && m_number_of_quantum_bits > 1)
+    {
+      unsigned long input_rowbits = 0;
+      for (int rowbit = 0; rowbit < m_number_of_quantum_bits; ++rowbit)
+        if (inputs.q_index_mask().test(m_q_index[rowbit]))
+          input_rowbits |= 1UL << rowbit;
+      std::vector<unsigned long> candidates;
+      for (unsigned long mask = input_rowbits; mask; mask &= mask - 1)
+        candidates.push_back(mask & -mask);
+      if (__builtin_popcountl(input_rowbits) > 1)
+        for (int rowbit = __builtin_ctzl(input_rowbits) + 1; rowbit <= 63 - __builtin_clzl(input_rowbits); ++rowbit)
+          candidates.push_back((1UL << rowbit) - 1);
+      unsigned long const pivot = first_non_zero_index();
+      split = false;
+      for (unsigned long rowbit_mask : candidates)
+      {
+        QIndexMask factor_q_index_mask;
+        for (unsigned long mask = rowbit_mask; mask; mask &= mask - 1)
+          factor_q_index_mask.set(m_q_index[__builtin_ctzl(mask)]);
+        if (factor_q_index_mask.is_subset_of(measurement_mask) || (m_q_index_mask - factor_q_index_mask).is_subset_of(measurement_mask))
+          continue;
+        if (factors_out(rowbit_mask, pivot) && separate_measurements(factor_q_index_mask))
+        {
+          factors.push_back(split_off(rowbit_mask, pivot));
+          std::vector<BasicEntangledState> more_factors = factors.back().separate(inputs, measurement_mask);
+          std::move(more_factors.begin(), more_factors.end(), std::back_inserter(factors));
+          split = true;
+          break;
+        }
+      }
+    }
+  }
+  return factors;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::starts_with_a_minus() const
+{
+  // The shared factor √½^m_sqrt_half_exponent is positive, so it doesn't change the sign.
+  if (m_sparse)
+    return !m_sparse->empty() && m_sparse->front().second.starts_with_a_minus();
+  for (unsigned long index = 0; index < number_of_coefficients(); ++index)
+    if (!is_zero_coefficient(index))
+      return is_converted() ? converted_coefficient(index).starts_with_a_minus() : stored(index).starts_with_a_minus();
+  return false;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::has_multiple_terms() const
+{
+  if (m_sparse)
+    return m_sparse->size() > 1;
+  int cnt = 0;
+  for (unsigned long index = 0; index < number_of_coefficients(); ++index)
+    if (!is_zero_coefficient(index) && ++cnt > 1)
+      return true;
+  return false;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::is_zero() const
+{
+  if (m_sparse)
+    return m_sparse->empty();
+  for (unsigned long index = 0; index < number_of_coefficients(); ++index)
+    if (!is_zero_coefficient(index))
+      return false;
+  return true;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::is_basis_state(q_index_type q_index, bool& value) const
+{
+  unsigned long const rowbit_mask = 1UL << rowbit(q_index);
+  value = (first_non_zero_index() & rowbit_mask) != 0;
+  unsigned long const other_value_bit = value ? 0 : rowbit_mask;
+  if (m_sparse)
+    return std::all_of(m_sparse->begin(), m_sparse->end(), [&](auto const& entry){ return (entry.first & rowbit_mask) != other_value_bit; });
+  // Run over the product states in which the qubit has the other value; those must all be zero.
+  unsigned long const low_mask = rowbit_mask - 1;
+  unsigned long const half_size = number_of_coefficients() / 2;
+  for (unsigned long i = 0; i < half_size; ++i)
+    if (!is_zero_coefficient(((i & ~low_mask) << 1) | other_value_bit | (i & low_mask)))
+      return false;
+  return true;
+}
+
+template<typename Scalar>
+bool BasicEntangledState<Scalar>::is_hadamard_basis_state(bool& minus) const
+{
+  // A measured qubit is entangled with its measurement qubit.
+  if (m_number_of_quantum_bits != 1 || !m_measurements.empty())
+    return false;
+  Scalar const coefficient0 = coefficient(0);
+  Scalar const coefficient1 = coefficient(1);
+  minus = coefficient0 != coefficient1;
+  return !minus || coefficient0 == -coefficient1;
+}
+
+template<typename Scalar>
+void BasicEntangledState<Scalar>::print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const
 {
   unsigned long const number_of_product_states = 1 << m_number_of_quantum_bits;
   if (number_of_product_states == 1)
@@ -237,57 +1514,53 @@ void EntangledState::print_on(std::ostream& os, bool negate_all_terms, bool is_f
   }
   //--------------------------------------------------------------------------
   // This is a copy of Sum::print_on, with some adjustments marked with a *).
-  bool const starts_with_a_minus_ = starts_with_a_minus() != negate_all_terms;
-  bool const has_multiple_terms_ = has_multiple_terms();
+  bool const starts_with_a_minus_ = this->starts_with_a_minus() != negate_all_terms;
+  bool const has_multiple_terms_ = this->has_multiple_terms();
   bool const needs_parens = has_multiple_terms_ && is_factor;
   bool const toggle_sign_all_terms = (needs_parens && starts_with_a_minus_) != negate_all_terms;
   if (needs_parens)
     os << '(';
   bool first_term = true;
-  auto first = m_sum.begin();
-  unsigned long state = 0;      // *) Added.
-  do
-  {
-    if (!formula::is_zero(*first))
-    {
-      if (!first_term)
-        os << (formula::starts_with_a_minus(*first) != toggle_sign_all_terms ? " - " : " + ");
+  // *) Was a loop over m_sum that skipped zero terms.
+  for_each_non_zero([&](unsigned long state, Scalar const& stored_amplitude){
+    Scalar const amplitude = folded(stored_amplitude);  // *) Added.
+    if (!first_term)
+      os << (formula::starts_with_a_minus(amplitude) != toggle_sign_all_terms ? " - " : " + ");
 #if 1                           // *) Added.
-      if (first->is_unity())
-        os << '|';
-      else
-      {
+    if (amplitude.is_unity())
+      os << '|';
+    else
+    {
 #endif
-        print_formula_on(*first, os, toggle_sign_all_terms, true /* *) was false */);
+      print_formula_on(amplitude, os, toggle_sign_all_terms, true /* *) was false */);
 #if 1                           // *) Added.
-        os << "\u00b7|"; // "·|"
-      }
-      for (int i = m_number_of_quantum_bits - 1; i >= 0; --i)
-      {
-        int mask = 1 << i;
-        os << ((state & mask) ? '1' : '0');
-        print_subscript_on(os, m_q_index[i].get_value());
-      }
-      os << "\u27e9"; // "⟩"
-#endif
-      first_term = false;
+      os << "\u00b7|"; // "·|"
     }
-    ++state;                    // * Added.
-  }
-  while (++first != m_sum.end());
+    for (int i = m_number_of_quantum_bits - 1; i >= 0; --i)
+    {
+      int mask = 1 << i;
+      os << ((state & mask) ? '1' : '0');
+      print_subscript_on(os, m_q_index[i].get_value());
+    }
+    os << "\u27e9"; // "⟩"
+#endif
+    first_term = false;
+  });
   if (needs_parens)
     os << ')';
   //--------------------------------------------------------------------------
 }
 
-class MeasurementEntangledProductState : public formula::Product<std::array<QuBitField, 1>>
+template<typename Scalar>
+class MeasurementEntangledProductState : public formula::Product<std::array<Scalar, 1>>
 {
  private:
+  using formula::Product<std::array<Scalar, 1>>::m_product;
   std::map<int, char> m_product_state;
 
  public:
-  MeasurementEntangledProductState(QuBitField const& amplitude, std::map<int, char>&& product_state) :
-    formula::Product<std::array<QuBitField, 1>>({ amplitude }), m_product_state(std::move(product_state)) { }
+  MeasurementEntangledProductState(Scalar const& amplitude, std::map<int, char>&& product_state) :
+    formula::Product<std::array<Scalar, 1>>({ amplitude }), m_product_state(std::move(product_state)) { }
 
   bool starts_with_a_minus() const override { return m_product[0].starts_with_a_minus(); }
   bool is_zero() const override { return m_product[0].is_zero(); }
@@ -303,20 +1576,20 @@ class MeasurementEntangledProductState : public formula::Product<std::array<QuBi
   }
 };
 
-class MeasurementEntangledSubState : public formula::Sum<std::vector<MeasurementEntangledProductState>>
+template<typename Scalar>
+class MeasurementEntangledSubState : public formula::Sum<std::vector<MeasurementEntangledProductState<Scalar>>>
 {
  public:
   // Construct an empty State, with no product states yet :).
-  MeasurementEntangledSubState() : formula::Sum<std::vector<MeasurementEntangledProductState>>({}) { }
+  MeasurementEntangledSubState() : formula::Sum<std::vector<MeasurementEntangledProductState<Scalar>>>({}) { }
 
-  void add(QuBitField const& amplitude, std::map<int, char>&& product_state) { m_sum.emplace_back(amplitude, std::move(product_state)); }
+  void add(Scalar const& amplitude, std::map<int, char>&& product_state) { this->m_sum.emplace_back(amplitude, std::move(product_state)); }
 };
 
-void EntangledState::print_measurement_permutations_on(std::ostream& os, Circuit const* circuit) const
+template<typename Scalar>
+void BasicEntangledState<Scalar>::print_measurement_permutations_on(std::ostream& os, Circuit const* circuit) const
 {
-  unsigned long const all_measurements_mask = circuit->get_measurement_mask();
-  using measurement_mask_type = utils::BitSet<unsigned long>;   // A bitset of measurement bits.
-  using measurement_bit_type = utils::bitset::Index;            // The index of a single measurement bit.
+  QIndexMask const& all_measurements_mask = circuit->get_measurement_mask();
   // For example, suppose we have 19 qubits and 10 measurement bits:
   //
   //                        22222222211111111110000000000 } -- q_index runs from 0 to 28.
@@ -332,7 +1605,7 @@ void EntangledState::print_measurement_permutations_on(std::ostream& os, Circuit
   //                   2    00100000000000000000000000000
 
   // The measurement bits that take part in this EntangledState.
-  measurement_mask_type const measurement_mask{m_q_index_mask & all_measurements_mask};
+  QIndexMask const measurement_mask = m_q_index_mask & all_measurements_mask;
 
   using rowbit_mask_type = utils::BitSet<unsigned long>;        // A bitset of rowbit bits.
   using rowbit_type = utils::bitset::Index;                     // The index of a single rowbit bit (usually just called 'rowbit' despite that it is an index).
@@ -347,16 +1620,15 @@ void EntangledState::print_measurement_permutations_on(std::ostream& os, Circuit
   rowbit_type const rowbit_begin = utils::bitset::index_begin;
   rowbit_type const rowbit_end = utils::bitset::IndexPOD{number_of_rowbits};
 
-  // Convert the measurement bits in m_q_index to a vector of measurement_bit_type.
-  std::vector<std::pair<measurement_bit_type, rowbit_type>> measurement_bits;   // A list of the q_index (as measurement_bit_type) / rowbit index
-                                                                                // pairs of measurement bits involved in this EntangledState.
+  // Collect the measurement bits in m_q_index.
+  std::vector<std::pair<q_index_type, rowbit_type>> measurement_bits;   // A list of the q_index / rowbit index pairs
+                                                                        // of measurement bits involved in this EntangledState.
   rowbit_mask_type rowbit_measurements_mask;                    // A mask with all of those bits.
   rowbit_measurements_mask.reset();
   for (rowbit_type rowbit{rowbit_begin}; rowbit != rowbit_end; ++rowbit)
   {
-    // Convert the rowbit into the corresponding q_index, as measurement_bit_type.
-    int8_t const quantum_register_index = m_q_index[rowbit()].get_value();
-    measurement_bit_type const q_index = utils::bitset::IndexPOD{quantum_register_index};
+    // Convert the rowbit into the corresponding q_index.
+    q_index_type const q_index = m_q_index[rowbit()];
     // When it is actually a measurement bit (and not a normal qubit), store it:
     if (measurement_mask.test(q_index))
     {
@@ -386,10 +1658,6 @@ void EntangledState::print_measurement_permutations_on(std::ostream& os, Circuit
   perm_type const perm_begin = utils::bitset::index_begin;
   perm_type const perm_end = utils::bitset::IndexPOD{number_of_measurement_bits};
 
-  // The row range.
-  rowbit_mask_type const row_begin{rowbit_mask_type::mask_type(0)};
-  rowbit_mask_type const row_end{rowbit_mask_type::mask_type(1) << number_of_rowbits};
-
   // Run over all measurement permutations.
   perm_mask_type const measurement_bit_permutation_end{perm_mask_type::mask_type(1) << number_of_measurement_bits};
   perm_mask_type measurement_bit_permutation{perm_mask_type::mask_type(0)};
@@ -410,60 +1678,39 @@ void EntangledState::print_measurement_permutations_on(std::ostream& os, Circuit
       }
       else
         c = '0';
-      size_t measurement_bit_q_index_val = measurement_bits[i()].first();
-      q_index_type measurement_bit_q_index(measurement_bit_q_index_val);
-      classical_bits[circuit->classical_index(measurement_bit_q_index)] = c;
+      classical_bits[circuit->classical_index(measurement_bits[i()].first)] = c;
     }
     std::string prefix = "\n";
     for (auto&& classical_bit : adaptor::reversed(classical_bits))
       prefix += classical_bit.second + subscript_str(classical_bit.first);
     prefix += ": ";
-    MeasurementEntangledSubState mess;
-    // Run over all possible rows to find those that correspond with this permutation.
-    for (rowbit_mask_type row{row_begin}; row != row_end; ++row)
-    {
+    MeasurementEntangledSubState<Scalar> mess;
+    // Run over all rows that exist (have a non-zero coefficient) to find those that correspond with this permutation.
+    for_each_non_zero([&](unsigned long index, Scalar const& stored_amplitude){
+      rowbit_mask_type const row{static_cast<rowbit_mask_type::mask_type>(index)};
       // Only consider the product states of this measurement permutation.
       if ((row & rowbit_measurements_mask) == measurement_bits_permutation_mask)
       {
-        // Don't print anything if it doesn't exist.
-        if (m_sum[row()].is_zero())
-          continue;
         std::map<int, char> product_state;
         for (rowbit_type rowbit{rowbit_begin}; rowbit != rowbit_end; ++rowbit)
         {
           char c = row.test(rowbit) ? '1' : '0';
-          int8_t const quantum_register_index = m_q_index[rowbit()].get_value();
-          measurement_bit_type const q_index = utils::bitset::IndexPOD{quantum_register_index};
+          q_index_type const q_index = m_q_index[rowbit()];
           // When it is not a measurement bit, store it:
           if (!measurement_mask.test(q_index))
-            product_state[quantum_register_index] = c;
+            product_state[q_index.get_value()] = c;
         }
-        mess.add(m_sum[row()], std::move(product_state));
+        mess.add(folded(stored_amplitude), std::move(product_state));
       }
-    }
+    });
     os << prefix << mess;
   }
 }
 
-void swap(EntangledState& lhs, EntangledState& rhs)
-{
-  std::swap(lhs.m_number_of_quantum_bits, rhs.m_number_of_quantum_bits);
-  std::swap(lhs.m_q_index_mask, rhs.m_q_index_mask);
-  std::swap(lhs.m_sum, rhs.m_sum);
-  std::swap(lhs.m_q_index, rhs.m_q_index);
-}
-
-bool operator!=(EntangledState const& lhs, EntangledState const& rhs)
-{
-  // This shouldn't be called when the number of quantum bits differ;
-  // that is dangerous as it might still be equal after merging the
-  // EntangledState with another first.
-  assert(lhs.m_number_of_quantum_bits == rhs.m_number_of_quantum_bits);
-  // Same thing.
-  assert(lhs.m_q_index_mask == rhs.m_q_index_mask);
-  // Sorry, not implemented yet.
-  assert(lhs.m_q_index == rhs.m_q_index);
-  return lhs.m_sum != rhs.m_sum;
-}
+// Explicit instantiations.
+template class BasicEntangledState<QuBitField>;
+template class BasicEntangledState<QuBitRing>;
+template class BasicEntangledState<QuBitModular>;
+template class BasicEntangledState<QuBitComplex>;
 
 } // namespace quantum
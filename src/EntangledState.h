@@ -3,46 +3,363 @@
 #include "QuBitField.h"
 #include "Circuit.h"
 #include "InputCollector.h"
+#include "GateMatrix.h"
+#include "DictionaryVector.h"
+#include "AmplitudePlanes.h"
+#include "PackedAmplitudes.h"
+#include "SmallAmplitudes.h"
+#include "IndexTable.h"
 #include "formula.h"
+#include <boost/container/small_vector.hpp>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <vector>
 
 namespace quantum {
 
-class EntangledState : public formula::Sum<std::vector<QuBitField>> // List of all 2^m_number_of_quantum_bits coefficients of each product state.
+// The coefficients of all 2^m_number_of_quantum_bits product states of a number of entangled qubits.
+//
+// Scalar is the type that is used for the coefficients (amplitudes). It must be a formula
+// (derived from formula::Sum) that supports exact arithmetic, like QuBitField (the default)
+// or QuBitRing.
+//
+// All coefficients share a single factor √½^m_sqrt_half_exponent that is not stored in m_sum.
+// Gates are applied as GateMatrix, with their common factor √½ pulled out, so that for
+// example H only adds and subtracts coefficients and increments m_sqrt_half_exponent.
+// Common factors √2 are only divided out of the coefficients again when printing,
+// comparing or when m_sqrt_half_exponent grew by reduce_interval.
+//
+// Large states that only have a few distinct coefficients are stored as a DictionaryVector
+// (m_dictionary) instead of in m_sum. In that mode a gate is applied by calculating the
+// result once per distinct pair (or column) of input values and the products with the
+// gate entries are memoized.
+//
+// States in which most coefficients are zero (for example after measurements whose outcome
+// is stored as an extra qubit) are stored sparse instead (m_sparse): only the non-zero coefficients,
+// sorted by product state index. Gates and merge then only visit those.
+//
+// Large QuBitField states that stay in a subfield (for example real states, that only
+// ever use the component k of k + l·i + (m + n·i)·√½) are stored as AmplitudePlanes
+// (m_planes): one vector per component, where the components that are zero everywhere
+// are not stored and not calculated.
+//
+// Large QuBitField states whose coefficients are in ℤ[ω, 1/√2] (all states of Clifford+T
+// circuits) are stored as PackedAmplitudes (m_packed) for as long as their numerators fit
+// in an int64_t: H, X, Y, Z, S, T and CX are then applied with vectorized integer
+// additions and shuffles. A gate that would overflow is finished with exact arithmetic
+// after switching back to m_sum.
+//
+// States of at most small_amplitudes::max_qubits qubits (most of them) store their coefficients
+// inline (m_small) and use kernels that are unrolled for their size (see SmallAmplitudes.h).
+// They are promoted to one of the other storage modes when they grow larger.
+//
+// The storage mode is switched automatically.
+//
+// The rowbit of a qubit is determined by the order in which states were merged. The gate kernels
+// run over contiguous runs of 2^rowbit pairs of coefficients: a gate on a low rowbit pays the
+// loop overhead of a run for every few coefficients, while a gate on a high rowbit streams
+// through two long runs. Large states count the gates per rowbit and every so often move the
+// qubits that most gates were applied to (the hot qubits) to the highest rowbits (see maybe_relabel).
+//
+// A measurement doesn't add its measurement qubit to the state (see measure): the outcome
+// is a function of the qubits of the state, the parity of some of them, for as long as only
+// gates that map product states to product states (X, Z, S, T, CX, ...) were applied to
+// those qubits. Only a gate like H turns the outcome into an extra qubit (materialize).
+template<typename Scalar>
+class BasicEntangledState : public formula::Sum<std::vector<Scalar>> // List of all 2^m_number_of_quantum_bits coefficients of each product state.
 {
+ public:
+  using scalar_type = Scalar;
+  using matrix_type = Eigen::Matrix<Scalar, 2, 2>;                              // QMatrix when Scalar is QuBitField.
+  using matrixX_type = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;  // QMatrixX when Scalar is QuBitField.
+
  private:
+  using base_type = formula::Sum<std::vector<Scalar>>;
+  using base_type::m_sum;
+  using sparse_type = std::vector<std::pair<unsigned long, Scalar>>;    // Pairs of product state index and coefficient.
+  using q_index_container_type = boost::container::small_vector<q_index_type, small_amplitudes::max_qubits>;
+
+  // The outcome of a measurement, as far as it isn't stored as a qubit of this state.
+  struct Measurement
+  {
+    q_index_type q_index;               // The measurement qubit that would store the outcome.
+    QIndexMask q_index_mask;            // The outcome is the parity of the qubits in this mask,
+    bool negated;                       // inverted if this is true.
+  };
+
   int m_number_of_quantum_bits;         // The number of entangled qubits that this object represents.
-  std::vector<q_index_type> m_q_index;  // Maps rowbit to q_index_type.
-  unsigned long m_q_index_mask;         // Has a bit set for each q_index_type in m_q_index;
+  q_index_container_type m_q_index;     // Maps rowbit to q_index_type.
+  QIndexMask m_q_index_mask;            // Has a bit set for each q_index_type in m_q_index;
+  int m_sqrt_half_exponent;             // All coefficients in m_sum must still be multiplied with √½^m_sqrt_half_exponent.
+  int m_next_reduce_exponent;           // Call reduce() when m_sqrt_half_exponent reaches this value.
+  std::optional<DictionaryVector<Scalar>> m_dictionary; // If set, this contains the coefficients and m_sum is empty.
+  std::optional<sparse_type> m_sparse;  // If set, this contains the non-zero coefficients, sorted by index, and m_sum is empty.
+  std::optional<AmplitudePlanes> m_planes;      // If set, this contains the coefficients, per component, and m_sum is empty.
+  std::optional<PackedAmplitudes> m_packed;     // If set, this contains the coefficients as int64_t numerators, and m_sum is empty.
+  std::optional<small_amplitudes::array_type<Scalar>> m_small;  // If set, this contains the coefficients of a small state, and m_sum is empty.
+  int m_storage_check_countdown;        // The number of gates until the next attempt to switch to a DictionaryVector.
+  std::size_t m_compact_at;             // Compact m_dictionary when its table reaches this size.
+  std::vector<std::shared_ptr<IndexTable const>> m_index_tables;        // The most recently used index tables, most recent first.
+  std::vector<Measurement> m_measurements;      // The measurements whose outcomes are not stored as qubits, in the order that they were done.
+  boost::container::small_vector<unsigned int, small_amplitudes::max_qubits> m_rowbit_uses;     // The (decaying) number of gates applied to each rowbit; only counted for large states.
+  int m_relabel_countdown;              // The number of calls to maybe_relabel until the next one that considers relabeling.
+
+  // Coefficients roughly grow with a factor √2 for every increment of m_sqrt_half_exponent.
+  // Try to divide out common factors every so many increments, to keep them small.
+  static constexpr int reduce_interval = 32;
+
+  // Only states with at least dictionary_min_size coefficients are stored in a DictionaryVector,
+  // and only when at most one in dictionary_ratio of the coefficients is distinct.
+  // Twice that many distinct coefficients make it switch back to m_sum.
+  static constexpr unsigned long dictionary_min_size = 64;
+  static constexpr unsigned long dictionary_ratio = 8;
+  // Likewise, states with at least sparse_min_size coefficients are stored sparse when at most
+  // one in sparse_ratio of the coefficients is non-zero, until twice that many are.
+  static constexpr unsigned long sparse_min_size = 16;
+  static constexpr unsigned long sparse_ratio = 4;
+  // The number of gates between two attempts to switch to a DictionaryVector.
+  static constexpr int storage_check_interval = 16;
+  // Only QuBitField states are stored as AmplitudePlanes; when they have at least planes_min_size
+  // coefficients and at most planes_max_non_zero of the four components are non-zero.
+  static constexpr bool planes_supported = std::is_same<Scalar, QuBitField>::value;
+  static constexpr unsigned long planes_min_size = 64;
+  static constexpr int planes_max_non_zero = 2;
+  // Likewise, only QuBitField states with at least packed_min_size coefficients are stored as PackedAmplitudes.
+  static constexpr bool packed_supported = planes_supported;
+  static constexpr unsigned long packed_min_size = 64;
+  // The number of index tables that are kept for reuse by the next gates.
+  static constexpr std::size_t index_table_cache_size = 4;
+  // Only QuBitField states are split into factors (see separate), because that takes an exact division.
+  static constexpr bool separation_supported = planes_supported;
+  // Only states with at least relabel_min_qubits qubits are relabeled, at most once every relabel_interval gates.
+  // A qubit is moved to one of the highest relabel_rowbits rowbits when it was used at least relabel_min_uses
+  // times and more than twice as often as the qubit that it is exchanged with.
+  static constexpr int relabel_min_qubits = 20;
+  static constexpr int relabel_rowbits = 4;
+  static constexpr int relabel_interval = 64;
+  static constexpr unsigned int relabel_min_uses = 8;
 
  private:
   // Return the rowbit that corresponds to q_index. Only call when has(q_index) is true.
   int rowbit(q_index_type q_index) const;
 
+  // Divide common factors √2 out of all coefficients, decrementing m_sqrt_half_exponent accordingly.
+  void reduce();
+  // Call reduce() if m_sqrt_half_exponent grew large enough.
+  void maybe_reduce() { if (m_sqrt_half_exponent >= m_next_reduce_exponent) reduce(); }
+
+  // Return the stored coefficient of product state index, without the factor √½^m_sqrt_half_exponent.
+  Scalar const& stored(unsigned long index) const
+  {
+    return m_small ? (*m_small)[index] : m_dictionary ? (*m_dictionary)[index] : m_sparse ? sparse_coefficient(index) : m_sum[index];
+  }
+  // Return stored_coefficient multiplied with √½^m_sqrt_half_exponent.
+  Scalar folded(Scalar const& stored_coefficient) const { return m_sqrt_half_exponent == 0 ? stored_coefficient : stored_coefficient.times_sqrt_half(m_sqrt_half_exponent); }
+  // Return a pointer to the coefficient of product state index in m_sparse, or nullptr if it is zero.
+  Scalar const* find_sparse(unsigned long index) const;
+  // Same as stored(index), but only call when m_sparse is set.
+  Scalar const& sparse_coefficient(unsigned long index) const;
+  // Return true if the coefficients are not stored as Scalar (m_planes or m_packed is set).
+  bool is_converted() const { return m_planes || m_packed; }
+  // Return the stored coefficient of product state index; only call when is_converted() returns true.
+  Scalar converted_coefficient(unsigned long index) const;
+  // Return true if the coefficient of product state index is zero.
+  bool is_zero_coefficient(unsigned long index) const { return m_planes ? m_planes->is_zero(index) : m_packed ? m_packed->is_zero(index) : stored(index).is_zero(); }
+  // Call f(index, stored(index)) for every non-zero coefficient, in increasing order of index.
+  template<typename F>
+  void for_each_non_zero(F f) const;
+  // Return the number of non-zero coefficients.
+  unsigned long number_of_non_zero_coefficients() const;
+
+  // Switch between m_sum, m_dictionary and m_sparse, if that seems beneficial.
+  void update_storage();
+  // Use m_dictionary as storage from now on.
+  void use_dictionary(DictionaryVector<Scalar>&& dictionary);
+  // Use m_sparse as storage from now on.
+  void make_sparse();
+  // Use m_planes as storage from now on, if the coefficients are in a subfield.
+  void make_planes();
+  // Use m_packed as storage from now on, if the coefficients are in ℤ[ω, 1/√2] and their numerators fit.
+  void make_packed();
+  // Add the qubits of entangled_state (whose coefficients were just merged into this object).
+  void append_quantum_bits(BasicEntangledState const& entangled_state);
+  // Use m_small as storage from now on. Only call when m_sum is used and the state is small enough.
+  void make_small();
+  // Use m_sum as storage from now on.
+  void make_dense();
+  // Count a gate applied to the rowbits of rowbit_mask, if this state is large enough to be relabeled.
+  void count_uses(unsigned long rowbit_mask)
+  {
+    if (m_number_of_quantum_bits < relabel_min_qubits)
+      return;
+    m_rowbit_uses.resize(m_number_of_quantum_bits);
+    for (; rowbit_mask; rowbit_mask &= rowbit_mask - 1)
+      ++m_rowbit_uses[__builtin_ctzl(rowbit_mask)];
+  }
+  // Exchange rowbit low_rowbits[j] with rowbit high_rowbits[j] for every j, where the low rowbits are less than the high ones.
+  void swap_rowbits(std::vector<int> const& low_rowbits, std::vector<int> const& high_rowbits);
+  // Return the IndexTable for a gate whose input j is on the rowbit(s) masks[j], reusing a recently used one if possible.
+  IndexTable const& index_table(std::vector<unsigned long> const& masks);
+  // The implementation of apply for monomial gates; table lists the columns of the gate.
+  template<typename Matrix>
+  void apply_monomial(GateMatrix<Matrix> const& gate, IndexTable const& table);
+  // The implementation of apply for dense gates, for m_sum and m_dictionary.
+  void apply_columns(matrixX_type const& matrix, IndexTable const& table);
+  // The implementation of apply_columns for m_sum.
+  void apply_dense(matrixX_type const& matrix, IndexTable const& table);
+  // Apply matrix to the pairs (i0, i0 | rowbit_mask) of m_sum, starting with i0 = first.
+  void apply_pairs(matrix_type const& matrix, unsigned long rowbit_mask, unsigned long first);
+  // The implementation of apply for m_sparse.
+  void apply_sparse(matrixX_type const& matrix, IndexTable const& table);
+
+  // Return the index of the first non-zero coefficient.
+  unsigned long first_non_zero_index() const;
+  // Return true if the qubits of rowbit_mask factor out, where pivot is the index of a non-zero coefficient.
+  bool factors_out(unsigned long rowbit_mask, unsigned long pivot) const;
+  // The implementation of factors_out, where value(index) returns the stored coefficient of index.
+  template<typename Value>
+  bool factors_out(unsigned long rowbit_mask, unsigned long pivot, Value const& value) const;
+  // Replace this state with the factor of the qubits that are not in rowbit_mask and return the factor of those
+  // that are. Only call when factors_out(rowbit_mask, pivot) returned true.
+  BasicEntangledState split_off(unsigned long rowbit_mask, unsigned long pivot);
+  // Replace this state with the non-zero coefficients coefficients (sorted by index) of the qubits q_index (in order of rowbit).
+  void assign(q_index_container_type&& q_index, sparse_type&& coefficients, int sqrt_half_exponent);
+
+  // Update m_measurements for gate, applied to the qubits input_q_indices (one per gate input), before it is applied.
+  // The outcomes that depend on those qubits are still parities afterwards if gate maps product states to product states
+  // (affinely); the others are materialized first.
+  template<typename Matrix>
+  void update_measurements(GateMatrix<Matrix> const& gate, std::vector<q_index_type> const& input_q_indices);
+  // Add the measurement qubit of measurement to this state, in the state that its outcome is in.
+  void materialize(Measurement const& measurement);
+  // Return true if the parity of the qubits in q_index_mask is the same in every product state with a non-zero coefficient; store it in parity.
+  bool has_constant_parity(QIndexMask const& q_index_mask, bool& parity) const;
+  // Make the outcome of every measurement depend on the qubits of factor_q_index_mask only, or on the other qubits only, by dropping
+  // the qubits on one side when their parity is constant. Returns false if that isn't possible for some measurement.
+  bool separate_measurements(QIndexMask const& factor_q_index_mask);
+
  public:
   // Default constructor.
-  EntangledState() : formula::Sum<std::vector<QuBitField>>{{}}, m_number_of_quantum_bits(0) { }
+  BasicEntangledState() : base_type{{}}, m_number_of_quantum_bits(0), m_sqrt_half_exponent(0), m_next_reduce_exponent(reduce_interval),
+    m_storage_check_countdown(0), m_compact_at(0), m_relabel_countdown(relabel_interval) { }
   // Construct an EntangledState for a single qubit in the |0⟩ state (so yeah, it isn't entangled).
-  EntangledState(q_index_type quantum_register_index) :
-    formula::Sum<std::vector<QuBitField>>{{1, 0}}, m_number_of_quantum_bits(1), m_q_index{quantum_register_index}, m_q_index_mask(1UL << quantum_register_index.get_value()) { }
+  BasicEntangledState(q_index_type quantum_register_index) :
+    base_type{{}}, m_number_of_quantum_bits(1), m_q_index{quantum_register_index}, m_q_index_mask(quantum_register_index),
+    m_sqrt_half_exponent(0), m_next_reduce_exponent(reduce_interval), m_small(std::in_place),
+    m_storage_check_countdown(0), m_compact_at(0), m_relabel_countdown(relabel_interval) { (*m_small)[0] = Scalar(1); }
+
+  void merge(BasicEntangledState const& entangled_state);
+
+  bool has(q_index_type q_index) const { return m_q_index_mask.test(q_index); }
+  void apply(GateMatrix<matrix_type> const& gate, q_index_type chain) { apply(gate, chain, rowbit(chain)); }
+  // Same, when the rowbit of chain is already known (see ComponentRegistry).
+  void apply(GateMatrix<matrix_type> const& gate, q_index_type chain, int chain_rowbit);
 
-  void merge(EntangledState const& entangled_state);
+  bool has(InputCollector const& collector) const { return m_q_index_mask.intersects(collector.q_index_mask()); }
+  void apply(GateMatrix<matrixX_type> const& gate, InputCollector const& inputs);
 
-  bool has(q_index_type q_index) const { return (m_q_index_mask & (1UL << q_index.get_value())) != 0; }
-  void apply(QMatrix const& matrix, q_index_type chain);
+  // Reorder the rowbits so that m_q_index is in increasing order.
+  void sort_quantum_bits();
+  // Move the qubits that recent gates were mostly applied to into the highest rowbits, if that seems worth it.
+  // Returns true if the rowbits were changed (see ComponentRegistry).
+  bool maybe_relabel();
 
-  bool has(InputCollector const& collector) const { return (m_q_index_mask & collector.q_index_mask()) != 0; }
-  void apply(QMatrixX const& matrix, InputCollector const& inputs);
+  // Split off the qubits that are no longer entangled with the rest after a multi-input gate on inputs.
+  // Returns the factors that were split off; this state keeps the remaining qubits. Every factor keeps
+  // at least one qubit that is not in measurement_mask, so that measurement results stay with their qubits.
+  std::vector<BasicEntangledState> separate(InputCollector const& inputs, QIndexMask const& measurement_mask);
 
-  void print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const;
+  // Measure qubit q_index: record its outcome as the value of measurement qubit measurement_q_index.
+  // That is the same as a CNOT with q_index as control and measurement_q_index (in the state |0⟩) as target,
+  // but the measurement qubit isn't added to the state until that is needed.
+  void measure(q_index_type q_index, q_index_type measurement_q_index);
+  // Add the measurement qubits of all measurements to this state (this is what the state looks like with them).
+  void materialize_measurements();
+  // Return true if this state has measurements whose outcomes are not stored as qubits.
+  bool has_measurements() const { return !m_measurements.empty(); }
+
+  // Return true if qubit q_index has the same value in every product state with a non-zero coefficient,
+  // so that it is exactly |0⟩ or |1⟩ and not entangled with the other qubits; store that value in value.
+  bool is_basis_state(q_index_type q_index, bool& value) const;
+  // Return true if this is a single qubit that is exactly |+⟩ or |−⟩; store whether it is |−⟩ in minus.
+  bool is_hadamard_basis_state(bool& minus) const;
+
+  // For printing (override virtual functions of formula::Sum).
+  bool starts_with_a_minus() const override;
+  bool has_multiple_terms() const override;
+  bool is_zero() const override;
+  bool is_unity() const override { return coefficient(0).is_unity(); }
+  void print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const override;
   void print_measurement_permutations_on(std::ostream& os, Circuit const* circuit) const;
 
   // Accessor for m_q_index_mask.
-  unsigned long q_index_mask() const { return m_q_index_mask; }
+  QIndexMask const& q_index_mask() const { return m_q_index_mask; }
+  // Accessor for m_number_of_quantum_bits.
+  int number_of_quantum_bits() const { return m_number_of_quantum_bits; }
+  // Return the qubit that corresponds to rowbit.
+  q_index_type q_index(int rowbit) const { return m_q_index[rowbit]; }
 
-  friend bool operator!=(EntangledState const& rhs, EntangledState const& lhs);
+  // Return the number of coefficients (2^m_number_of_quantum_bits).
+  unsigned long number_of_coefficients() const
+  {
+    return m_small || m_sparse ? 1UL << m_number_of_quantum_bits : m_dictionary ? m_dictionary->size() : m_planes ? m_planes->size() : m_packed ? m_packed->size() : m_sum.size();
+  }
+  // Return the coefficient of product state index, including the shared factor √½^m_sqrt_half_exponent.
+  Scalar coefficient(unsigned long index) const { return is_converted() ? folded(converted_coefficient(index)) : folded(stored(index)); }
+  // Return true if the coefficients are stored in a DictionaryVector.
+  bool uses_dictionary() const { return m_dictionary.has_value(); }
+  // Return true if only the non-zero coefficients are stored.
+  bool is_sparse() const { return m_sparse.has_value(); }
+  // Return true if the coefficients are stored per component.
+  bool uses_planes() const { return m_planes.has_value(); }
+  // Return true if the coefficients are stored as int64_t numerators.
+  bool uses_packed() const { return m_packed.has_value(); }
+  // Return true if the coefficients are stored inline.
+  bool is_small() const { return m_small.has_value(); }
 
-  friend void swap(EntangledState& lhs, EntangledState& rhs);
+  friend bool operator!=(BasicEntangledState const& lhs, BasicEntangledState const& rhs)
+  {
+    // This shouldn't be called when the number of quantum bits differ;
+    // that is dangerous as it might still be equal after merging the
+    // EntangledState with another first.
+    assert(lhs.m_number_of_quantum_bits == rhs.m_number_of_quantum_bits);
+    // Same thing.
+    assert(lhs.m_q_index_mask == rhs.m_q_index_mask);
+    // Sorry, not implemented yet.
+    assert(lhs.m_q_index == rhs.m_q_index);
+    if (lhs.m_sqrt_half_exponent == rhs.m_sqrt_half_exponent && !lhs.m_dictionary && !rhs.m_dictionary && !lhs.m_sparse && !rhs.m_sparse &&
+        !lhs.is_converted() && !rhs.is_converted() && !lhs.m_small && !rhs.m_small)
+      return lhs.m_sum != rhs.m_sum;
+    for (unsigned long index = 0; index < lhs.number_of_coefficients(); ++index)
+      if (lhs.coefficient(index) != rhs.coefficient(index))
+        return true;
+    return false;
+  }
+
+  friend void swap(BasicEntangledState& lhs, BasicEntangledState& rhs)
+  {
+    std::swap(lhs.m_number_of_quantum_bits, rhs.m_number_of_quantum_bits);
+    std::swap(lhs.m_q_index_mask, rhs.m_q_index_mask);
+    std::swap(lhs.m_sum, rhs.m_sum);
+    std::swap(lhs.m_q_index, rhs.m_q_index);
+    std::swap(lhs.m_sqrt_half_exponent, rhs.m_sqrt_half_exponent);
+    std::swap(lhs.m_next_reduce_exponent, rhs.m_next_reduce_exponent);
+    std::swap(lhs.m_dictionary, rhs.m_dictionary);
+    std::swap(lhs.m_sparse, rhs.m_sparse);
+    std::swap(lhs.m_planes, rhs.m_planes);
+    std::swap(lhs.m_packed, rhs.m_packed);
+    std::swap(lhs.m_small, rhs.m_small);
+    std::swap(lhs.m_storage_check_countdown, rhs.m_storage_check_countdown);
+    std::swap(lhs.m_compact_at, rhs.m_compact_at);
+    std::swap(lhs.m_index_tables, rhs.m_index_tables);
+    std::swap(lhs.m_measurements, rhs.m_measurements);
+    std::swap(lhs.m_rowbit_uses, rhs.m_rowbit_uses);
+    std::swap(lhs.m_relabel_countdown, rhs.m_relabel_countdown);
+  }
 };
 
+// The exact representation, using QuBitField coefficients, as used by State.
+using EntangledState = BasicEntangledState<QuBitField>;
+
 } // namespace quantum
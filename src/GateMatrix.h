@@ -0,0 +1,159 @@
+#pragma once
+
+#include "QuBitField.h"
+#include "QuBitRing.h"
+#include "QuBitModular.h"
+#include "QuBitComplex.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace quantum {
+
+namespace detail {
+
+// The exponent of √2 in the denominator of a gate matrix entry.
+inline int sqrt2_exponent(QuBitRing const& entry) { return entry.sqrt2_exponent(); }
+inline int sqrt2_exponent(QuBitField const& entry) { return QuBitRing(entry).sqrt2_exponent(); }
+// Only a bound, but exact for entries that were converted from a QuBitRing or QuBitField.
+inline int sqrt2_exponent(QuBitModular const& entry) { return entry.sqrt2_exponent(); }
+// Don't pull factors √½ out of approximations; those are simply multiplied.
+inline int sqrt2_exponent(QuBitComplex const&) { return 0; }
+
+} // namespace detail
+
+// The classification of a gate matrix.
+enum gate_matrix_kind_t
+{
+  identity_matrix,      // The identity.
+  diagonal_matrix,      // Only non-zero entries on the diagonal (Z, S, T, ...).
+  permutation_matrix,   // Exactly one entry equal to one per row and column, the rest is zero (X, Controlled_X, ...).
+  monomial_matrix,      // Exactly one non-zero entry per row and column (Y, ...).
+  dense_matrix          // Anything else (H, ...).
+};
+
+// A gate matrix, prepared once for being applied to an EntangledState.
+//
+// The matrix is decomposed as √½^m_sqrt_half_exponent · m_unscaled, where the
+// common factor √½^m_sqrt_half_exponent is pulled out of all entries. For example,
+// H = √½ · [[1, 1], [1, -1]]. An EntangledState keeps a single shared √½ exponent
+// for all of its coefficients, so that applying H only needs additions and subtractions
+// and then increments that exponent.
+//
+// Moreover, the matrix is classified once (see gate_matrix_kind_t). Only dense
+// matrices need a matrix multiplication; the others are applied by permuting the
+// coefficients and/or multiplying them with a single entry (unless that is one).
+template<typename Matrix>
+class GateMatrix
+{
+ public:
+  using matrix_type = Matrix;
+  using scalar_type = typename Matrix::Scalar;
+
+ private:
+  matrix_type m_unscaled;               // The matrix, without the common factor.
+  int m_sqrt_half_exponent;             // The matrix is √½^m_sqrt_half_exponent · m_unscaled.
+  gate_matrix_kind_t m_kind;            // The classification of m_unscaled.
+  // The following are only valid for monomial matrices (all kinds except dense_matrix).
+  std::vector<int> m_column;            // The column of the non-zero entry, per row.
+  std::vector<int> m_row;               // The row of the non-zero entry, per column.
+  std::vector<char> m_factor_is_one;    // Whether the non-zero entry is one, per row.
+  std::vector<int> m_omega_power;       // The n such that the non-zero entry is ω^n, or -1 if it isn't a power of ω = e^{iπ/4}, per row.
+  std::vector<int> m_cycle_starts;      // The smallest row of each cycle (of length larger than one) of the permutation m_column.
+
+  void classify();
+
+ public:
+  explicit GateMatrix(matrix_type const& matrix);
+
+  // Accessors.
+  matrix_type const& unscaled() const { return m_unscaled; }
+  int sqrt_half_exponent() const { return m_sqrt_half_exponent; }
+  gate_matrix_kind_t kind() const { return m_kind; }
+
+  // Return true if every row and column has exactly one non-zero entry.
+  bool is_monomial() const { return m_kind != dense_matrix; }
+
+  // The following may only be called when is_monomial() returns true.
+  // Row r of the matrix times a vector v is factor(r) · v[column(r)].
+
+  // Return the number of rows.
+  int size() const { return m_column.size(); }
+  // Return the column of the non-zero entry of row.
+  int column(int row) const { return m_column[row]; }
+  // Return the row of the non-zero entry of column.
+  int row(int column) const { return m_row[column]; }
+  // Return the non-zero entry of row.
+  scalar_type const& factor(int row) const { return m_unscaled(row, m_column[row]); }
+  // Return true if the non-zero entry of row is one.
+  bool factor_is_one(int row) const { return m_factor_is_one[row]; }
+  // Return n if the non-zero entry of row is ω^n, or -1 if it is not a power of ω = e^{iπ/4}.
+  int omega_power(int row) const { return m_omega_power[row]; }
+  // Return coefficient times the non-zero entry of row.
+  scalar_type times_factor(int row, scalar_type const& coefficient) const
+  {
+    return m_omega_power[row] == -1 ? factor(row) * coefficient : coefficient.times_omega(m_omega_power[row]);
+  }
+  // Return the smallest row of every non-trivial cycle of the permutation.
+  std::vector<int> const& cycle_starts() const { return m_cycle_starts; }
+};
+
+template<typename Matrix>
+GateMatrix<Matrix>::GateMatrix(matrix_type const& matrix) : m_unscaled(matrix), m_sqrt_half_exponent(std::numeric_limits<int>::max())
+{
+  // Every non-zero entry has at least this many factors √½.
+  for (Eigen::Index i = 0; i < matrix.size(); ++i)
+    if (!matrix(i).is_zero())
+      m_sqrt_half_exponent = std::min(m_sqrt_half_exponent, detail::sqrt2_exponent(matrix(i)));
+  if (m_sqrt_half_exponent == std::numeric_limits<int>::max())
+    m_sqrt_half_exponent = 0;
+  for (Eigen::Index i = 0; i < matrix.size(); ++i)
+    m_unscaled(i) = matrix(i).times_sqrt_half(-m_sqrt_half_exponent);
+  classify();
+}
+
+template<typename Matrix>
+void GateMatrix<Matrix>::classify()
+{
+  int const size = m_unscaled.rows();
+  m_column.assign(size, -1);
+  m_row.assign(size, -1);
+  m_factor_is_one.assign(size, false);
+  m_omega_power.assign(size, -1);
+  m_kind = dense_matrix;
+  for (int row = 0; row < size; ++row)
+    for (int col = 0; col < size; ++col)
+    {
+      if (m_unscaled(row, col).is_zero())
+        continue;
+      // More than one non-zero entry in this row or column?
+      if (m_column[row] != -1 || m_row[col] != -1)
+        return;
+      m_column[row] = col;
+      m_row[col] = row;
+      m_factor_is_one[row] = m_unscaled(row, col) == scalar_type(1);
+      for (int n = 0; n < 8; ++n)
+        if (m_unscaled(row, col) == scalar_type(1).times_omega(n))
+          m_omega_power[row] = n;
+    }
+  bool is_diagonal = true;
+  bool is_permutation = true;
+  for (int row = 0; row < size; ++row)
+  {
+    // A row with only zeroes.
+    if (m_column[row] == -1)
+      return;
+    is_diagonal = is_diagonal && m_column[row] == row;
+    is_permutation = is_permutation && m_factor_is_one[row];
+    // Is this the smallest row of a non-trivial cycle?
+    int r = m_column[row];
+    while (r > row)
+      r = m_column[r];
+    if (r == row && m_column[row] != row)
+      m_cycle_starts.push_back(row);
+  }
+  m_kind = is_diagonal ? (is_permutation ? identity_matrix : diagonal_matrix) : is_permutation ? permutation_matrix : monomial_matrix;
+}
+
+} // namespace quantum
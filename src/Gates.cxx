@@ -164,6 +164,19 @@ QMatrix const I{I_init};
 // Controlled-NOT matrix.
 QMatrixX const Controlled_X = Eigen::Matrix<QuBitField, 4, 4>{CX_init};
 
+std::array<GateMatrix<QMatrix>, number_of_gates> const gate_matrices = {
+  GateMatrix<QMatrix>{gate[X]},
+  GateMatrix<QMatrix>{gate[Y]},
+  GateMatrix<QMatrix>{gate[Z]},
+  GateMatrix<QMatrix>{gate[S]},
+  GateMatrix<QMatrix>{gate[S_inv]},
+  GateMatrix<QMatrix>{gate[T]},
+  GateMatrix<QMatrix>{gate[T_inv]},
+  GateMatrix<QMatrix>{gate[H]}
+};
+
+GateMatrix<QMatrixX> const Controlled_X_matrix{Controlled_X};
+
 } // namespace gates
 
 } // namespace quantum
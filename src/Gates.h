@@ -2,7 +2,9 @@
 
 #include "QMatrix.h"
 #include "QMatrixX.h"
+#include "GateMatrix.h"
 #include <array>
+#include <vector>
 
 namespace quantum {
 namespace gates {
@@ -29,6 +31,40 @@ extern QMatrix const I;
 
 extern QMatrixX const Controlled_X;
 
+// The same gates, prepared for EntangledState::apply.
+extern std::array<GateMatrix<QMatrix>, number_of_gates> const gate_matrices;
+extern GateMatrix<QMatrixX> const Controlled_X_matrix;
+
+// The same gates, with coefficients converted to Scalar.
+template<typename Scalar>
+class GateMatrices
+{
+ public:
+  using matrix_type = Eigen::Matrix<Scalar, 2, 2>;
+  using matrixX_type = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+  std::vector<GateMatrix<matrix_type>> gate;    // Indexed by gate_t.
+  GateMatrix<matrixX_type> Controlled_X;
+
+ private:
+  GateMatrices();
+
+ public:
+  // Return the gates for Scalar; these are converted on first use.
+  static GateMatrices const& instance()
+  {
+    static GateMatrices const gate_matrices;
+    return gate_matrices;
+  }
+};
+
+template<typename Scalar>
+GateMatrices<Scalar>::GateMatrices() : Controlled_X(gates::Controlled_X.cast<Scalar>())
+{
+  for (int g = 0; g < number_of_gates; ++g)
+    gate.emplace_back(gates::gate[g].cast<Scalar>());
+}
+
 } // namespace gates
 
 using gates::gate;
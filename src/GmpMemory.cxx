@@ -0,0 +1,211 @@
+#include "sys.h"
+#include "GmpMemory.h"
+#include "debug.h"
+#include <gmp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace quantum {
+
+namespace {
+
+constexpr std::size_t number_of_size_classes = GmpMemory::max_pooled_size / GmpMemory::granularity;
+
+GmpMemory::mode_type s_mode = GmpMemory::gmp_default;
+
+std::atomic<uint64_t> s_allocations;
+std::atomic<uint64_t> s_reallocations;
+std::atomic<uint64_t> s_frees;
+std::atomic<uint64_t> s_mallocs;
+
+void count(std::atomic<uint64_t>& counter)
+{
+  counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* checked(void* ptr)
+{
+  // GMP doesn't expect its memory functions to fail.
+  if (!ptr)
+    DoutFatal(dc::core, "GmpMemory: out of memory");
+  return ptr;
+}
+
+std::size_t round_up(std::size_t size)
+{
+  return (size + GmpMemory::granularity - 1) & ~(GmpMemory::granularity - 1);
+}
+
+// The free blocks of one thread, one singly linked list per size class.
+// The link to the next block is stored in the first bytes of each free block.
+struct FreeLists
+{
+  void* m_head[number_of_size_classes] = {};
+  int m_count[number_of_size_classes] = {};
+
+  void release();
+  ~FreeLists();
+};
+
+// Trivially destructible, so that it can still be tested after the FreeLists of this thread were destroyed.
+thread_local bool tl_free_lists_destroyed = false;
+thread_local FreeLists tl_free_lists;
+
+void FreeLists::release()
+{
+  for (std::size_t c = 0; c < number_of_size_classes; ++c)
+  {
+    while (m_head[c])
+    {
+      void* next = *static_cast<void**>(m_head[c]);
+      std::free(m_head[c]);
+      m_head[c] = next;
+    }
+    m_count[c] = 0;
+  }
+}
+
+FreeLists::~FreeLists()
+{
+  release();
+  tl_free_lists_destroyed = true;
+}
+
+void* counting_allocate(std::size_t size)
+{
+  count(s_allocations);
+  count(s_mallocs);
+  return checked(std::malloc(size));
+}
+
+void* counting_reallocate(void* ptr, std::size_t UNUSED_ARG(old_size), std::size_t new_size)
+{
+  count(s_reallocations);
+  count(s_mallocs);
+  return checked(std::realloc(ptr, new_size));
+}
+
+void counting_free(void* ptr, std::size_t UNUSED_ARG(size))
+{
+  count(s_frees);
+  std::free(ptr);
+}
+
+// Pooled blocks are allocated with a size that is rounded up to a multiple of the granularity.
+// A block is only put on a free list when the size that it is freed with is such a multiple:
+// then it is at least that large, no matter who allocated it.
+
+void* pool_allocate(std::size_t size)
+{
+  std::size_t const rounded_size = round_up(size);
+  if (rounded_size == 0 || rounded_size > GmpMemory::max_pooled_size || tl_free_lists_destroyed)
+  {
+    count(s_mallocs);
+    return checked(std::malloc(size));
+  }
+  std::size_t const c = rounded_size / GmpMemory::granularity - 1;
+  FreeLists& free_lists = tl_free_lists;
+  void* ptr = free_lists.m_head[c];
+  if (!ptr)
+  {
+    count(s_mallocs);
+    return checked(std::malloc(rounded_size));
+  }
+  free_lists.m_head[c] = *static_cast<void**>(ptr);
+  --free_lists.m_count[c];
+  return ptr;
+}
+
+void pool_free(void* ptr, std::size_t size)
+{
+  if (size % GmpMemory::granularity == 0 && size != 0 && size <= GmpMemory::max_pooled_size && !tl_free_lists_destroyed)
+  {
+    std::size_t const c = size / GmpMemory::granularity - 1;
+    FreeLists& free_lists = tl_free_lists;
+    if (free_lists.m_count[c] < GmpMemory::max_free_blocks)
+    {
+      *static_cast<void**>(ptr) = free_lists.m_head[c];
+      free_lists.m_head[c] = ptr;
+      ++free_lists.m_count[c];
+      return;
+    }
+  }
+  std::free(ptr);
+}
+
+void* pooled_allocate(std::size_t size)
+{
+  count(s_allocations);
+  return pool_allocate(size);
+}
+
+void* pooled_reallocate(void* ptr, std::size_t old_size, std::size_t new_size)
+{
+  count(s_reallocations);
+  // Nothing to do if the block already has the right size class.
+  if (old_size % GmpMemory::granularity == 0 && round_up(new_size) == old_size)
+    return ptr;
+  if (old_size > GmpMemory::max_pooled_size && new_size > GmpMemory::max_pooled_size)
+  {
+    count(s_mallocs);
+    return checked(std::realloc(ptr, new_size));
+  }
+  void* new_ptr = pool_allocate(new_size);
+  std::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+  pool_free(ptr, old_size);
+  return new_ptr;
+}
+
+void pooled_free(void* ptr, std::size_t size)
+{
+  count(s_frees);
+  pool_free(ptr, size);
+}
+
+} // namespace
+
+void GmpMemory::set_mode(mode_type mode)
+{
+  switch (mode)
+  {
+    case gmp_default:
+      mp_set_memory_functions(nullptr, nullptr, nullptr);
+      break;
+    case counting:
+      mp_set_memory_functions(&counting_allocate, &counting_reallocate, &counting_free);
+      break;
+    case pooled:
+      mp_set_memory_functions(&pooled_allocate, &pooled_reallocate, &pooled_free);
+      break;
+  }
+  s_mode = mode;
+}
+
+GmpMemory::mode_type GmpMemory::mode()
+{
+  return s_mode;
+}
+
+GmpMemory::Counters GmpMemory::counters()
+{
+  return { s_allocations.load(std::memory_order_relaxed), s_reallocations.load(std::memory_order_relaxed),
+    s_frees.load(std::memory_order_relaxed), s_mallocs.load(std::memory_order_relaxed) };
+}
+
+void GmpMemory::reset_counters()
+{
+  s_allocations = 0;
+  s_reallocations = 0;
+  s_frees = 0;
+  s_mallocs = 0;
+}
+
+void GmpMemory::release_free_blocks()
+{
+  if (!tl_free_lists_destroyed)
+    tl_free_lists.release();
+}
+
+} // namespace quantum
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace quantum {
+
+// Opt-in replacement of the memory functions of GMP.
+//
+// The limbs of every big number (the mpq_rational of a Rational, the mpz_int of an Integer)
+// are allocated with the memory functions of GMP, which default to malloc, realloc and free.
+// Merging EntangledStates or applying a gate to a large state therefore does many tiny
+// allocations. GmpMemory can replace those functions by ones that count every call
+// (counting), or that also serve blocks of up to max_pooled_size bytes from free lists,
+// per size class, that are local to the calling thread (pooled).
+//
+// Every block still comes from malloc, so that memory that was allocated before the mode
+// was changed, or that was allocated by another thread, can safely be freed by any of them.
+// The mode may not be changed while other threads are using GMP.
+class GmpMemory
+{
+ public:
+  enum mode_type
+  {
+    gmp_default,        // Use the memory functions that GMP started with.
+    counting,           // Use malloc, realloc and free, but count every call.
+    pooled              // Count every call and recycle small blocks through thread-local free lists.
+  };
+
+  struct Counters
+  {
+    uint64_t allocations;       // The number of blocks that GMP allocated.
+    uint64_t reallocations;     // The number of blocks that GMP resized.
+    uint64_t frees;             // The number of blocks that GMP freed.
+    uint64_t mallocs;           // The number of those calls that had to call malloc or realloc.
+  };
+
+  static constexpr std::size_t granularity = 8;         // The size classes are multiples of this (the size of a limb).
+  static constexpr std::size_t max_pooled_size = 256;   // Larger blocks are never pooled.
+  static constexpr int max_free_blocks = 4096;          // The maximum number of free blocks kept per size class and thread.
+
+  // Replace the memory functions of GMP.
+  static void set_mode(mode_type mode);
+  // Return the current mode.
+  static mode_type mode();
+
+  // Return the counters, summed over all threads, since the last call to reset_counters.
+  static Counters counters();
+  static void reset_counters();
+
+  // Give the free blocks of the calling thread back to malloc.
+  static void release_free_blocks();
+};
+
+// Use a given GmpMemory mode during the lifetime of this object.
+class GmpMemoryScope
+{
+ private:
+  GmpMemory::mode_type m_previous_mode;
+
+ public:
+  GmpMemoryScope(GmpMemory::mode_type mode) : m_previous_mode(GmpMemory::mode()) { GmpMemory::set_mode(mode); }
+  ~GmpMemoryScope() { GmpMemory::set_mode(m_previous_mode); }
+
+  GmpMemoryScope(GmpMemoryScope const&) = delete;
+  GmpMemoryScope& operator=(GmpMemoryScope const&) = delete;
+};
+
+} // namespace quantum
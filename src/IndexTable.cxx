@@ -0,0 +1,105 @@
+#include "sys.h"
+#include "IndexTable.h"
+#include "debug.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace quantum {
+
+namespace {
+
+unsigned long deposit_bits_generic(unsigned long value, unsigned long mask)
+{
+  unsigned long result = 0;
+  for (unsigned long bit = 1; mask; bit <<= 1)
+  {
+    unsigned long const lowest = mask & -mask;
+    if ((value & bit))
+      result |= lowest;
+    mask ^= lowest;
+  }
+  return result;
+}
+
+unsigned long extract_bits_generic(unsigned long value, unsigned long mask)
+{
+  unsigned long result = 0;
+  for (unsigned long bit = 1; mask; bit <<= 1)
+  {
+    unsigned long const lowest = mask & -mask;
+    if ((value & lowest))
+      result |= bit;
+    mask ^= lowest;
+  }
+  return result;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2")))
+unsigned long deposit_bits_bmi2(unsigned long value, unsigned long mask)
+{
+  return _pdep_u64(value, mask);
+}
+
+__attribute__((target("bmi2")))
+unsigned long extract_bits_bmi2(unsigned long value, unsigned long mask)
+{
+  return _pext_u64(value, mask);
+}
+#endif
+
+} // namespace
+
+//static
+unsigned long IndexTable::deposit_bits(unsigned long value, unsigned long mask)
+{
+#if defined(__x86_64__)
+  static bool const have_bmi2 = __builtin_cpu_supports("bmi2");
+  if (have_bmi2)
+    return deposit_bits_bmi2(value, mask);
+#endif
+  return deposit_bits_generic(value, mask);
+}
+
+//static
+unsigned long IndexTable::extract_bits(unsigned long value, unsigned long mask)
+{
+#if defined(__x86_64__)
+  static bool const have_bmi2 = __builtin_cpu_supports("bmi2");
+  if (have_bmi2)
+    return extract_bits_bmi2(value, mask);
+#endif
+  return extract_bits_generic(value, mask);
+}
+
+IndexTable::IndexTable(std::vector<unsigned long> const& masks, int number_of_quantum_bits) :
+  m_masks(masks), m_number_of_quantum_bits(number_of_quantum_bits), m_used_mask(0)
+{
+  int const number_of_inputs = masks.size();
+  for (unsigned long mask : masks)
+    m_used_mask |= mask;
+  ASSERT(number_of_inputs <= number_of_quantum_bits && __builtin_popcountl(m_used_mask) == number_of_inputs);
+
+  unsigned long const rows = 1UL << number_of_inputs;
+  m_offset.resize(rows);
+  m_row.resize(rows);
+  for (unsigned long row = 0; row < rows; ++row)
+  {
+    // Bit j of row goes to masks[j].
+    unsigned long offset = 0;
+    for (int j = 0; j < number_of_inputs; ++j)
+      if ((row & (1UL << j)))
+        offset |= masks[j];
+    m_offset[row] = offset;
+    m_row[extract_bits(offset, m_used_mask)] = row;
+  }
+
+  unsigned long const all_bits = (1UL << number_of_quantum_bits) - 1;
+  unsigned long const unused_mask = all_bits & ~m_used_mask;
+  m_base.resize(1UL << (number_of_quantum_bits - number_of_inputs));
+  for (unsigned long column = 0; column < m_base.size(); ++column)
+    m_base[column] = deposit_bits(column, unused_mask);
+}
+
+} // namespace quantum
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+namespace quantum {
+
+// The indices of the coefficients that a gate works on, for a given choice of input rowbits.
+//
+// A gate with number_of_inputs inputs works on columns of 2^number_of_inputs coefficients:
+// all coefficients whose indices only differ in the "used" bits (the rowbit masks of the inputs).
+// Row r of a column is the coefficient whose used bits are the bits of r, where bit j of r is
+// the bit of input j. The index of row r of column c is base(c) | offset(r), where base(c) is c
+// scattered over the "unused" bits (PDEP) and offset(r) the bits of r scattered over the masks of
+// the inputs. Conversely, row_of(index) gathers the used bits of index back into a row (PEXT).
+//
+// Both tables only depend on the masks and the number of qubits, so that an EntangledState
+// can reuse them for all gates on the same qubits.
+class IndexTable
+{
+ private:
+  std::vector<unsigned long> m_masks;   // The rowbit mask of each input.
+  int m_number_of_quantum_bits;         // The number of qubits of the state.
+  unsigned long m_used_mask;            // All bits of m_masks.
+  std::vector<unsigned long> m_offset;  // The used bits of each row.
+  std::vector<unsigned long> m_base;    // The unused bits of each column.
+  std::vector<int> m_row;               // The row that corresponds to the used bits of an index, in increasing order of significance.
+
+ public:
+  IndexTable(std::vector<unsigned long> const& masks, int number_of_quantum_bits);
+
+  // Return true if this table was constructed with the same arguments.
+  bool matches(std::vector<unsigned long> const& masks, int number_of_quantum_bits) const { return number_of_quantum_bits == m_number_of_quantum_bits && masks == m_masks; }
+
+  // Return the number of rows of a column.
+  unsigned long rows() const { return m_offset.size(); }
+  // Return the number of columns.
+  unsigned long columns() const { return m_base.size(); }
+  // Return the mask with the bits of all inputs.
+  unsigned long used_mask() const { return m_used_mask; }
+  // Return the index of the first coefficient of column.
+  unsigned long base(unsigned long column) const { return m_base[column]; }
+  // Return the used bits of row.
+  unsigned long offset(unsigned long row) const { return m_offset[row]; }
+  // Return the index of row in column.
+  unsigned long index(unsigned long column, unsigned long row) const { return m_base[column] | m_offset[row]; }
+  // Return the row that index is in.
+  unsigned long row_of(unsigned long index) const { return m_row[extract_bits(index, m_used_mask)]; }
+
+  // Return the lowest bits of value, scattered over the set bits of mask (PDEP).
+  static unsigned long deposit_bits(unsigned long value, unsigned long mask);
+  // Return the bits of value at the set bits of mask, gathered into the lowest bits (PEXT).
+  static unsigned long extract_bits(unsigned long value, unsigned long mask);
+};
+
+} // namespace quantum
@@ -1,5 +1,6 @@
 #include "sys.h"
 #include "InputCollector.h"
+#include "debug.h"
 #include <iostream>
 
 namespace quantum {
@@ -12,6 +13,16 @@ int InputCollector::chain_to_rowbit(q_index_type chain) const
   return iter->second;
 }
 
+q_index_type InputCollector::rowbit_to_chain(int rowbit) const
+{
+  for (auto&& m : m_chain_to_rowbit_map)
+    if (m.second == rowbit)
+      return m.first;
+  // Don't call this function for a rowbit that wasn't added.
+  ASSERT(false);
+  return {};
+}
+
 std::ostream& operator<<(std::ostream& os, InputCollector const& input_collector)
 {
   char const* prefix = "{";
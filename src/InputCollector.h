@@ -25,20 +25,20 @@ class InputCollector
   using chain_to_rowbit_map_type = std::map<q_index_type, int>;
   q_index_type m_start_chain;                           // This gate was first encountered on this chain.
   chain_to_rowbit_map_type m_chain_to_rowbit_map;       // Map qubit index to row bit (index).
-  unsigned long m_q_index_mask;                         // A mask with bits set for each q_index in m_chain_to_rowbit_map.
+  QIndexMask m_q_index_mask;                            // A mask with bits set for each q_index in m_chain_to_rowbit_map.
 
  public:
-  InputCollector() : m_q_index_mask(0) { }
-  InputCollector(q_index_type start_chain) : m_start_chain(start_chain), m_q_index_mask(0) { }
+  InputCollector() { }
+  InputCollector(q_index_type start_chain) : m_start_chain(start_chain) { }
 
   // Return true iff all inputs where collected (default constructed object will return false).
   bool have_all_inputs(q_index_type& current_chain) const { return current_chain == m_start_chain; }
 
   // Remember which qubit (chain) corresponds to which (matrix) row bit.
-  void add(q_index_type chain, int rowbit) { m_chain_to_rowbit_map[chain] = rowbit; m_q_index_mask |= 1UL << chain.get_value(); }
+  void add(q_index_type chain, int rowbit) { m_chain_to_rowbit_map[chain] = rowbit; m_q_index_mask.set(chain); }
 
   // Accessor for the mask.
-  unsigned long q_index_mask() const { return m_q_index_mask; }
+  QIndexMask const& q_index_mask() const { return m_q_index_mask; }
 
   // Accessor for number of inputs / rowbits.
   size_t number_of_inputs() const { return m_chain_to_rowbit_map.size(); }
@@ -46,6 +46,9 @@ class InputCollector
   // Accessor from chain to mapped rowbit. Returns -1 if the chain doesn't exist.
   int chain_to_rowbit(q_index_type chain) const;
 
+  // Accessor from rowbit to the chain that was mapped to it. Only call for a rowbit that exists.
+  q_index_type rowbit_to_chain(int rowbit) const;
+
   friend std::ostream& operator<<(std::ostream& os, InputCollector const& input_collector);
 };
 
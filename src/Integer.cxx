@@ -0,0 +1,50 @@
+#include "sys.h"
+#include "Integer.h"
+#include <iostream>
+
+namespace quantum {
+
+Integer::Integer(mpz_int const& value)
+{
+  mpz_srcptr const z = value.backend().data();
+  if (mpz_fits_slong_p(z))
+  {
+    m_value = mpz_get_si(z);
+    if (m_value >= min_value)
+      return;
+  }
+  m_big.reset(new mpz_int(value));
+}
+
+//static
+Integer Integer::big_add(Integer const& i1, Integer const& i2)
+{
+  return i1.to_mpz() + i2.to_mpz();
+}
+
+//static
+Integer Integer::big_sub(Integer const& i1, Integer const& i2)
+{
+  return i1.to_mpz() - i2.to_mpz();
+}
+
+//static
+Integer Integer::big_mul(Integer const& i1, Integer const& i2)
+{
+  return i1.to_mpz() * i2.to_mpz();
+}
+
+std::size_t Integer::big_hash() const
+{
+  mpz_srcptr const z = m_big->backend().data();
+  return mpz_get_ui(z) * 0x9e3779b97f4a7c15ULL + mpz_size(z) * mpz_sgn(z);
+}
+
+std::ostream& operator<<(std::ostream& os, Integer const& i)
+{
+  if (i.m_big)
+    return os << *i.m_big;
+  return os << i.m_value;
+}
+
+} // namespace quantum
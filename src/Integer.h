@@ -0,0 +1,157 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <boost/multiprecision/gmp.hpp>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <limits>
+#include <type_traits>
+
+namespace quantum {
+
+// An integer that is stored inline, as an int64_t, for as long as it fits; and
+// that is promoted to a (heap allocated) mpz_int only when a value outgrows that.
+//
+// Like Rational, a value is only stored as mpz_int when it does NOT fit inline,
+// so that every number has exactly one representation. The inline value is never
+// allowed to become INT64_MIN, so that negation can't overflow.
+class Integer
+{
+ public:
+  using mpz_int = boost::multiprecision::mpz_int;
+
+ private:
+  int64_t m_value;                      // The value, if m_big is null.
+  std::unique_ptr<mpz_int> m_big;       // Non-null iff the value doesn't fit in m_value.
+
+  static constexpr int64_t min_value = -std::numeric_limits<int64_t>::max();
+
+  // The slow path: do the calculation with mpz_int.
+  static Integer big_add(Integer const& i1, Integer const& i2);
+  static Integer big_sub(Integer const& i1, Integer const& i2);
+  static Integer big_mul(Integer const& i1, Integer const& i2);
+  std::size_t big_hash() const;
+
+ public:
+  Integer() : m_value(0) { }
+  Integer(int value) : m_value(value) { }
+  Integer(long value) : m_value(value) { if (value < min_value) *this = Integer(mpz_int(value)); }
+  Integer(mpz_int const& value);
+  // Allow construction from boost::multiprecision expression templates.
+  template<typename Expression, typename std::enable_if<
+      std::is_convertible<Expression, mpz_int>::value &&
+      !std::is_integral<Expression>::value &&
+      !std::is_same<Expression, mpz_int>::value, int>::type = 0>
+  Integer(Expression const& expression) : Integer(mpz_int(expression)) { }
+
+  Integer(Integer const& i) : m_value(i.m_value), m_big(i.m_big ? new mpz_int(*i.m_big) : nullptr) { }
+  Integer(Integer&& i) = default;
+  Integer& operator=(Integer const& i)
+  {
+    m_value = i.m_value;
+    if (i.m_big && m_big)
+      *m_big = *i.m_big;        // Reuse the allocated limbs.
+    else if (i.m_big)
+      m_big.reset(new mpz_int(*i.m_big));
+    else
+      m_big.reset();
+    return *this;
+  }
+  Integer& operator=(Integer&& i) = default;
+
+  // Return true if the value is stored inline.
+  bool is_small() const { return !m_big; }
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const { return m_big ? big_hash() : static_cast<std::size_t>(m_value); }
+  // Return the inline value. Only call when is_small() returns true.
+  int64_t small_value() const { return m_value; }
+  // Convert to mpz_int.
+  mpz_int to_mpz() const { return m_big ? *m_big : mpz_int(m_value); }
+
+  bool is_even() const { return m_big ? mpz_even_p(m_big->backend().data()) : (m_value & 1) == 0; }
+  // Return this value divided by two. Only call when is_even() returns true.
+  Integer half() const { return m_big ? Integer(mpz_int(*m_big / 2)) : Integer(m_value / 2); }
+
+  Integer operator-() const { return m_big ? Integer(mpz_int(-*m_big)) : Integer(-m_value); }
+
+  friend Integer operator+(Integer const& i1, Integer const& i2)
+  {
+    int64_t result;
+    if (!i1.m_big && !i2.m_big && !__builtin_add_overflow(i1.m_value, i2.m_value, &result) && result >= min_value)
+      return result;
+    return big_add(i1, i2);
+  }
+
+  friend Integer operator-(Integer const& i1, Integer const& i2)
+  {
+    int64_t result;
+    if (!i1.m_big && !i2.m_big && !__builtin_sub_overflow(i1.m_value, i2.m_value, &result) && result >= min_value)
+      return result;
+    return big_sub(i1, i2);
+  }
+
+  friend Integer operator*(Integer const& i1, Integer const& i2)
+  {
+    int64_t result;
+    if (!i1.m_big && !i2.m_big && !__builtin_mul_overflow(i1.m_value, i2.m_value, &result) && result >= min_value)
+      return result;
+    return big_mul(i1, i2);
+  }
+
+  Integer& operator+=(Integer const& i) { return *this = *this + i; }
+  Integer& operator-=(Integer const& i) { return *this = *this - i; }
+  Integer& operator*=(Integer const& i) { return *this = *this * i; }
+
+  friend bool operator==(Integer const& i1, Integer const& i2)
+  {
+    // An inline value can never be equal to a big value.
+    if (!i1.m_big && !i2.m_big)
+      return i1.m_value == i2.m_value;
+    return i1.m_big && i2.m_big && *i1.m_big == *i2.m_big;
+  }
+  friend bool operator!=(Integer const& i1, Integer const& i2) { return !(i1 == i2); }
+  friend bool operator<(Integer const& i1, Integer const& i2)
+  {
+    if (!i1.m_big && !i2.m_big)
+      return i1.m_value < i2.m_value;
+    return i1.to_mpz() < i2.to_mpz();
+  }
+
+  friend bool operator==(Integer const& i, int n) { return !i.m_big && i.m_value == n; }
+  friend bool operator!=(Integer const& i, int n) { return !(i == n); }
+  friend bool operator<(Integer const& i, int n) { return i.m_big ? *i.m_big < n : i.m_value < n; }
+  friend bool operator>(Integer const& i, int n) { return i.m_big ? *i.m_big > n : i.m_value > n; }
+
+  // Prints the same as mpz_int.
+  friend std::ostream& operator<<(std::ostream& os, Integer const& i);
+};
+
+} // namespace quantum
+
+// Add support for libeigen3. See https://eigen.tuxfamily.org/dox/TopicCustomizing_CustomScalar.html
+
+namespace Eigen {
+
+template<> struct NumTraits<quantum::Integer> : GenericNumTraits<quantum::Integer>
+{
+  typedef quantum::Integer Real;
+  typedef quantum::Integer NonInteger;
+  typedef quantum::Integer Nested;
+
+  static inline Real epsilon() { return 0; }
+  static inline Real dummy_precision() { return 0; }
+  static inline int digits10() { return 0; }
+
+  enum {
+    IsInteger = 1,
+    IsSigned = 1,
+    IsComplex = 0,
+    RequireInitialization = 1,
+    ReadCost = 2,
+    AddCost = 2,
+    MulCost = 4
+  };
+};
+
+} // namespace Eigen
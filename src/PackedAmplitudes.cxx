@@ -0,0 +1,267 @@
+#include "sys.h"
+#include "PackedAmplitudes.h"
+#include "QuBitRing.h"
+#include "debug.h"
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace quantum {
+
+namespace {
+
+constexpr int64_t max_component = PackedAmplitudes::max_component;
+
+// Return the index of the next pair (i0, i0 | rowbit_mask) after the one starting at i0.
+inline unsigned long next_pair(unsigned long i0, unsigned long rowbit_mask)
+{
+  ++i0;
+  // Skip the indices that have rowbit_mask set.
+  if ((i0 & rowbit_mask))
+    i0 += rowbit_mask;
+  return i0;
+}
+
+// Return component j of x·ω^p, where x is a numerator, or zero if p is -1.
+inline int64_t times_omega(int64_t const* x, int p, int j)
+{
+  if (p < 0)
+    return 0;
+  // x·ω = -d + a·ω + b·ω² + c·ω³; coefficients that wrap around are negated, and ω⁴ = -1.
+  int const q = p & 3;
+  int64_t const value = x[(j - q) & 3];
+  return (j < q) != (p >= 4) ? -value : value;
+}
+
+// Apply the 2x2 gate with entries ω^p[0], ω^p[1], ω^p[2] and ω^p[3] to every pair.
+unsigned long apply_pairs_generic(int64_t* numerator, unsigned long size, int const* p, unsigned long rowbit_mask)
+{
+  for (unsigned long i0 = 0; i0 < size; i0 = next_pair(i0, rowbit_mask))
+  {
+    int64_t* const x0 = numerator + 4 * i0;
+    int64_t* const x1 = numerator + 4 * (i0 | rowbit_mask);
+    int64_t r[2][4];
+    for (int row = 0; row < 2; ++row)
+      for (int j = 0; j < 4; ++j)
+      {
+        // Both terms are at most max_component in absolute value, so this can't overflow.
+        r[row][j] = times_omega(x0, p[2 * row], j) + times_omega(x1, p[2 * row + 1], j);
+        if (r[row][j] > max_component || r[row][j] < -max_component)
+          return i0;
+      }
+    std::copy(r[0], r[0] + 4, x0);
+    std::copy(r[1], r[1] + 4, x1);
+  }
+  return size;
+}
+
+#if defined(__x86_64__)
+// Return x·ω^p, using the shuffle perm and the sign mask (all bits set for components that must be negated) of ω^p,
+// or zero if keep is zero.
+__attribute__((target("avx2")))
+inline __m256i times_omega(__m256i x, __m256i perm, __m256i sign, __m256i keep)
+{
+  // Negating is (x ^ -1) - -1; x ^ 0 - 0 leaves it unchanged.
+  return _mm256_and_si256(_mm256_sub_epi64(_mm256_xor_si256(_mm256_permutevar8x32_epi32(x, perm), sign), sign), keep);
+}
+
+// Return a mask with all bits set for each component of r that is larger than max_component in absolute value.
+__attribute__((target("avx2")))
+inline __m256i out_of_range(__m256i r, __m256i max, __m256i min)
+{
+  return _mm256_or_si256(_mm256_cmpgt_epi64(r, max), _mm256_cmpgt_epi64(min, r));
+}
+
+// The AVX2 version of apply_pairs_generic; each numerator is exactly one register.
+__attribute__((target("avx2")))
+unsigned long apply_pairs_avx2(int64_t* numerator, unsigned long size, int const* p, unsigned long rowbit_mask)
+{
+  __m256i perm[4], sign[4], keep[4];
+  for (int e = 0; e < 4; ++e)
+  {
+    int const q = p[e] & 3;
+    int32_t index[8];
+    int64_t negate[4];
+    for (int j = 0; j < 4; ++j)
+    {
+      // Component j of the result is component (j - q) & 3 of x (two 32-bit halves).
+      index[2 * j] = 2 * ((j - q) & 3);
+      index[2 * j + 1] = 2 * ((j - q) & 3) + 1;
+      negate[j] = (j < q) != (p[e] >= 4) ? -1 : 0;
+    }
+    perm[e] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(index));
+    sign[e] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(negate));
+    keep[e] = _mm256_set1_epi64x(p[e] < 0 ? 0 : -1);
+  }
+  __m256i const max = _mm256_set1_epi64x(max_component);
+  __m256i const min = _mm256_set1_epi64x(-max_component);
+  for (unsigned long i0 = 0; i0 < size; i0 = next_pair(i0, rowbit_mask))
+  {
+    __m256i* const a0 = reinterpret_cast<__m256i*>(numerator + 4 * i0);
+    __m256i* const a1 = reinterpret_cast<__m256i*>(numerator + 4 * (i0 | rowbit_mask));
+    __m256i const x0 = _mm256_loadu_si256(a0);
+    __m256i const x1 = _mm256_loadu_si256(a1);
+    __m256i const r0 = _mm256_add_epi64(times_omega(x0, perm[0], sign[0], keep[0]), times_omega(x1, perm[1], sign[1], keep[1]));
+    __m256i const r1 = _mm256_add_epi64(times_omega(x0, perm[2], sign[2], keep[2]), times_omega(x1, perm[3], sign[3], keep[3]));
+    // Leave the pair unchanged when it doesn't fit.
+    __m256i const overflow = _mm256_or_si256(out_of_range(r0, max, min), out_of_range(r1, max, min));
+    if (!_mm256_testz_si256(overflow, overflow))
+      return i0;
+    _mm256_storeu_si256(a0, r0);
+    _mm256_storeu_si256(a1, r1);
+  }
+  return size;
+}
+#endif
+
+} // namespace
+
+bool PackedAmplitudes::assign(std::vector<QuBitField> const& coefficients)
+{
+  std::vector<QuBitRing> values;
+  values.reserve(coefficients.size());
+  int k = 0;
+  for (auto const& coefficient : coefficients)
+  {
+    if (!QuBitRing::contains(coefficient))
+      return false;
+    values.emplace_back(coefficient);
+    k = std::max(k, values.back().m_k);
+  }
+  std::vector<int64_t> numerator(4 * values.size());
+  for (std::size_t i = 0; i < values.size(); ++i)
+  {
+    // Bring every value on the common denominator √2^k.
+    auto const scaled = values[i].scaled_coefficients(k - values[i].m_k);
+    for (int j = 0; j < 4; ++j)
+    {
+      if (!scaled[j].is_small() || scaled[j].small_value() > max_component || scaled[j].small_value() < -max_component)
+        return false;
+      numerator[4 * i + j] = scaled[j].small_value();
+    }
+  }
+  m_size = values.size();
+  m_numerator = std::move(numerator);
+  // The value with the largest exponent isn't divisible by √2, so this is already normalized.
+  m_k = k;
+  return true;
+}
+
+QuBitField PackedAmplitudes::operator[](std::size_t i) const
+{
+  int64_t const* x = &m_numerator[4 * i];
+  // a + b·ω + c·ω² + d·ω³ = (a + c·i) + ((b - d) + (b + d)·i)·√½.
+  QuBitField const numerator{Rational(x[0]), Rational(x[2]), Rational(x[1] - x[3]), Rational(x[1] + x[3])};
+  return m_k == 0 ? numerator : numerator.times_sqrt_half(m_k);
+}
+
+bool PackedAmplitudes::is_zero(std::size_t i) const
+{
+  int64_t const* x = &m_numerator[4 * i];
+  return (x[0] | x[1] | x[2] | x[3]) == 0;
+}
+
+std::vector<QuBitField> PackedAmplitudes::expand() const
+{
+  std::vector<QuBitField> result;
+  result.reserve(m_size);
+  for (std::size_t i = 0; i < m_size; ++i)
+    result.push_back((*this)[i]);
+  return result;
+}
+
+void PackedAmplitudes::times_sqrt_half(int n)
+{
+  m_k += n;
+  normalize();
+}
+
+void PackedAmplitudes::normalize()
+{
+  // Find the largest d ≤ m_k such that every numerator is divisible by √2^d.
+  int d = m_k;
+  for (std::size_t i = 0; i < m_size && d > 0; ++i)
+  {
+    int64_t const* x = &m_numerator[4 * i];
+    int64_t const any = x[0] | x[1] | x[2] | x[3];
+    if (any == 0)
+      continue;
+    // Divisible by 2^t, and by one more √2 if the quotient has a ≡ c and b ≡ d (mod 2).
+    int const t = __builtin_ctzll(any);
+    bool const odd = (((x[0] ^ x[2]) | (x[1] ^ x[3])) >> t & 1) == 0;
+    d = std::min(d, 2 * t + (odd ? 1 : 0));
+  }
+  if (d == 0)
+    return;
+  if (d / 2 > 62)
+  {
+    // Only zero is divisible by that.
+    m_k = 0;
+    return;
+  }
+  for (std::size_t i = 0; i < m_size; ++i)
+  {
+    int64_t* x = &m_numerator[4 * i];
+    for (int j = 0; j < 4; ++j)
+      x[j] >>= d / 2;
+    if ((d & 1))
+    {
+      // Divide by √2 = ω - ω³.
+      int64_t const a = x[0], b = x[1], c = x[2], e = x[3];
+      x[0] = (b - e) / 2;
+      x[1] = (a + c) / 2;
+      x[2] = (b + e) / 2;
+      x[3] = (c - a) / 2;
+    }
+  }
+  m_k -= d;
+}
+
+unsigned long PackedAmplitudes::apply_pairs(std::vector<int> const& omega_powers, unsigned long rowbit_mask)
+{
+#if defined(__x86_64__)
+  static bool const have_avx2 = __builtin_cpu_supports("avx2");
+  if (have_avx2)
+    return apply_pairs_avx2(m_numerator.data(), m_size, omega_powers.data(), rowbit_mask);
+#endif
+  return apply_pairs_generic(m_numerator.data(), m_size, omega_powers.data(), rowbit_mask);
+}
+
+unsigned long PackedAmplitudes::apply(std::vector<int> const& omega_powers, int number_of_rows, std::vector<unsigned long> const& masks)
+{
+  if (number_of_rows == 2)
+    return apply_pairs(omega_powers, masks[0]);
+
+  // The offset of each row of the gate relative to the first coefficient of its group, and the mask with all used bits.
+  std::vector<unsigned long> offset(number_of_rows, 0);
+  for (int row = 0; row < number_of_rows; ++row)
+    for (std::size_t j = 0; j < masks.size(); ++j)
+      if ((row & (1 << j)))
+        offset[row] |= masks[j];
+  unsigned long const used_mask = offset[number_of_rows - 1];
+
+  std::vector<int64_t> column(4 * number_of_rows);
+  std::vector<int64_t> result(4 * number_of_rows);
+  for (unsigned long i0 = 0; i0 < m_size; ++i0)
+  {
+    if ((i0 & used_mask))
+      continue;
+    for (int col = 0; col < number_of_rows; ++col)
+      std::copy_n(&m_numerator[4 * (i0 | offset[col])], 4, &column[4 * col]);
+    for (int row = 0; row < number_of_rows; ++row)
+      for (int j = 0; j < 4; ++j)
+      {
+        // Only monomial gates have more than two rows, so there is at most one term.
+        int64_t sum = 0;
+        for (int col = 0; col < number_of_rows; ++col)
+          sum += times_omega(&column[4 * col], omega_powers[row * number_of_rows + col], j);
+        result[4 * row + j] = sum;
+      }
+    for (int row = 0; row < number_of_rows; ++row)
+      std::copy_n(&result[4 * row], 4, &m_numerator[4 * (i0 | offset[row])]);
+  }
+  return m_size;
+}
+
+} // namespace quantum
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "QuBitField.h"
+#include "GateMatrix.h"
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace quantum {
+
+// The coefficients of an EntangledState as numerators in ℤ[ω] with one shared denominator:
+// coefficient i is (a + b·ω + c·ω² + d·ω³) / √2^m_k, where a, b, c and d are the
+// four int64_t at m_numerator[4 * i] (exactly one 256-bit register per coefficient).
+//
+// The gates of the Clifford+T set are powers of ω (X, Y, Z, S, T, CX), or such powers
+// times √½ (H). Multiplying with ω is a rotation of a, b, c and d with one negation,
+// so that all gates are applied with vectorized shuffles, negations, additions
+// and subtractions only (using AVX2 when the CPU supports it).
+//
+// All numerator components are kept at most max_component in absolute value, so that
+// the sum of two never overflows. A group of coefficients (the pair of a single qubit gate)
+// whose result exceeds that is not written: apply returns where it stopped, after which
+// the caller must calculate the remainder with exact (QuBitField) arithmetic.
+class PackedAmplitudes
+{
+ public:
+  static constexpr int64_t max_component = (int64_t{1} << 62) - 1;
+
+ private:
+  std::size_t m_size;                   // The number of coefficients.
+  std::vector<int64_t> m_numerator;     // Four components per coefficient.
+  int m_k;                              // The power of √2 in the denominator of all coefficients.
+
+  // Divide all numerators by √2 as long as they are all divisible and m_k > 0.
+  void normalize();
+  // Apply a gate given as ω-powers (see apply below).
+  unsigned long apply(std::vector<int> const& omega_powers, int number_of_rows, std::vector<unsigned long> const& masks);
+  unsigned long apply_pairs(std::vector<int> const& omega_powers, unsigned long rowbit_mask);
+
+ public:
+  PackedAmplitudes() : m_size(0), m_k(0) { }
+
+  // Try to store coefficients. Returns false, leaving this object unchanged,
+  // if they are not in ℤ[ω, 1/√2] or a numerator doesn't fit.
+  bool assign(std::vector<QuBitField> const& coefficients);
+
+  // Return the number of coefficients.
+  std::size_t size() const { return m_size; }
+  // Return coefficient i.
+  QuBitField operator[](std::size_t i) const;
+  // Return true if coefficient i is zero.
+  bool is_zero(std::size_t i) const;
+  // Exchange coefficients i and j.
+  void swap_coefficients(std::size_t i, std::size_t j) { std::swap_ranges(&m_numerator[4 * i], &m_numerator[4 * i + 4], &m_numerator[4 * j]); }
+  // Return all coefficients in AoS layout.
+  std::vector<QuBitField> expand() const;
+  // Multiply all coefficients with √½^n, where n ≥ 0.
+  void times_sqrt_half(int n);
+
+  // Return true if every non-zero entry of gate is a power of ω, and apply can be used.
+  // Gates with more than one input must also be monomial (like CX): those never overflow.
+  template<typename Matrix>
+  static bool supports(GateMatrix<Matrix> const& gate) { return omega_powers(gate.unscaled()).has_value() && (gate.unscaled().rows() == 2 || gate.is_monomial()); }
+
+  // Apply gate to every group of coefficients whose indices only differ in the bits of masks;
+  // masks[j] is the rowbit mask of input j of the gate. Only call when supports(gate) returns true.
+  //
+  // Groups are calculated in the order of their smallest index. Returns the smallest
+  // index of the first group that wasn't calculated because it would overflow, or size()
+  // if everything was calculated.
+  template<typename Matrix>
+  unsigned long apply(GateMatrix<Matrix> const& gate, std::vector<unsigned long> const& masks)
+  {
+    return apply(*omega_powers(gate.unscaled()), gate.unscaled().rows(), masks);
+  }
+
+  // Return n for every entry of matrix that is ω^n (row by row), or -1 if it is zero.
+  template<typename Matrix>
+  static std::optional<std::vector<int>> omega_powers(Matrix const& matrix);
+};
+
+template<typename Matrix>
+std::optional<std::vector<int>> PackedAmplitudes::omega_powers(Matrix const& matrix)
+{
+  std::vector<int> result;
+  for (int row = 0; row < matrix.rows(); ++row)
+    for (int col = 0; col < matrix.cols(); ++col)
+    {
+      if (matrix(row, col).is_zero())
+      {
+        result.push_back(-1);
+        continue;
+      }
+      int n = 0;
+      while (n < 8 && matrix(row, col) != QuBitField(1).times_omega(n))
+        ++n;
+      if (n == 8)
+        return std::nullopt;
+      result.push_back(n);
+    }
+  return result;
+}
+
+} // namespace quantum
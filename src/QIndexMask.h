@@ -0,0 +1,148 @@
+#pragma once
+
+#include "utils/Vector.h"
+#include <boost/container/small_vector.hpp>
+#include <algorithm>
+#include <cstddef>
+
+namespace quantum {
+
+namespace index_category {
+enum qubits {};         // Index into quantum register.
+} // namespace category
+
+using q_index_type = utils::VectorIndex<index_category::qubits>;
+
+// A set of qubits: a bitset with bit q_index set for each q_index_type in the set.
+//
+// There is no limit on the number of qubits (including the measurement qubits) of a circuit,
+// but the first word is stored inline: masks that only contain qubits with an index less
+// than word_bits (all masks of circuits with at most 64 qubits) never allocate memory,
+// and their operations are a single word operation.
+class QIndexMask
+{
+ public:
+  using word_type = unsigned long;
+  static constexpr std::size_t word_bits = 64;
+
+ private:
+  // Bit q_index is bit q_index % word_bits of m_words[q_index / word_bits]. The last word is never zero.
+  boost::container::small_vector<word_type, 1> m_words;
+
+  void trim() { while (!m_words.empty() && m_words.back() == 0) m_words.pop_back(); }
+
+ public:
+  QIndexMask() = default;
+  explicit QIndexMask(q_index_type q_index) { set(q_index); }
+
+  // Return the mask of the qubits begin up till (but not including) end.
+  static QIndexMask range(q_index_type begin, q_index_type end)
+  {
+    QIndexMask mask;
+    for (q_index_type q_index = begin; q_index < end; ++q_index)
+      mask.set(q_index);
+    return mask;
+  }
+
+  void set(q_index_type q_index)
+  {
+    std::size_t const word = q_index.get_value() / word_bits;
+    if (word >= m_words.size())
+      m_words.resize(word + 1);
+    m_words[word] |= word_type{1} << (q_index.get_value() % word_bits);
+  }
+
+  bool test(q_index_type q_index) const
+  {
+    std::size_t const word = q_index.get_value() / word_bits;
+    return word < m_words.size() && ((m_words[word] >> (q_index.get_value() % word_bits)) & 1);
+  }
+
+  // Return true if the set is empty.
+  bool empty() const { return m_words.empty(); }
+
+  // Return true if this set and mask have a qubit in common.
+  bool intersects(QIndexMask const& mask) const
+  {
+    std::size_t const size = std::min(m_words.size(), mask.m_words.size());
+    for (std::size_t word = 0; word < size; ++word)
+      if ((m_words[word] & mask.m_words[word]))
+        return true;
+    return false;
+  }
+
+  // Return true if every qubit of this set is also in mask.
+  bool is_subset_of(QIndexMask const& mask) const
+  {
+    if (m_words.size() > mask.m_words.size())
+      return false;
+    for (std::size_t word = 0; word < m_words.size(); ++word)
+      if ((m_words[word] & ~mask.m_words[word]))
+        return false;
+    return true;
+  }
+
+  // Return the qubit with the lowest index. Only call when the set isn't empty.
+  q_index_type first() const
+  {
+    std::size_t word = 0;
+    while (m_words[word] == 0)
+      ++word;
+    return q_index_type{word * word_bits + __builtin_ctzl(m_words[word])};
+  }
+
+  // Call f(q_index) for every qubit in the set, in increasing order.
+  template<typename F>
+  void for_each(F f) const
+  {
+    for (std::size_t word = 0; word < m_words.size(); ++word)
+      for (word_type bits = m_words[word]; bits; bits &= bits - 1)
+        f(q_index_type{word * word_bits + __builtin_ctzl(bits)});
+  }
+
+  QIndexMask& operator|=(QIndexMask const& mask)
+  {
+    if (mask.m_words.size() > m_words.size())
+      m_words.resize(mask.m_words.size());
+    for (std::size_t word = 0; word < mask.m_words.size(); ++word)
+      m_words[word] |= mask.m_words[word];
+    return *this;
+  }
+
+  QIndexMask& operator&=(QIndexMask const& mask)
+  {
+    if (m_words.size() > mask.m_words.size())
+      m_words.resize(mask.m_words.size());
+    for (std::size_t word = 0; word < m_words.size(); ++word)
+      m_words[word] &= mask.m_words[word];
+    trim();
+    return *this;
+  }
+
+  // Remove the qubits of mask from this set.
+  QIndexMask& operator-=(QIndexMask const& mask)
+  {
+    std::size_t const size = std::min(m_words.size(), mask.m_words.size());
+    for (std::size_t word = 0; word < size; ++word)
+      m_words[word] &= ~mask.m_words[word];
+    trim();
+    return *this;
+  }
+
+  friend QIndexMask operator|(QIndexMask lhs, QIndexMask const& rhs) { return lhs |= rhs; }
+  friend QIndexMask operator&(QIndexMask lhs, QIndexMask const& rhs) { return lhs &= rhs; }
+  friend QIndexMask operator-(QIndexMask lhs, QIndexMask const& rhs) { return lhs -= rhs; }
+
+  friend bool operator==(QIndexMask const& lhs, QIndexMask const& rhs) { return lhs.m_words == rhs.m_words; }
+  friend bool operator!=(QIndexMask const& lhs, QIndexMask const& rhs) { return lhs.m_words != rhs.m_words; }
+  // Compare the masks as the (binary) numbers with the same bits set.
+  friend bool operator<(QIndexMask const& lhs, QIndexMask const& rhs)
+  {
+    if (lhs.m_words.size() != rhs.m_words.size())
+      return lhs.m_words.size() < rhs.m_words.size();
+    return std::lexicographical_compare(lhs.m_words.rbegin(), lhs.m_words.rend(), rhs.m_words.rbegin(), rhs.m_words.rend());
+  }
+  friend bool operator>(QIndexMask const& lhs, QIndexMask const& rhs) { return rhs < lhs; }
+};
+
+} // namespace quantum
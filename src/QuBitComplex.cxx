@@ -0,0 +1,182 @@
+#include "sys.h"
+#include "QuBitComplex.h"
+#include "Butterfly.h"
+#include "debug.h"
+#include <cmath>
+#include <functional>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace quantum {
+
+namespace {
+
+constexpr double sqrt_half = 0.70710678118654752440;
+
+double to_double(Rational const& r)
+{
+  return r.to_mpq().convert_to<double>();
+}
+
+} // namespace
+
+QuBitComplex::QuBitComplex(QuBitField const& value) : base_type{complex_type{}}
+{
+  // k + l·i + (m + n·i)·√½.
+  m_sum = complex_type(to_double(value.m_sum[QuBitField::nr_]) + to_double(value.m_sum[QuBitField::rr_]) * sqrt_half,
+                       to_double(value.m_sum[QuBitField::ni_]) + to_double(value.m_sum[QuBitField::ri_]) * sqrt_half);
+}
+
+std::size_t QuBitComplex::hash() const
+{
+  std::hash<double> hasher;
+  return hasher(m_sum.real()) * 0x100000001b3ULL ^ hasher(m_sum.imag());
+}
+
+QuBitComplex QuBitComplex::times_omega(int n) const
+{
+  n &= 7;
+  double re = m_sum.real();
+  double im = m_sum.imag();
+  // Multiply with i = ω² as often as possible; that is exact.
+  for (int i = 0; i < n / 2; ++i)
+  {
+    double const t = re;
+    re = -im;
+    im = t;
+  }
+  // (re + im·i)·ω = (re - im)·√½ + (re + im)·√½·i.
+  if ((n & 1))
+    return complex_type((re - im) * sqrt_half, (re + im) * sqrt_half);
+  return complex_type(re, im);
+}
+
+QuBitComplex QuBitComplex::times_sqrt_half(int n) const
+{
+  // √½^n = √½^(n mod 2) / 2^(n div 2).
+  int const halves = n >= 0 ? n / 2 : -((1 - n) / 2);
+  complex_type result(std::ldexp(m_sum.real(), -halves), std::ldexp(m_sum.imag(), -halves));
+  if ((n & 1))
+    result *= sqrt_half;
+  return result;
+}
+
+bool QuBitComplex::starts_with_a_minus() const
+{
+  return negligible(m_sum.real()) ? m_sum.imag() < 0 : m_sum.real() < 0;
+}
+
+// The same as print_formula_on(RationalsComplex), except that negligible components are omitted.
+void QuBitComplex::print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const
+{
+  bool const have_real_part = !negligible(m_sum.real());
+  bool const have_imag_part = !negligible(m_sum.imag());
+  if (!have_real_part && !have_imag_part)
+  {
+    os << '0';
+    return;
+  }
+  double real_part = negate_all_terms ? -m_sum.real() : m_sum.real();
+  double imaginary_part = negate_all_terms ? -m_sum.imag() : m_sum.imag();
+
+  bool const has_multiple_terms = have_real_part && have_imag_part;
+  bool const starts_with_a_minus = (have_real_part && real_part < 0) || (!have_real_part && imaginary_part < 0);
+
+  if (starts_with_a_minus)
+  {
+    if (have_real_part)
+      real_part = -real_part;
+    else
+      imaginary_part = -imaginary_part;
+  }
+  if (has_multiple_terms && is_factor)
+  {
+    os << '(';
+    if (starts_with_a_minus)
+      imaginary_part = -imaginary_part;
+  }
+  if (have_real_part)
+    os << real_part;
+  if (have_imag_part)
+  {
+    if (imaginary_part > 0)
+    {
+      if (have_real_part)
+        os << " + ";
+    }
+    else
+    {
+      os << (have_real_part ? " - " : "-");
+      imaginary_part = -imaginary_part;
+    }
+    if (negligible(imaginary_part - 1))
+      os << "i";
+    else
+      os << imaginary_part << "\u00b7i"; // "·i"
+  }
+  if (has_multiple_terms && is_factor)
+    os << ')';
+}
+
+#if defined(__x86_64__)
+namespace {
+
+// Return m·c for two complex numbers c (in the low and high half of c), where m = mr + mi·i.
+__attribute__((target("avx2,fma")))
+inline __m256d multiply(__m256d mr, __m256d mi, __m256d c)
+{
+  // (mr·cr - mi·ci, mr·ci + mi·cr).
+  return _mm256_fmaddsub_pd(mr, c, _mm256_mul_pd(mi, _mm256_permute_pd(c, 0x5)));
+}
+
+// The AVX2 version of apply_butterfly, that processes two pairs at a time; end - begin must be even.
+// The complex value of coefficient i is stored at base + i * stride.
+__attribute__((target("avx2,fma")))
+void apply_butterfly_avx2(char* base, std::size_t stride, unsigned long begin, unsigned long end, std::complex<double> const (&m)[2][2], unsigned long rowbit_mask)
+{
+  auto at = [=](unsigned long i){ return reinterpret_cast<double*>(base + i * stride); };
+  __m256d const m00r = _mm256_set1_pd(m[0][0].real()), m00i = _mm256_set1_pd(m[0][0].imag());
+  __m256d const m01r = _mm256_set1_pd(m[0][1].real()), m01i = _mm256_set1_pd(m[0][1].imag());
+  __m256d const m10r = _mm256_set1_pd(m[1][0].real()), m10i = _mm256_set1_pd(m[1][0].imag());
+  __m256d const m11r = _mm256_set1_pd(m[1][1].real()), m11i = _mm256_set1_pd(m[1][1].imag());
+  for (unsigned long pair = begin; pair < end; pair += 2)
+  {
+    unsigned long const i0 = butterfly_pair(pair, rowbit_mask);
+    unsigned long const j0 = butterfly_pair(pair + 1, rowbit_mask);
+    double* const a0 = at(i0);
+    double* const a1 = at(i0 | rowbit_mask);
+    double* const b0 = at(j0);
+    double* const b1 = at(j0 | rowbit_mask);
+    __m256d const c0 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(a0)), _mm_loadu_pd(b0), 1);
+    __m256d const c1 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(a1)), _mm_loadu_pd(b1), 1);
+    __m256d const r0 = _mm256_add_pd(multiply(m00r, m00i, c0), multiply(m01r, m01i, c1));
+    __m256d const r1 = _mm256_add_pd(multiply(m10r, m10i, c0), multiply(m11r, m11i, c1));
+    _mm_storeu_pd(a0, _mm256_castpd256_pd128(r0));
+    _mm_storeu_pd(b0, _mm256_extractf128_pd(r0, 1));
+    _mm_storeu_pd(a1, _mm256_castpd256_pd128(r1));
+    _mm_storeu_pd(b1, _mm256_extractf128_pd(r1, 1));
+  }
+}
+
+} // namespace
+#endif
+
+void apply_butterfly(std::vector<QuBitComplex>& coefficients, Eigen::Matrix<QuBitComplex, 2, 2> const& matrix, unsigned long rowbit_mask,
+    unsigned long begin, unsigned long end)
+{
+#if defined(__x86_64__)
+  static bool const have_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (have_avx2 && end - begin >= 2)
+  {
+    std::complex<double> const m[2][2] = { { matrix(0, 0).m_sum, matrix(0, 1).m_sum }, { matrix(1, 0).m_sum, matrix(1, 1).m_sum } };
+    unsigned long const even_end = begin + ((end - begin) & ~1UL);
+    apply_butterfly_avx2(reinterpret_cast<char*>(&coefficients[0].m_sum), sizeof(QuBitComplex), begin, even_end, m, rowbit_mask);
+    // Do the last pair, if any, with the generic code.
+    begin = even_end;
+  }
+#endif
+  apply_butterfly<QuBitComplex>(coefficients, matrix, rowbit_mask, begin, end);
+}
+
+} // namespace quantum
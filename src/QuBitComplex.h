@@ -0,0 +1,116 @@
+#pragma once
+
+#include "QuBitField.h"
+#include "formula.h"
+#include <Eigen/Core>
+#include <complex>
+#include <vector>
+
+namespace quantum {
+
+// An approximation of the numbers of QuBitField by a std::complex<double>.
+//
+// This is the scalar type of the fast (inexact) simulator: all arithmetic is done
+// in double precision and amplitudes are printed as decimal numbers. Components
+// with an absolute value less than epsilon are considered to be zero, so that
+// rounding errors don't show up as extra terms.
+//
+// Powers of ω that are calculated with times_omega are bit-wise equal to
+// the conversion of the corresponding QuBitField, so that GateMatrix still
+// recognizes the monomial gates (X, Y, Z, S, T, ...).
+class QuBitComplex : public formula::Sum<std::complex<double>>
+{
+  using base_type = formula::Sum<std::complex<double>>;
+
+ public:
+  using complex_type = std::complex<double>;
+  static constexpr double epsilon = 1e-12;
+
+ private:
+  // Return true if component should be considered to be zero.
+  static bool negligible(double component) { return std::abs(component) < epsilon; }
+
+  friend void apply_butterfly(std::vector<QuBitComplex>& coefficients, Eigen::Matrix<QuBitComplex, 2, 2> const& matrix, unsigned long rowbit_mask,
+      unsigned long begin, unsigned long end);
+
+ public:
+  QuBitComplex() : base_type{complex_type{}} { }
+  QuBitComplex(int a) : base_type{complex_type(a)} { }
+  QuBitComplex(complex_type value) : base_type{value} { }
+  QuBitComplex(QuBitComplex const& v) : base_type(v.m_sum) { }
+  QuBitComplex& operator=(QuBitComplex const& v) { m_sum = v.m_sum; return *this; }
+  explicit QuBitComplex(QuBitField const& value);
+
+  // Accessor for the value.
+  complex_type value() const { return m_sum; }
+
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const;
+
+  // Return this value times ω^n.
+  QuBitComplex times_omega(int n) const;
+  // Return this value times √½^n (n may be negative).
+  QuBitComplex times_sqrt_half(int n) const;
+  // Every value can be divided by √2.
+  int sqrt2_valuation(int limit) const { return limit; }
+
+  QuBitComplex& operator+=(QuBitComplex const& v) { m_sum += v.m_sum; return *this; }
+  QuBitComplex& operator-=(QuBitComplex const& v) { m_sum -= v.m_sum; return *this; }
+  QuBitComplex& operator*=(QuBitComplex const& v) { m_sum *= v.m_sum; return *this; }
+  QuBitComplex operator-() const { return complex_type(-m_sum); }
+
+  friend QuBitComplex operator+(QuBitComplex const& v1, QuBitComplex const& v2) { return complex_type(v1.m_sum + v2.m_sum); }
+  friend QuBitComplex operator-(QuBitComplex const& v1, QuBitComplex const& v2) { return complex_type(v1.m_sum - v2.m_sum); }
+  friend QuBitComplex operator*(QuBitComplex const& v1, QuBitComplex const& v2) { return complex_type(v1.m_sum * v2.m_sum); }
+
+  // The same fused operations as QuBitField has.
+  friend QuBitComplex fma(QuBitComplex const& v1, QuBitComplex const& v2, QuBitComplex const& v3) { return complex_type(v1.m_sum * v2.m_sum + v3.m_sum); }
+  friend QuBitComplex mul_add(QuBitComplex const& v1, QuBitComplex const& v2, QuBitComplex const& v3, QuBitComplex const& v4) { return complex_type(v1.m_sum * v2.m_sum + v3.m_sum * v4.m_sum); }
+  friend QuBitComplex mul_sub(QuBitComplex const& v1, QuBitComplex const& v2, QuBitComplex const& v3, QuBitComplex const& v4) { return complex_type(v1.m_sum * v2.m_sum - v3.m_sum * v4.m_sum); }
+  // Bit-wise equality; use is_zero() for comparisons with a tolerance.
+  friend bool operator==(QuBitComplex const& v1, QuBitComplex const& v2) { return v1.m_sum == v2.m_sum; }
+  friend bool operator!=(QuBitComplex const& v1, QuBitComplex const& v2) { return !(v1 == v2); }
+
+  QuBitComplex conjugate() const { return std::conj(m_sum); }
+
+ public:
+  // For printing (override virtual functions of formula::Sum).
+  bool starts_with_a_minus() const override;
+  bool has_multiple_terms() const override { return !negligible(m_sum.real()) && !negligible(m_sum.imag()); }
+  bool is_zero() const override { return negligible(m_sum.real()) && negligible(m_sum.imag()); }
+  bool is_unity() const override { return negligible(m_sum.imag()) && (negligible(m_sum.real() - 1) || negligible(m_sum.real() + 1)); }
+  void print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const override;
+};
+
+// Specialization of apply_butterfly (see Butterfly.h); this uses AVX2 when the CPU supports it.
+void apply_butterfly(std::vector<QuBitComplex>& coefficients, Eigen::Matrix<QuBitComplex, 2, 2> const& matrix, unsigned long rowbit_mask,
+    unsigned long begin, unsigned long end);
+
+} // namespace quantum
+
+// Add support for libeigen3. See https://eigen.tuxfamily.org/dox/TopicCustomizing_CustomScalar.html
+
+namespace Eigen {
+
+template<> struct NumTraits<quantum::QuBitComplex> : GenericNumTraits<quantum::QuBitComplex>
+{
+  typedef quantum::QuBitComplex Real;
+  typedef quantum::QuBitComplex NonInteger;
+  typedef quantum::QuBitComplex Nested;
+
+  static inline Real epsilon() { return 0; }
+  static inline Real dummy_precision() { return 0; }
+  static inline int digits10() { return 0; }
+
+  enum {
+    IsInteger = 0,
+    IsSigned = 1,
+    IsComplex = 0,
+    RequireInitialization = 1,
+    ReadCost = 1,
+    AddCost = 2,
+    MulCost = 6
+  };
+};
+
+} // namespace Eigen
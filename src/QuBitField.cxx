@@ -17,8 +17,8 @@ void print_formula_on(quantum::RationalsComplex const& number, std::ostream& os,
     os << '0';
   else
   {
-    boost::multiprecision::mpq_rational real_part = negate_all_terms ? -number.m_real : number.m_real;
-    boost::multiprecision::mpq_rational imaginary_part = negate_all_terms ? -number.m_imag : number.m_imag;
+    quantum::Rational real_part = negate_all_terms ? -number.m_real : number.m_real;
+    quantum::Rational imaginary_part = negate_all_terms ? -number.m_imag : number.m_imag;
 
     bool const has_multiple_terms = have_real_part && have_imag_part;
     bool const starts_with_a_minus = (have_real_part && real_part < 0) || (!have_real_part && imaginary_part < 0);
@@ -67,18 +67,195 @@ void print_formula_on(quantum::RationalsComplex const& number, std::ostream& os,
 
 namespace quantum {
 
+namespace {
+
+// Use a function, so that this can be used during static initialization (of the gates).
+Rational const& half()
+{
+  static Rational const half_(1, 2);
+  return half_;
+}
+
+} // namespace
+
+namespace {
+
+// The sum of a number of terms, where the first term is stored without adding it to zero.
+class TermSum
+{
+  Rational m_sum;
+  bool m_empty = true;
+
+ public:
+  void add(Rational&& term) { if (m_empty) m_sum = std::move(term); else m_sum += term; m_empty = false; }
+  void sub(Rational&& term) { if (m_empty) m_sum = -term; else m_sum -= term; m_empty = false; }
+  bool empty() const { return m_empty; }
+  Rational& value() { return m_sum; }
+};
+
+} // namespace
+
+//static
+template<unsigned int components>
+void QuBitField::multiply(base_type::container_type& result, QuBitField const& v1, QuBitField const& v2, product_mode mode)
+{
+  constexpr bool k = (components & (1U << nr_));
+  constexpr bool l = (components & (1U << ni_));
+  constexpr bool m = (components & (1U << rr_));
+  constexpr bool n = (components & (1U << ri_));
+  base_type::container_type const& x = v1.m_sum;
+  base_type::container_type const& y = v2.m_sum;
+  TermSum sum[4];
+  // nr: k1·k2 - l1·l2 + (m1·m2 - n1·n2)/2.
+  if constexpr (k)
+    sum[nr_].add(x[nr_] * y[nr_]);
+  if constexpr (l)
+    sum[nr_].sub(x[ni_] * y[ni_]);
+  if constexpr (m || n)
+  {
+    TermSum root;
+    if constexpr (m)
+      root.add(x[rr_] * y[rr_]);
+    if constexpr (n)
+      root.sub(x[ri_] * y[ri_]);
+    sum[nr_].add(half() * root.value());
+  }
+  // ni: k1·l2 + l1·k2 + (m1·n2 + n1·m2)/2.
+  if constexpr (k && l)
+  {
+    sum[ni_].add(x[nr_] * y[ni_]);
+    sum[ni_].add(x[ni_] * y[nr_]);
+  }
+  if constexpr (m && n)
+    sum[ni_].add(half() * (x[rr_] * y[ri_] + x[ri_] * y[rr_]));
+  // rr: m1·k2 - n1·l2 + k1·m2 - l1·n2.
+  if constexpr (m && k)
+  {
+    sum[rr_].add(x[rr_] * y[nr_]);
+    sum[rr_].add(x[nr_] * y[rr_]);
+  }
+  if constexpr (n && l)
+  {
+    sum[rr_].sub(x[ri_] * y[ni_]);
+    sum[rr_].sub(x[ni_] * y[ri_]);
+  }
+  // ri: m1·l2 + n1·k2 + k1·n2 + l1·m2.
+  if constexpr (m && l)
+  {
+    sum[ri_].add(x[rr_] * y[ni_]);
+    sum[ri_].add(x[ni_] * y[rr_]);
+  }
+  if constexpr (n && k)
+  {
+    sum[ri_].add(x[ri_] * y[nr_]);
+    sum[ri_].add(x[nr_] * y[ri_]);
+  }
+  for (int j = 0; j < 4; ++j)
+  {
+    // Components without terms are zero.
+    if (sum[j].empty())
+    {
+      if (mode == product_assign)
+        result[j] = 0;
+    }
+    else if (mode == product_assign)
+      result[j] = std::move(sum[j].value());
+    else if (mode == product_add)
+      result[j] += sum[j].value();
+    else
+      result[j] -= sum[j].value();
+  }
+}
+
+//static
+void QuBitField::multiply(base_type::container_type& result, QuBitField const& v1, QuBitField const& v2, product_mode mode)
+{
+  using multiply_function = void (*)(base_type::container_type&, QuBitField const&, QuBitField const&, product_mode);
+  static constexpr multiply_function specialization[16] = {
+    &multiply<0>, &multiply<1>, &multiply<2>, &multiply<3>, &multiply<4>, &multiply<5>, &multiply<6>, &multiply<7>,
+    &multiply<8>, &multiply<9>, &multiply<10>, &multiply<11>, &multiply<12>, &multiply<13>, &multiply<14>, &multiply<15>
+  };
+  specialization[v1.non_zero_components() | v2.non_zero_components()](result, v1, v2, mode);
+}
+
 QuBitField operator*(QuBitField const& v1, QuBitField const& v2)
 {
-  static constexpr int nr_ = QuBitField::nr_;
-  static constexpr int ni_ = QuBitField::ni_;
-  static constexpr int rr_ = QuBitField::rr_;
-  static constexpr int ri_ = QuBitField::ri_;
   QuBitField result;
-  mpq_rational half(1, 2);
-  result.m_sum[nr_] = v1.m_sum[nr_] * v2.m_sum[nr_] - v1.m_sum[ni_] * v2.m_sum[ni_] + half * (v1.m_sum[rr_] * v2.m_sum[rr_] - v1.m_sum[ri_] * v2.m_sum[ri_]);
-  result.m_sum[ni_] = v1.m_sum[nr_] * v2.m_sum[ni_] + v1.m_sum[ni_] * v2.m_sum[nr_] + half * (v1.m_sum[rr_] * v2.m_sum[ri_] + v1.m_sum[ri_] * v2.m_sum[rr_]);
-  result.m_sum[rr_] = v1.m_sum[rr_] * v2.m_sum[nr_] - v1.m_sum[ri_] * v2.m_sum[ni_] + v1.m_sum[nr_] * v2.m_sum[rr_] - v1.m_sum[ni_] * v2.m_sum[ri_];
-  result.m_sum[ri_] = v1.m_sum[rr_] * v2.m_sum[ni_] + v1.m_sum[ri_] * v2.m_sum[nr_] + v1.m_sum[nr_] * v2.m_sum[ri_] + v1.m_sum[ni_] * v2.m_sum[rr_];
+  QuBitField::multiply(result.m_sum, v1, v2, QuBitField::product_assign);
+  return result;
+}
+
+void QuBitField::multiply_accumulate(QuBitField const& v1, QuBitField const& v2, bool subtract)
+{
+  multiply(m_sum, v1, v2, subtract ? product_subtract : product_add);
+}
+
+QuBitField QuBitField::times_omega(int n) const
+{
+  QuBitField result(*this);
+  n &= 7;
+  // ω⁴ = -1.
+  if ((n & 4))
+    result.negate();
+  // ω² = i.
+  if ((n & 2))
+    result = result.times_i();
+  if ((n & 1))
+  {
+    // (k + l·i + (m + n·i)·√½)·(1 + i)·√½ = ((m - n) + (m + n)·i)/2 + ((k - l) + (k + l)·i)·√½.
+    base_type::container_type const& x = result.m_sum;
+    result.m_sum = base_type::container_type{ (x[rr_] - x[ri_]) * half(), (x[rr_] + x[ri_]) * half(), x[nr_] - x[ni_], x[nr_] + x[ni_] };
+  }
+  return result;
+}
+
+std::size_t QuBitField::hash() const
+{
+  std::size_t result = 0;
+  for (int j = 0; j < 4; ++j)
+    result = result * 0x100000001b3ULL ^ m_sum[j].hash();
+  return result;
+}
+
+QuBitField QuBitField::inverse() const
+{
+  // Write this value as a + b·√½, with a = k + l·i and b = m + n·i. Then (a + b·√½)·(a - b·√½) = a² - b²/2 = c,
+  // which has no √½ component, and c·c* = |c|² is rational. Hence 1/(a + b·√½) = (a - b·√½)·c* / |c|².
+  QuBitField const other_root{m_sum[nr_], m_sum[ni_], -m_sum[rr_], -m_sum[ri_]};
+  QuBitField const c_conjugate = (*this * other_root).conjugate();
+  Rational const scale = (c_conjugate * c_conjugate.conjugate()).m_sum[nr_].inverse();
+  QuBitField result = other_root * c_conjugate;
+  for (int j = 0; j < 4; ++j)
+    result.m_sum[j] *= scale;
+  return result;
+}
+
+QuBitField QuBitField::times_sqrt_half(int n) const
+{
+  QuBitField result(*this);
+  if ((n & 1))
+  {
+    base_type::container_type const& x = m_sum;
+    if (n > 0)
+    {
+      // (k + l·i + (m + n·i)·√½)·√½ = (m + n·i)/2 + (k + l·i)·√½.
+      result.m_sum = base_type::container_type{ x[rr_] * half(), x[ri_] * half(), x[nr_], x[ni_] };
+      --n;
+    }
+    else
+    {
+      // (k + l·i + (m + n·i)·√½)·√2 = (m + n·i) + 2·(k + l·i)·√½.
+      result.m_sum = base_type::container_type{ x[rr_], x[ri_], x[nr_] + x[nr_], x[ni_] + x[ni_] };
+      ++n;
+    }
+  }
+  if (n != 0)
+  {
+    // Multiply with √½^n = 2^(-n/2).
+    Rational const scale = Rational::power_of_two(-n / 2);
+    for (int j = 0; j < 4; ++j)
+      result.m_sum[j] *= scale;
+  }
   return result;
 }
 
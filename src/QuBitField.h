@@ -1,6 +1,7 @@
 #pragma once
 
 #include "formula.h"
+#include "Rational.h"
 #include <Eigen/Core>
 #include <boost/multiprecision/gmp.hpp>
 #include <string>
@@ -13,10 +14,10 @@ using namespace boost::multiprecision;
 // Just a helper class for printing QuBitField.
 struct RationalsComplex
 {
-  mpq_rational m_real;
-  mpq_rational m_imag;
+  Rational m_real;
+  Rational m_imag;
 
-  RationalsComplex(mpq_rational real, mpq_rational imag) : m_real(real), m_imag(imag) { }
+  RationalsComplex(Rational real, Rational imag) : m_real(std::move(real)), m_imag(std::move(imag)) { }
 
   bool is_unity() const { return m_imag == 0 && (m_real == 1 || m_real == -1); }
   bool starts_with_a_minus() const { return m_real < 0 || (m_real == 0 && m_imag < 0); }
@@ -38,9 +39,21 @@ void print_formula_on(quantum::RationalsComplex const& number, std::ostream& os,
 namespace quantum {
 
 // This class represents the numbers ℚ[i, 1/√2] = { (k + l·i) + (m + n·i)·√½ | k,l,m,n ∈ ℚ }
-class QuBitField : public formula::Sum<Eigen::Matrix<mpq_rational, 4, 1>>
+//
+// Each of k, l, m and n is a Rational, which is stored inline (without heap allocation)
+// as long as its numerator and denominator fit in an int64_t.
+//
+// Many values only use some of the components (for example, real amplitudes only have k and m).
+// Multiplication therefore first determines which components are non-zero in either operand
+// and then calls a version of the product formula that was specialized at compile time
+// for exactly those components: a product of two values in ℚ[√½] takes four Rational
+// multiplications instead of sixteen, and one of two rationals just one.
+class QuBitField : public formula::Sum<Eigen::Matrix<Rational, 4, 1>>
 {
-  using base_type = formula::Sum<Eigen::Matrix<mpq_rational, 4, 1>>;
+  using base_type = formula::Sum<Eigen::Matrix<Rational, 4, 1>>;
+  friend class QuBitRing;
+  friend class AmplitudePlanes;
+  friend class QuBitComplex;
 
  private:
   static constexpr int nr_ = 0; // Non-root Real: k.
@@ -48,26 +61,84 @@ class QuBitField : public formula::Sum<Eigen::Matrix<mpq_rational, 4, 1>>
   static constexpr int rr_ = 2; // Root Real: m.
   static constexpr int ri_ = 3; // Root Imaginary: n.
 
+  // Add (or subtract, if subtract is true) v1 * v2 to this value, without creating a QuBitField temporary.
+  void multiply_accumulate(QuBitField const& v1, QuBitField const& v2, bool subtract);
+
+  // Return a bit mask with bit j set iff component j is non-zero.
+  unsigned int non_zero_components() const
+  {
+    return (m_sum[nr_] != 0 ? 1U << nr_ : 0) | (m_sum[ni_] != 0 ? 1U << ni_ : 0) | (m_sum[rr_] != 0 ? 1U << rr_ : 0) | (m_sum[ri_] != 0 ? 1U << ri_ : 0);
+  }
+
+  // How multiply stores the product.
+  enum product_mode { product_assign, product_add, product_subtract };
+  // Store v1 * v2 in result, or add it to / subtract it from result, depending on mode.
+  // Only the components in the bit mask components are used; the other components of v1 and v2 must be zero.
+  template<unsigned int components>
+  static void multiply(base_type::container_type& result, QuBitField const& v1, QuBitField const& v2, product_mode mode);
+  // Call the specialization of multiply for the components that are non-zero in v1 or v2.
+  static void multiply(base_type::container_type& result, QuBitField const& v1, QuBitField const& v2, product_mode mode);
+
  public:
   using base_type::Sum;
   QuBitField() : base_type{{0, 0, 0, 0}} { }
   QuBitField(int nr) : base_type{{nr, 0, 0, 0}} { }
-  QuBitField(mpq_rational nr) : base_type{{nr, 0, 0, 0}} { }
-  QuBitField(mpq_rational nr, mpq_rational ni, mpq_rational rr, mpq_rational ri) : base_type{{ nr, ni, rr, ri}} { }
+  QuBitField(Rational nr) : base_type{{nr, 0, 0, 0}} { }
+  QuBitField(Rational nr, Rational ni, Rational rr, Rational ri) : base_type{{ nr, ni, rr, ri}} { }
   QuBitField(QuBitField const& v) : base_type(v.m_sum) { }
+  QuBitField(QuBitField&& v) : base_type(std::move(v.m_sum)) { }
+  QuBitField& operator=(QuBitField const& v) { m_sum = v.m_sum; return *this; }
+  QuBitField& operator=(QuBitField&& v) { m_sum = std::move(v.m_sum); return *this; }
 
   QuBitField& operator+=(QuBitField const& v) { m_sum += v.m_sum; return *this; }
   QuBitField& operator-=(QuBitField const& v) { m_sum -= v.m_sum; return *this; }
-  QuBitField& operator*=(QuBitField const& v) { QuBitField self(*this); *this = self * v; return *this; }
-  QuBitField operator-() const { return base_type::container_type(-m_sum); }
+  QuBitField& operator*=(QuBitField const& v) { return *this = *this * v; }
+  QuBitField operator-() const& { return base_type::container_type(-m_sum); }
+  QuBitField operator-() && { negate(); return std::move(*this); }
+  // Negate this value in place.
+  void negate() { for (int j = 0; j < 4; ++j) m_sum[j] = -m_sum[j]; }
 
+  // Reuse the storage of temporaries where possible.
   friend QuBitField operator+(QuBitField const& v1, QuBitField const& v2) { QuBitField result(v1); result += v2; return result; }
+  friend QuBitField operator+(QuBitField&& v1, QuBitField const& v2) { v1 += v2; return std::move(v1); }
+  friend QuBitField operator+(QuBitField const& v1, QuBitField&& v2) { v2 += v1; return std::move(v2); }
+  friend QuBitField operator+(QuBitField&& v1, QuBitField&& v2) { v1 += v2; return std::move(v1); }
   friend QuBitField operator-(QuBitField const& v1, QuBitField const& v2) { QuBitField result(v1); result -= v2; return result; }
+  friend QuBitField operator-(QuBitField&& v1, QuBitField const& v2) { v1 -= v2; return std::move(v1); }
+  friend QuBitField operator-(QuBitField const& v1, QuBitField&& v2) { v2.negate(); v2 += v1; return std::move(v2); }
+  friend QuBitField operator-(QuBitField&& v1, QuBitField&& v2) { v1 -= v2; return std::move(v1); }
   friend QuBitField operator*(QuBitField const& v1, QuBitField const& v2);
+
+  // Fused operations.
+  // Return v1 * v2 + v3.
+  friend QuBitField fma(QuBitField const& v1, QuBitField const& v2, QuBitField v3) { v3.multiply_accumulate(v1, v2, false); return v3; }
+  // Return v1 * v2 + v3 * v4.
+  friend QuBitField mul_add(QuBitField const& v1, QuBitField const& v2, QuBitField const& v3, QuBitField const& v4) { QuBitField result(v1 * v2); result.multiply_accumulate(v3, v4, false); return result; }
+  // Return v1 * v2 - v3 * v4.
+  friend QuBitField mul_sub(QuBitField const& v1, QuBitField const& v2, QuBitField const& v3, QuBitField const& v4) { QuBitField result(v1 * v2); result.multiply_accumulate(v3, v4, true); return result; }
+
+  // Multiplication with constants.
+  // Return this value times i.
+  QuBitField times_i() const { return { -m_sum[ni_], m_sum[nr_], -m_sum[ri_], m_sum[rr_] }; }
+  // Return this value times ω^n, where ω = e^{iπ/4} (n may be negative).
+  QuBitField times_omega(int n) const;
+
   friend bool operator==(QuBitField const& v1, QuBitField const& v2) { return v1.m_sum == v2.m_sum; }
   friend bool operator!=(QuBitField const& v1, QuBitField const& v2) { return v1.m_sum != v2.m_sum; }
 
   QuBitField conjugate() const { return { m_sum[0], -m_sum[1], m_sum[2], -m_sum[3] }; }
+  // Return 1 divided by this value, which may not be zero.
+  QuBitField inverse() const;
+  // Return true if this value is 2^exponent for some (possibly negative) exponent, and store that in exponent.
+  bool is_power_of_two(int& exponent) const { return m_sum[ni_] == 0 && m_sum[rr_] == 0 && m_sum[ri_] == 0 && m_sum[nr_].is_power_of_two(exponent); }
+
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const;
+
+  // Return this value times √½^n (n may be negative).
+  QuBitField times_sqrt_half(int n) const;
+  // Return the largest d ≤ limit such that this value divided by √2^d is still an element of this field: that is always limit.
+  int sqrt2_valuation(int limit) const { return limit; }
 
  public:
   // For printing (override virtual functions of formula::Sum).
@@ -154,4 +225,15 @@ template<> struct NumTraits<quantum::QuBitField> : GenericNumTraits<quantum::QuB
   };
 };
 
+namespace internal {
+
+// Let the matrix products of Eigen use the fused multiply-add of QuBitField.
+template<>
+inline quantum::QuBitField pmadd(quantum::QuBitField const& a, quantum::QuBitField const& b, quantum::QuBitField const& c)
+{
+  return fma(a, b, c);
+}
+
+} // namespace internal
+
 } // namespace Eigen
@@ -0,0 +1,265 @@
+#include "sys.h"
+#include "QuBitModular.h"
+#include "debug.h"
+
+namespace quantum {
+
+namespace {
+
+using modular::primes;
+constexpr int N = modular::number_of_primes;
+using mpz_int = Integer::mpz_int;
+
+// Return base^exponent, for base in Montgomery form.
+uint64_t power(modular::MontgomeryPrime const& prime, uint64_t base, uint64_t exponent)
+{
+  uint64_t result = prime.to_montgomery(1);
+  while (exponent)
+  {
+    if ((exponent & 1))
+      result = prime.multiply(result, base);
+    base = prime.multiply(base, base);
+    exponent >>= 1;
+  }
+  return result;
+}
+
+// Return n modulo prime, in Montgomery form.
+uint64_t residue_of(modular::MontgomeryPrime const& prime, Integer const& n)
+{
+  uint64_t r;
+  if (n.is_small())
+  {
+    int64_t const value = n.small_value();
+    r = value >= 0 ? static_cast<uint64_t>(value) % prime.p() : prime.p() - (static_cast<uint64_t>(-value) % prime.p());
+    if (r == prime.p())
+      r = 0;
+  }
+  else
+  {
+    mpz_int const m = n.to_mpz() % prime.p();
+    r = m < 0 ? prime.p() - static_cast<uint64_t>(-m) : static_cast<uint64_t>(m);
+  }
+  return prime.to_montgomery(r);
+}
+
+// The constants for the Chinese remainder theorem. Use a function, so that this can be used during static initialization.
+struct ChineseRemainder
+{
+  mpz_int m_modulus;                    // The product of all primes.
+  std::array<mpz_int, N> m_basis;       // m_basis[pi] is 1 modulo primes[pi] and 0 modulo the other primes.
+
+  ChineseRemainder() : m_modulus(1)
+  {
+    for (int pi = 0; pi < N; ++pi)
+      m_modulus *= primes[pi].p();
+    for (int pi = 0; pi < N; ++pi)
+    {
+      mpz_int const others = m_modulus / primes[pi].p();
+      // others^-1 modulo primes[pi], using Fermat's little theorem.
+      uint64_t const others_residue = static_cast<uint64_t>(others % primes[pi].p());
+      uint64_t const inverse = power(primes[pi], primes[pi].to_montgomery(others_residue), primes[pi].p() - 2);
+      m_basis[pi] = others * primes[pi].from_montgomery(inverse);
+    }
+  }
+
+  // Return the integer with absolute value less than m_modulus / 2 that has the given residues (in Montgomery form).
+  Integer reconstruct(uint64_t const* residues) const
+  {
+    mpz_int x = 0;
+    for (int pi = 0; pi < N; ++pi)
+      x += m_basis[pi] * primes[pi].from_montgomery(residues[pi]);
+    x %= m_modulus;
+    if (2 * x > m_modulus)
+      x -= m_modulus;
+    return x;
+  }
+};
+
+ChineseRemainder const& chinese_remainder()
+{
+  static ChineseRemainder const chinese_remainder_;
+  return chinese_remainder_;
+}
+
+} // namespace
+
+QuBitModular::QuBitModular(int a) : base_type{{}}, m_k(0)
+{
+  for (int pi = 0; pi < N; ++pi)
+    residue(0, pi) = residue_of(primes[pi], a);
+}
+
+QuBitModular::QuBitModular(QuBitRing const& value) : base_type{{}}, m_k(0)
+{
+  for (int j = 0; j < 4; ++j)
+    for (int pi = 0; pi < N; ++pi)
+      residue(j, pi) = residue_of(primes[pi], value.m_sum[j]);
+  *this = times_sqrt_half(value.sqrt2_exponent());
+}
+
+QuBitRing QuBitModular::to_ring() const
+{
+  // Numerator too large for the number of primes.
+  ASSERT(m_k <= max_sqrt2_exponent);
+  QuBitModular numerator(*this);
+  numerator.multiply_by_power_of_two(m_k / 2);
+  if ((m_k & 1))
+    numerator.multiply_by_sqrt2();
+  ChineseRemainder const& crt = chinese_remainder();
+  return { crt.reconstruct(&numerator.m_sum[0]), crt.reconstruct(&numerator.m_sum[N]),
+    crt.reconstruct(&numerator.m_sum[2 * N]), crt.reconstruct(&numerator.m_sum[3 * N]), m_k };
+}
+
+bool QuBitModular::equals(int n) const
+{
+  // Zero is zero in Montgomery form too.
+  for (int pi = 0; pi < N; ++pi)
+    if (residue(0, pi) != (n == 0 ? 0 : residue_of(primes[pi], n)))
+      return false;
+  for (int j = N; j < 4 * N; ++j)
+    if (m_sum[j] != 0)
+      return false;
+  return true;
+}
+
+std::size_t QuBitModular::hash() const
+{
+  std::size_t result = 0;
+  for (uint64_t r : m_sum)
+    result = result * 0x100000001b3ULL ^ r;
+  return result;
+}
+
+void QuBitModular::multiply_by_sqrt2()
+{
+  // (a + b·ω + c·ω² + d·ω³)·(ω - ω³) = (b - d) + (a + c)·ω + (b + d)·ω² + (c - a)·ω³.
+  for (int pi = 0; pi < N; ++pi)
+  {
+    modular::MontgomeryPrime const& prime = primes[pi];
+    uint64_t const a = residue(0, pi), b = residue(1, pi), c = residue(2, pi), d = residue(3, pi);
+    residue(0, pi) = prime.sub(b, d);
+    residue(1, pi) = prime.add(a, c);
+    residue(2, pi) = prime.add(b, d);
+    residue(3, pi) = prime.sub(c, a);
+  }
+}
+
+void QuBitModular::multiply_by_power_of_two(int exponent)
+{
+  if (exponent == 0)
+    return;
+  for (int pi = 0; pi < N; ++pi)
+  {
+    modular::MontgomeryPrime const& prime = primes[pi];
+    // 2 or 1/2 = (p + 1)/2.
+    uint64_t const base = prime.to_montgomery(exponent > 0 ? 2 : (prime.p() + 1) / 2);
+    uint64_t const factor = power(prime, base, exponent > 0 ? exponent : -exponent);
+    for (int j = 0; j < 4; ++j)
+      residue(j, pi) = prime.multiply(residue(j, pi), factor);
+  }
+}
+
+QuBitModular QuBitModular::times_omega(int n) const
+{
+  QuBitModular result;
+  n &= 7;
+  // ω⁴ = -1.
+  bool const negate = n >= 4;
+  n &= 3;
+  for (int j = 0; j < 4; ++j)
+  {
+    int const to = (j + n) & 3;
+    // Coefficients that wrap around are negated.
+    bool const negate_j = (j + n >= 4) != negate;
+    for (int pi = 0; pi < N; ++pi)
+      result.residue(to, pi) = negate_j ? primes[pi].negate(residue(j, pi)) : residue(j, pi);
+  }
+  result.m_k = m_k;
+  return result;
+}
+
+QuBitModular QuBitModular::times_sqrt_half(int n) const
+{
+  QuBitModular result(*this);
+  int const m = n < 0 ? -n : n;
+  if ((m & 1))
+  {
+    // √½ = √2 / 2.
+    result.multiply_by_sqrt2();
+    result.multiply_by_power_of_two(n > 0 ? -(m + 1) / 2 : (m - 1) / 2);
+  }
+  else
+    result.multiply_by_power_of_two(n > 0 ? -m / 2 : m / 2);
+  result.m_k = std::max(m_k + n, 0);
+  return result;
+}
+
+QuBitModular& QuBitModular::operator+=(QuBitModular const& v)
+{
+  for (int j = 0; j < 4; ++j)
+    for (int pi = 0; pi < N; ++pi)
+      residue(j, pi) = primes[pi].add(residue(j, pi), v.residue(j, pi));
+  m_k = std::max(m_k, v.m_k);
+  return *this;
+}
+
+QuBitModular& QuBitModular::operator-=(QuBitModular const& v)
+{
+  for (int j = 0; j < 4; ++j)
+    for (int pi = 0; pi < N; ++pi)
+      residue(j, pi) = primes[pi].sub(residue(j, pi), v.residue(j, pi));
+  m_k = std::max(m_k, v.m_k);
+  return *this;
+}
+
+QuBitModular QuBitModular::operator-() const
+{
+  QuBitModular result(*this);
+  for (int j = 0; j < 4; ++j)
+    for (int pi = 0; pi < N; ++pi)
+      result.residue(j, pi) = primes[pi].negate(residue(j, pi));
+  return result;
+}
+
+QuBitModular QuBitModular::conjugate() const
+{
+  QuBitModular result(*this);
+  for (int pi = 0; pi < N; ++pi)
+  {
+    result.residue(1, pi) = primes[pi].negate(residue(3, pi));
+    result.residue(2, pi) = primes[pi].negate(residue(2, pi));
+    result.residue(3, pi) = primes[pi].negate(residue(1, pi));
+  }
+  return result;
+}
+
+QuBitModular operator*(QuBitModular const& v1, QuBitModular const& v2)
+{
+  QuBitModular result;
+  for (int pi = 0; pi < N; ++pi)
+  {
+    modular::MontgomeryPrime const& prime = primes[pi];
+    uint64_t a[4], b[4];
+    for (int j = 0; j < 4; ++j)
+    {
+      a[j] = v1.residue(j, pi);
+      b[j] = v2.residue(j, pi);
+    }
+    // The same as QuBitRing, using ω⁴ = -1.
+    for (int j = 0; j < 4; ++j)
+    {
+      uint64_t sum = 0;
+      for (int l = 0; l < 4; ++l)
+      {
+        uint64_t const product = prime.multiply(a[l], b[(j - l) & 3]);
+        sum = l <= j ? prime.add(sum, product) : prime.sub(sum, product);
+      }
+      result.residue(j, pi) = sum;
+    }
+  }
+  result.m_k = v1.m_k + v2.m_k;
+  return result;
+}
+
+} // namespace quantum
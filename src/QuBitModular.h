@@ -0,0 +1,194 @@
+#pragma once
+
+#include "QuBitRing.h"
+#include "formula.h"
+#include <Eigen/Core>
+#include <array>
+#include <cstdint>
+
+namespace quantum {
+namespace modular {
+
+// Arithmetic modulo an odd prime p < 2^62, on residues in Montgomery form (x·2^64 mod p).
+//
+// Because p < 2^62 the product of two residues plus m·p (m < 2^64) never overflows 128 bits,
+// and the result of the reduction is less than 2p, so that one conditional subtraction suffices.
+class MontgomeryPrime
+{
+ private:
+  uint64_t m_p;                 // The prime.
+  uint64_t m_neg_p_inverse;     // -p^{-1} mod 2^64.
+  uint64_t m_r2;                // 2^128 mod p.
+
+  static constexpr uint64_t neg_inverse(uint64_t p)
+  {
+    // Newton iteration; x = p is correct in the lowest three bits, and every step doubles that.
+    uint64_t x = p;
+    for (int i = 0; i < 5; ++i)
+      x *= 2 - p * x;
+    return -x;
+  }
+
+  static constexpr uint64_t r2(uint64_t p)
+  {
+    unsigned __int128 const r = (static_cast<unsigned __int128>(1) << 64) % p;
+    return static_cast<uint64_t>(r * r % p);
+  }
+
+ public:
+  constexpr MontgomeryPrime(uint64_t p) : m_p(p), m_neg_p_inverse(neg_inverse(p)), m_r2(r2(p)) { }
+
+  // Accessor for the prime.
+  constexpr uint64_t p() const { return m_p; }
+
+  uint64_t add(uint64_t a, uint64_t b) const { uint64_t s = a + b; return s >= m_p ? s - m_p : s; }
+  uint64_t sub(uint64_t a, uint64_t b) const { return a >= b ? a - b : a + m_p - b; }
+  uint64_t negate(uint64_t a) const { return a == 0 ? 0 : m_p - a; }
+
+  // Return a·b·2^-64 mod p.
+  uint64_t multiply(uint64_t a, uint64_t b) const
+  {
+    unsigned __int128 const t = static_cast<unsigned __int128>(a) * b;
+    uint64_t const m = static_cast<uint64_t>(t) * m_neg_p_inverse;
+    uint64_t const u = (t + static_cast<unsigned __int128>(m) * m_p) >> 64;
+    return u >= m_p ? u - m_p : u;
+  }
+
+  // Convert a (less than p) to and from Montgomery form.
+  uint64_t to_montgomery(uint64_t a) const { return multiply(a, m_r2); }
+  uint64_t from_montgomery(uint64_t a) const { return multiply(a, 1); }
+};
+
+// The number of primes that QuBitModular uses.
+static constexpr int number_of_primes = 8;
+
+// The largest primes less than 2^62.
+inline constexpr std::array<MontgomeryPrime, number_of_primes> primes = {
+  (1ULL << 62) - 57, (1ULL << 62) - 87, (1ULL << 62) - 117, (1ULL << 62) - 143,
+  (1ULL << 62) - 153, (1ULL << 62) - 167, (1ULL << 62) - 171, (1ULL << 62) - 195
+};
+
+} // namespace modular
+
+// The numbers ℤ[ω, 1/√2] of QuBitRing, stored modulo several 62-bit primes.
+//
+// Since 2 is invertible modulo an odd prime, so is √2 = ω - ω³, and every value has a
+// unique representation as a + b·ω + c·ω² + d·ω³ in (ℤ/p)[ω]/(ω⁴ + 1) for every prime p.
+// That makes all arithmetic (including division by √2) run on native 64-bit integers,
+// without any allocation, while equality is exact.
+//
+// The exact value is only reconstructed (by to_ring or to_field) with the Chinese
+// remainder theorem, from the residues of the numerator (a + b·ω + c·ω² + d·ω³)·√2^k.
+// The exponent k (m_k) is an upper bound of the power of √2 in the denominator that is
+// tracked through every operation; it is not part of the value.
+//
+// The Galois conjugate (√2 ↦ -√2) of a normalized state is normalized too, so that both
+// an amplitude and its conjugate have an absolute value of at most one. Therefore the
+// coefficients of the numerator of an amplitude are at most √2^k in absolute value, and
+// its reconstruction is exact as long as k is at most max_sqrt2_exponent.
+class QuBitModular : public formula::Sum<std::array<uint64_t, 4 * modular::number_of_primes>>
+{
+  using base_type = formula::Sum<std::array<uint64_t, 4 * modular::number_of_primes>>;
+  static constexpr int N = modular::number_of_primes;
+
+ public:
+  // The largest exponent of √2 in the denominator for which the numerator of amplitudes can be reconstructed.
+  static constexpr int max_sqrt2_exponent = 2 * (62 * N - 2);
+
+ private:
+  // m_sum[j * N + pi] is the residue of coefficient j of ω^j modulo modular::primes[pi], in Montgomery form.
+  int m_k;                              // An upper bound of the power of √2 in the denominator.
+
+  // Return the residue of coefficient j modulo prime pi.
+  uint64_t& residue(int j, int pi) { return m_sum[j * N + pi]; }
+  uint64_t residue(int j, int pi) const { return m_sum[j * N + pi]; }
+
+  // Multiply with √2 = ω - ω³, or with 2^exponent, without changing m_k.
+  void multiply_by_sqrt2();
+  void multiply_by_power_of_two(int exponent);
+
+  // Return true if the residues are equal to those of n (a small integer).
+  bool equals(int n) const;
+
+ public:
+  QuBitModular() : base_type{{}}, m_k(0) { }
+  QuBitModular(int a);
+  QuBitModular(QuBitModular const& v) : base_type(v.m_sum), m_k(v.m_k) { }
+  QuBitModular& operator=(QuBitModular const& v) { m_sum = v.m_sum; m_k = v.m_k; return *this; }
+  explicit QuBitModular(QuBitRing const& value);
+  explicit QuBitModular(QuBitField const& value) : QuBitModular(QuBitRing(value)) { }
+
+  // Reconstruct the exact value.
+  QuBitRing to_ring() const;
+  QuBitField to_field() const { return to_ring().to_field(); }
+
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const;
+
+  // Accessor for the bound on the exponent of √2 in the denominator.
+  int sqrt2_exponent() const { return m_k; }
+
+  // Return this value times ω^n.
+  QuBitModular times_omega(int n) const;
+  // Return this value times √½^n (n may be negative).
+  QuBitModular times_sqrt_half(int n) const;
+  // The power of √2 that divides a numerator can't be seen modulo odd primes, so this only returns limit for zero.
+  int sqrt2_valuation(int limit) const { return is_zero() ? limit : 0; }
+
+  QuBitModular& operator+=(QuBitModular const& v);
+  QuBitModular& operator-=(QuBitModular const& v);
+  QuBitModular& operator*=(QuBitModular const& v) { return *this = *this * v; }
+  QuBitModular operator-() const;
+
+  friend QuBitModular operator+(QuBitModular const& v1, QuBitModular const& v2) { QuBitModular result(v1); result += v2; return result; }
+  friend QuBitModular operator-(QuBitModular const& v1, QuBitModular const& v2) { QuBitModular result(v1); result -= v2; return result; }
+  friend QuBitModular operator*(QuBitModular const& v1, QuBitModular const& v2);
+
+  // The same fused operations as QuBitField has.
+  friend QuBitModular fma(QuBitModular const& v1, QuBitModular const& v2, QuBitModular const& v3) { return v1 * v2 + v3; }
+  friend QuBitModular mul_add(QuBitModular const& v1, QuBitModular const& v2, QuBitModular const& v3, QuBitModular const& v4) { return v1 * v2 + v3 * v4; }
+  friend QuBitModular mul_sub(QuBitModular const& v1, QuBitModular const& v2, QuBitModular const& v3, QuBitModular const& v4) { return v1 * v2 - v3 * v4; }
+  // The representation is unique (m_k is not part of the value).
+  friend bool operator==(QuBitModular const& v1, QuBitModular const& v2) { return v1.m_sum == v2.m_sum; }
+  friend bool operator!=(QuBitModular const& v1, QuBitModular const& v2) { return !(v1 == v2); }
+
+  // The complex conjugate: ω̄ = -ω³, ω̄² = -ω² and ω̄³ = -ω.
+  QuBitModular conjugate() const;
+
+ public:
+  // For printing (override virtual functions of formula::Sum). These are only used for printing, so simply convert to QuBitField.
+  bool starts_with_a_minus() const override { return to_field().starts_with_a_minus(); }
+  bool has_multiple_terms() const override { return to_field().has_multiple_terms(); }
+  bool is_zero() const override { return equals(0); }
+  bool is_unity() const override { return equals(1) || equals(-1); }
+  void print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const override { to_field().print_on(os, negate_all_terms, is_factor); }
+};
+
+} // namespace quantum
+
+// Add support for libeigen3. See https://eigen.tuxfamily.org/dox/TopicCustomizing_CustomScalar.html
+
+namespace Eigen {
+
+template<> struct NumTraits<quantum::QuBitModular> : GenericNumTraits<quantum::QuBitModular>
+{
+  typedef quantum::QuBitModular Real;
+  typedef quantum::QuBitModular NonInteger;
+  typedef quantum::QuBitModular Nested;
+
+  static inline Real epsilon() { return 0; }
+  static inline Real dummy_precision() { return 0; }
+  static inline int digits10() { return 0; }
+
+  enum {
+    IsInteger = 0,
+    IsSigned = 1,
+    IsComplex = 0,
+    RequireInitialization = 1,
+    ReadCost = 10,
+    AddCost = 10,
+    MulCost = 40
+  };
+};
+
+} // namespace Eigen
@@ -0,0 +1,245 @@
+#include "sys.h"
+#include "QuBitRing.h"
+#include "debug.h"
+
+namespace quantum {
+
+namespace {
+
+Rational to_rational(Integer const& i)
+{
+  if (i.is_small())
+    return Rational(i.small_value(), 1);
+  return Rational(Rational::mpq_rational(i.to_mpz()));
+}
+
+} // namespace
+
+void QuBitRing::normalize()
+{
+  if (is_zero())
+  {
+    m_k = 0;
+    return;
+  }
+  while (m_k > 0 && numerator_is_divisible_by_sqrt2())
+  {
+    divide_numerator_by_sqrt2();
+    --m_k;
+  }
+}
+
+void QuBitRing::divide_numerator_by_sqrt2()
+{
+  // The numerator x = a + b·ω + c·ω² + d·ω³ is divisible by √2 iff a + c and b + d are both even,
+  // because x·√2 = x·(ω - ω³) = (b - d) + (a + c)·ω + (b + d)·ω² + (c - a)·ω³.
+  base_type::container_type const x = m_sum;
+  m_sum[0] = (x[1] - x[3]).half();
+  m_sum[1] = (x[0] + x[2]).half();
+  m_sum[2] = (x[1] + x[3]).half();
+  m_sum[3] = (x[2] - x[0]).half();
+}
+
+std::size_t QuBitRing::hash() const
+{
+  std::size_t result = m_k;
+  for (int j = 0; j < 4; ++j)
+    result = result * 0x100000001b3ULL ^ m_sum[j].hash();
+  return result;
+}
+
+QuBitRing QuBitRing::times_sqrt_half(int n) const
+{
+  QuBitRing result(*this);
+  if (n >= 0 || m_k >= -n)
+    result.m_k += n;
+  else
+  {
+    result.m_sum = scaled_coefficients(-n - m_k);
+    result.m_k = 0;
+  }
+  result.normalize();
+  return result;
+}
+
+int QuBitRing::sqrt2_valuation(int limit) const
+{
+  if (is_zero())
+    return limit;
+  if (m_k > 0)
+    return 0;
+  QuBitRing x(*this);
+  int d = 0;
+  while (d < limit && x.numerator_is_divisible_by_sqrt2())
+  {
+    x.divide_numerator_by_sqrt2();
+    ++d;
+  }
+  return d;
+}
+
+QuBitRing::base_type::container_type QuBitRing::scaled_coefficients(int n) const
+{
+  base_type::container_type x = m_sum;
+  if ((n & 1))
+  {
+    // Multiply with √2 = ω - ω³.
+    base_type::container_type const y = x;
+    x[0] = y[1] - y[3];
+    x[1] = y[0] + y[2];
+    x[2] = y[1] + y[3];
+    x[3] = y[2] - y[0];
+  }
+  // Multiply with 2^(n/2).
+  for (n >>= 1; n > 0; --n)
+    x += x;
+  return x;
+}
+
+int QuBitRing::unit_monomial_index() const
+{
+  int index = -1;
+  for (int j = 0; j < 4; ++j)
+  {
+    if (m_sum[j] == 0)
+      continue;
+    if (index != -1 || (m_sum[j] != 1 && m_sum[j] != -1))
+      return -1;
+    index = j;
+  }
+  return index;
+}
+
+QuBitRing::QuBitRing(QuBitField const& value) : base_type{{0, 0, 0, 0}}
+{
+  using mpq_rational = Rational::mpq_rational;
+  using mpz_int = Integer::mpz_int;
+  // (k + l·i) + (m + n·i)·√½ = k + (m + n)/2·ω + l·ω² + (n - m)/2·ω³, because i = ω² and √½ = (ω - ω³)/2.
+  std::array<mpq_rational, 4> c = {
+    value.m_sum[QuBitField::nr_].to_mpq(),
+    (value.m_sum[QuBitField::rr_].to_mpq() + value.m_sum[QuBitField::ri_].to_mpq()) / 2,
+    value.m_sum[QuBitField::ni_].to_mpq(),
+    (value.m_sum[QuBitField::ri_].to_mpq() - value.m_sum[QuBitField::rr_].to_mpq()) / 2
+  };
+  // Find the largest denominator; all denominators must be powers of two.
+  std::size_t e = 0;
+  for (auto&& q : c)
+  {
+    mpz_srcptr const den = mpq_denref(q.backend().data());
+    // Value not in ℤ[ω, 1/√2].
+    ASSERT(mpz_popcount(den) == 1);
+    e = std::max(e, mpz_scan1(den, 0));
+  }
+  for (int j = 0; j < 4; ++j)
+  {
+    mpz_int const num = numerator(c[j]) << e;
+    m_sum[j] = mpz_int(num / denominator(c[j]));
+  }
+  m_k = 2 * e;
+  normalize();
+}
+
+//static
+bool QuBitRing::contains(QuBitField const& value)
+{
+  // (m + n)/2 and (n - m)/2 have denominators that are powers of two iff m and n have.
+  for (auto const& component : value.m_sum)
+    if (component != 0 && mpz_popcount(mpq_denref(component.to_mpq().backend().data())) != 1)
+      return false;
+  return true;
+}
+
+QuBitField QuBitRing::to_field() const
+{
+  // a + b·ω + c·ω² + d·ω³ = (a + c·i) + ((b - d) + (b + d)·i)·√½.
+  Rational k = to_rational(m_sum[0]);
+  Rational l = to_rational(m_sum[2]);
+  Rational m = to_rational(m_sum[1] - m_sum[3]);
+  Rational n = to_rational(m_sum[1] + m_sum[3]);
+  if ((m_k & 1))
+  {
+    // Multiply with √½: (k + l·i + (m + n·i)·√½)·√½ = (m + n·i)/2 + (k + l·i)·√½.
+    Rational const half(1, 2);
+    std::swap(k, m);
+    std::swap(l, n);
+    k *= half;
+    l *= half;
+  }
+  if (m_k > 1)
+  {
+    Rational const scale = Rational::power_of_two(-(m_k / 2));
+    k *= scale;
+    l *= scale;
+    m *= scale;
+    n *= scale;
+  }
+  return { k, l, m, n };
+}
+
+QuBitRing QuBitRing::times_omega(int n) const
+{
+  QuBitRing result;
+  n &= 7;
+  // ω⁴ = -1.
+  bool const negate = n >= 4;
+  n &= 3;
+  for (int j = 0; j < 4; ++j)
+  {
+    int const to = j + n;
+    // Coefficients that wrap around are negated.
+    if ((to >= 4) != negate)
+      result.m_sum[to & 3] = -m_sum[j];
+    else
+      result.m_sum[to & 3] = m_sum[j];
+  }
+  result.m_k = m_k;
+  return result;
+}
+
+QuBitRing& QuBitRing::operator+=(QuBitRing const& v)
+{
+  if (v.is_zero())
+    return *this;
+  if (is_zero())
+    return *this = v;
+  // Bring both to the same denominator.
+  if (m_k == v.m_k)
+    m_sum += v.m_sum;
+  else if (m_k > v.m_k)
+    m_sum += v.scaled_coefficients(m_k - v.m_k);
+  else
+  {
+    m_sum = scaled_coefficients(v.m_k - m_k) + v.m_sum;
+    m_k = v.m_k;
+  }
+  normalize();
+  return *this;
+}
+
+QuBitRing operator*(QuBitRing const& v1, QuBitRing const& v2)
+{
+  if (v1.is_zero() || v2.is_zero())
+    return {};
+  QuBitRing result;
+  // Multiplication with ±ω^n/√2^k, which covers every entry of every gate.
+  int index;
+  if ((index = v2.unit_monomial_index()) != -1)
+    result = v1.times_omega(v2.m_sum[index] == 1 ? index : index + 4);
+  else if ((index = v1.unit_monomial_index()) != -1)
+    result = v2.times_omega(v1.m_sum[index] == 1 ? index : index + 4);
+  else
+  {
+    // The general case, using ω⁴ = -1.
+    auto const& a = v1.m_sum;
+    auto const& b = v2.m_sum;
+    result.m_sum[0] = a[0] * b[0] - a[1] * b[3] - a[2] * b[2] - a[3] * b[1];
+    result.m_sum[1] = a[0] * b[1] + a[1] * b[0] - a[2] * b[3] - a[3] * b[2];
+    result.m_sum[2] = a[0] * b[2] + a[1] * b[1] + a[2] * b[0] - a[3] * b[3];
+    result.m_sum[3] = a[0] * b[3] + a[1] * b[2] + a[2] * b[1] + a[3] * b[0];
+  }
+  result.m_k = v1.m_k + v2.m_k;
+  result.normalize();
+  return result;
+}
+
+} // namespace quantum
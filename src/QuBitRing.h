@@ -0,0 +1,123 @@
+#pragma once
+
+#include "QuBitField.h"
+#include "Integer.h"
+#include "formula.h"
+#include <Eigen/Core>
+
+namespace quantum {
+
+// This class represents the numbers ℤ[ω, 1/√2] = { (a + b·ω + c·ω² + d·ω³) / √2^k | a,b,c,d ∈ ℤ, k ∈ ℕ }, where ω = e^{iπ/4}.
+//
+// That is the subring of QuBitField that is generated by the Clifford+T gate set.
+// In this basis multiplication by ω (the T gate) is a cyclic shift of the coefficients
+// with one negation (because ω⁴ = -1), multiplication by ω² = i (S) and ω⁴ = -1 (Z) are
+// shifts too, while multiplication by ±1/√2 (H) only changes the exponent k.
+// Therefore gates never need a general multiplication, nor any gcd.
+//
+// Values are kept in canonical form: k is as small as possible (the numerator
+// is not divisible by √2 when k > 0) and zero has k = 0.
+class QuBitRing : public formula::Sum<Eigen::Matrix<Integer, 4, 1>>
+{
+  using base_type = formula::Sum<Eigen::Matrix<Integer, 4, 1>>;
+  friend class QuBitModular;
+  friend class PackedAmplitudes;
+
+ private:
+  int m_k;                              // The power of √2 in the denominator.
+
+  // Bring the value in canonical form.
+  void normalize();
+  // Return true if the numerator is divisible by √2.
+  bool numerator_is_divisible_by_sqrt2() const { return m_sum[0].is_even() == m_sum[2].is_even() && m_sum[1].is_even() == m_sum[3].is_even(); }
+  // Divide the numerator by √2. Only call when numerator_is_divisible_by_sqrt2() returns true.
+  void divide_numerator_by_sqrt2();
+  // Return the coefficients of this value times √2^n.
+  base_type::container_type scaled_coefficients(int n) const;
+  // Return the index of the single non-zero coefficient if that is ±1, or -1 otherwise.
+  int unit_monomial_index() const;
+
+ public:
+  QuBitRing() : base_type{{0, 0, 0, 0}}, m_k(0) { }
+  QuBitRing(int a) : base_type{{a, 0, 0, 0}}, m_k(0) { }
+  QuBitRing(Integer a, Integer b, Integer c, Integer d, int k = 0) : base_type{{a, b, c, d}}, m_k(k) { normalize(); }
+  QuBitRing(QuBitRing const& v) : base_type(v.m_sum), m_k(v.m_k) { }
+  QuBitRing& operator=(QuBitRing const& v) { m_sum = v.m_sum; m_k = v.m_k; return *this; }
+  // Convert a QuBitField to a QuBitRing. The value must be in ℤ[ω, 1/√2]; that is, all denominators must be powers of two.
+  explicit QuBitRing(QuBitField const& value);
+  // Return true if value is in ℤ[ω, 1/√2]; that is, if it can be converted to a QuBitRing.
+  static bool contains(QuBitField const& value);
+
+  // Convert to a QuBitField.
+  QuBitField to_field() const;
+
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const;
+
+  // Accessor for the exponent of √2 in the denominator.
+  int sqrt2_exponent() const { return m_k; }
+
+  // Return this value times ω^n.
+  QuBitRing times_omega(int n) const;
+  // Return this value times √½^n (n may be negative).
+  QuBitRing times_sqrt_half(int n) const;
+  // Return the largest d ≤ limit such that this value divided by √2^d is still in ℤ[ω] (0 if this value isn't in ℤ[ω] to begin with).
+  int sqrt2_valuation(int limit) const;
+
+  QuBitRing& operator+=(QuBitRing const& v);
+  QuBitRing& operator-=(QuBitRing const& v) { return *this += -v; }
+  QuBitRing& operator*=(QuBitRing const& v) { return *this = *this * v; }
+  QuBitRing operator-() const { QuBitRing result(*this); result.m_sum = -m_sum; return result; }
+
+  friend QuBitRing operator+(QuBitRing const& v1, QuBitRing const& v2) { QuBitRing result(v1); result += v2; return result; }
+  friend QuBitRing operator-(QuBitRing const& v1, QuBitRing const& v2) { QuBitRing result(v1); result -= v2; return result; }
+  friend QuBitRing operator*(QuBitRing const& v1, QuBitRing const& v2);
+
+  // The same fused operations as QuBitField has.
+  friend QuBitRing fma(QuBitRing const& v1, QuBitRing const& v2, QuBitRing const& v3) { return v1 * v2 + v3; }
+  friend QuBitRing mul_add(QuBitRing const& v1, QuBitRing const& v2, QuBitRing const& v3, QuBitRing const& v4) { return v1 * v2 + v3 * v4; }
+  friend QuBitRing mul_sub(QuBitRing const& v1, QuBitRing const& v2, QuBitRing const& v3, QuBitRing const& v4) { return v1 * v2 - v3 * v4; }
+  // Because of the canonical form, two values are equal iff their representations are.
+  friend bool operator==(QuBitRing const& v1, QuBitRing const& v2) { return v1.m_k == v2.m_k && v1.m_sum == v2.m_sum; }
+  friend bool operator!=(QuBitRing const& v1, QuBitRing const& v2) { return !(v1 == v2); }
+
+  // The complex conjugate: ω̄ = -ω³, ω̄² = -ω² and ω̄³ = -ω.
+  QuBitRing conjugate() const { return { m_sum[0], -m_sum[3], -m_sum[2], -m_sum[1], m_k }; }
+
+ public:
+  // For printing (override virtual functions of formula::Sum). These are only used for printing, so simply convert to QuBitField.
+  bool starts_with_a_minus() const override { return to_field().starts_with_a_minus(); }
+  bool has_multiple_terms() const override { return to_field().has_multiple_terms(); }
+  bool is_zero() const override { return m_sum[0] == 0 && m_sum[1] == 0 && m_sum[2] == 0 && m_sum[3] == 0; }
+  bool is_unity() const override { return m_k == 0 && (m_sum[0] == 1 || m_sum[0] == -1) && m_sum[1] == 0 && m_sum[2] == 0 && m_sum[3] == 0; }
+  void print_on(std::ostream& os, bool negate_all_terms, bool is_factor) const override { to_field().print_on(os, negate_all_terms, is_factor); }
+};
+
+} // namespace quantum
+
+// Add support for libeigen3. See https://eigen.tuxfamily.org/dox/TopicCustomizing_CustomScalar.html
+
+namespace Eigen {
+
+template<> struct NumTraits<quantum::QuBitRing> : GenericNumTraits<quantum::QuBitRing>
+{
+  typedef quantum::QuBitRing Real;
+  typedef quantum::QuBitRing NonInteger;
+  typedef quantum::QuBitRing Nested;
+
+  static inline Real epsilon() { return 0; }
+  static inline Real dummy_precision() { return 0; }
+  static inline int digits10() { return 0; }
+
+  enum {
+    IsInteger = 0,
+    IsSigned = 1,
+    IsComplex = 0,
+    RequireInitialization = 1,
+    ReadCost = 10,
+    AddCost = 20,
+    MulCost = 40
+  };
+};
+
+} // namespace Eigen
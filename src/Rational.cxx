@@ -0,0 +1,132 @@
+#include "sys.h"
+#include "Rational.h"
+#include "debug.h"
+#include <iostream>
+
+namespace quantum {
+
+Rational::Rational(int64_t num, int64_t den)
+{
+  // Division by zero.
+  ASSERT(den != 0);
+  if (num < min_num || den < min_num)
+  {
+    *this = Rational(mpq_rational(num, den));
+    return;
+  }
+  if (den < 0)
+  {
+    num = -num;
+    den = -den;
+  }
+  int64_t const g = gcd(abs(num), den);
+  m_num = num / g;
+  m_den = den / g;
+}
+
+Rational::Rational(mpq_rational const& value)
+{
+  mpz_srcptr const num = mpq_numref(value.backend().data());
+  mpz_srcptr const den = mpq_denref(value.backend().data());
+  // mpq_rational is always canonical, so if it fits then we can store it inline.
+  if (mpz_fits_slong_p(num) && mpz_fits_slong_p(den))
+  {
+    m_num = mpz_get_si(num);
+    m_den = mpz_get_si(den);
+    if (m_num >= min_num)
+      return;
+  }
+  m_big.reset(new mpq_rational(value));
+}
+
+Rational::mpq_rational Rational::to_mpq() const
+{
+  if (m_big)
+    return *m_big;
+  mpq_rational result;
+  // Already canonical; no need to call mpq_canonicalize.
+  mpq_set_si(result.backend().data(), m_num, m_den);
+  return result;
+}
+
+//static
+Rational Rational::power_of_two(int exponent)
+{
+  int const abs_exponent = exponent < 0 ? -exponent : exponent;
+  if (abs_exponent < 62)
+    return exponent < 0 ? Rational(1, int64_t{1} << abs_exponent, canonical_tag{}) : Rational(int64_t{1} << abs_exponent, 1, canonical_tag{});
+  boost::multiprecision::mpz_int power(1);
+  power <<= abs_exponent;
+  return exponent < 0 ? mpq_rational(boost::multiprecision::mpz_int(1), power) : mpq_rational(power);
+}
+
+bool Rational::is_power_of_two(int& exponent) const
+{
+  if (!m_big)
+  {
+    // In canonical form, at most one of two powers of two can be larger than one.
+    if (m_num <= 0 || (m_num & (m_num - 1)) != 0 || (m_den & (m_den - 1)) != 0)
+      return false;
+    exponent = m_num == 1 ? -__builtin_ctzll(m_den) : __builtin_ctzll(m_num);
+    return true;
+  }
+  mpz_srcptr const num = mpq_numref(m_big->backend().data());
+  mpz_srcptr const den = mpq_denref(m_big->backend().data());
+  if (mpz_sgn(num) <= 0 || mpz_popcount(num) != 1 || mpz_popcount(den) != 1)
+    return false;
+  exponent = static_cast<int>(mpz_scan1(num, 0)) - static_cast<int>(mpz_scan1(den, 0));
+  return true;
+}
+
+Rational Rational::inverse() const
+{
+  // Division by zero.
+  ASSERT(*this != 0);
+  if (m_big)
+    return mpq_rational(1) / *m_big;
+  // Since m_num is never INT64_MIN and m_den is positive, this is canonical again.
+  return m_num < 0 ? Rational(-m_den, -m_num, canonical_tag{}) : Rational(m_den, m_num, canonical_tag{});
+}
+
+//static
+Rational Rational::big_add(Rational const& r1, Rational const& r2)
+{
+  return r1.to_mpq() + r2.to_mpq();
+}
+
+//static
+Rational Rational::big_sub(Rational const& r1, Rational const& r2)
+{
+  return r1.to_mpq() - r2.to_mpq();
+}
+
+//static
+Rational Rational::big_mul(Rational const& r1, Rational const& r2)
+{
+  return r1.to_mpq() * r2.to_mpq();
+}
+
+//static
+int Rational::big_compare(Rational const& r1, Rational const& r2)
+{
+  return r1.to_mpq().compare(r2.to_mpq());
+}
+
+std::size_t Rational::big_hash() const
+{
+  mpq_srcptr const q = m_big->backend().data();
+  mpz_srcptr const num = mpq_numref(q);
+  return (mpz_get_ui(num) + mpz_size(num) * mpz_sgn(num)) * 0x9e3779b97f4a7c15ULL + mpz_get_ui(mpq_denref(q));
+}
+
+std::ostream& operator<<(std::ostream& os, Rational const& r)
+{
+  if (r.m_big)
+    return os << *r.m_big;
+  os << r.m_num;
+  if (r.m_den != 1)
+    os << '/' << r.m_den;
+  return os;
+}
+
+} // namespace quantum
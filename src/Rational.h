@@ -0,0 +1,256 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <boost/multiprecision/gmp.hpp>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <limits>
+#include <type_traits>
+
+namespace quantum {
+
+// A rational number that is stored inline, as an int64_t numerator and denominator,
+// for as long as it fits; and that is promoted to a (heap allocated) mpq_rational
+// only when a value outgrows that.
+//
+// Values are always kept in canonical form: the numerator and denominator have no
+// common factor and the denominator is larger than zero. Moreover, a value is only
+// stored as mpq_rational when it does NOT fit in the inline representation, so that
+// every number has exactly one representation and equality tests remain trivial.
+// The numerator is never allowed to become INT64_MIN, so that negation can't overflow.
+//
+// The result of all arithmetic is exactly the same as when using mpq_rational directly.
+class Rational
+{
+ public:
+  using mpq_rational = boost::multiprecision::mpq_rational;
+
+ private:
+  int64_t m_num;                        // The numerator, if m_big is null.
+  int64_t m_den;                        // The denominator, if m_big is null. Always larger than zero.
+  std::unique_ptr<mpq_rational> m_big;  // Non-null iff the value doesn't fit in m_num / m_den.
+
+  static constexpr int64_t min_num = -std::numeric_limits<int64_t>::max();
+
+  // Construct an inline value that is already known to be canonical.
+  struct canonical_tag { };
+  Rational(int64_t num, int64_t den, canonical_tag) : m_num(num), m_den(den) { }
+
+  static uint64_t gcd(uint64_t u, uint64_t v);
+  static uint64_t abs(int64_t n) { return n < 0 ? -static_cast<uint64_t>(n) : n; }
+
+  // Try to calculate num/den = n1/d1 + n2/d2 with int64_t. Returns false upon overflow.
+  static bool add(int64_t n1, int64_t d1, int64_t n2, int64_t d2, int64_t& num, int64_t& den);
+  // Try to calculate num/den = n1/d1 * n2/d2 with int64_t. Returns false upon overflow.
+  static bool mul(int64_t n1, int64_t d1, int64_t n2, int64_t d2, int64_t& num, int64_t& den);
+
+  // The slow path: do the calculation with mpq_rational.
+  static Rational big_add(Rational const& r1, Rational const& r2);
+  static Rational big_sub(Rational const& r1, Rational const& r2);
+  static Rational big_mul(Rational const& r1, Rational const& r2);
+  static int big_compare(Rational const& r1, Rational const& r2);
+  std::size_t big_hash() const;
+
+ public:
+  Rational() : m_num(0), m_den(1) { }
+  Rational(int num) : m_num(num), m_den(1) { }
+  Rational(long num) : m_num(num), m_den(1) { if (num < min_num) *this = Rational(mpq_rational(num)); }
+  Rational(int64_t num, int64_t den);
+  Rational(mpq_rational const& value);
+  // Allow construction from boost::multiprecision expression templates, like `k * th`.
+  template<typename Expression, typename std::enable_if<
+      std::is_convertible<Expression, mpq_rational>::value &&
+      !std::is_integral<Expression>::value &&
+      !std::is_same<Expression, mpq_rational>::value, int>::type = 0>
+  Rational(Expression const& expression) : Rational(mpq_rational(expression)) { }
+
+  Rational(Rational const& r) : m_num(r.m_num), m_den(r.m_den), m_big(r.m_big ? new mpq_rational(*r.m_big) : nullptr) { }
+  Rational(Rational&& r) = default;
+  Rational& operator=(Rational const& r)
+  {
+    m_num = r.m_num;
+    m_den = r.m_den;
+    if (r.m_big && m_big)
+      *m_big = *r.m_big;        // Reuse the allocated limbs.
+    else if (r.m_big)
+      m_big.reset(new mpq_rational(*r.m_big));
+    else
+      m_big.reset();
+    return *this;
+  }
+  Rational& operator=(Rational&& r) = default;
+
+  // Return true if the value is stored inline.
+  bool is_small() const { return !m_big; }
+
+  // Return a hash of the value. Equal values have equal hashes.
+  std::size_t hash() const { return m_big ? big_hash() : static_cast<std::size_t>(m_num) * 0x9e3779b97f4a7c15ULL + static_cast<std::size_t>(m_den); }
+
+  // Convert to mpq_rational.
+  mpq_rational to_mpq() const;
+
+  // Return 2^exponent (exponent may be negative).
+  static Rational power_of_two(int exponent);
+  // Return true if this value is 2^exponent for some (possibly negative) exponent, and store that in exponent.
+  bool is_power_of_two(int& exponent) const;
+
+  // Return 1 divided by this value, which may not be zero.
+  Rational inverse() const;
+
+  Rational operator-() const { return m_big ? Rational(mpq_rational(-*m_big)) : Rational(-m_num, m_den, canonical_tag{}); }
+
+  friend Rational operator+(Rational const& r1, Rational const& r2)
+  {
+    int64_t num, den;
+    if (!r1.m_big && !r2.m_big && add(r1.m_num, r1.m_den, r2.m_num, r2.m_den, num, den))
+      return {num, den, canonical_tag{}};
+    return big_add(r1, r2);
+  }
+
+  friend Rational operator-(Rational const& r1, Rational const& r2)
+  {
+    int64_t num, den;
+    // Since m_num is never INT64_MIN, negating it can't overflow.
+    if (!r1.m_big && !r2.m_big && add(r1.m_num, r1.m_den, -r2.m_num, r2.m_den, num, den))
+      return {num, den, canonical_tag{}};
+    return big_sub(r1, r2);
+  }
+
+  friend Rational operator*(Rational const& r1, Rational const& r2)
+  {
+    int64_t num, den;
+    if (!r1.m_big && !r2.m_big && mul(r1.m_num, r1.m_den, r2.m_num, r2.m_den, num, den))
+      return {num, den, canonical_tag{}};
+    return big_mul(r1, r2);
+  }
+
+  Rational& operator+=(Rational const& r) { return *this = *this + r; }
+  Rational& operator-=(Rational const& r) { return *this = *this - r; }
+  Rational& operator*=(Rational const& r) { return *this = *this * r; }
+
+  friend bool operator==(Rational const& r1, Rational const& r2)
+  {
+    // Because of the canonical form an inline value can never be equal to a big value.
+    if (!r1.m_big && !r2.m_big)
+      return r1.m_num == r2.m_num && r1.m_den == r2.m_den;
+    return r1.m_big && r2.m_big && *r1.m_big == *r2.m_big;
+  }
+  friend bool operator!=(Rational const& r1, Rational const& r2) { return !(r1 == r2); }
+
+  friend bool operator<(Rational const& r1, Rational const& r2)
+  {
+    if (!r1.m_big && !r2.m_big)
+      return static_cast<__int128>(r1.m_num) * r2.m_den < static_cast<__int128>(r2.m_num) * r1.m_den;
+    return big_compare(r1, r2) < 0;
+  }
+  friend bool operator>(Rational const& r1, Rational const& r2) { return r2 < r1; }
+  friend bool operator<=(Rational const& r1, Rational const& r2) { return !(r2 < r1); }
+  friend bool operator>=(Rational const& r1, Rational const& r2) { return !(r1 < r2); }
+
+  // Comparing with an int is very common (is_zero(), is_unity(), starts_with_a_minus(), etc).
+  // An int always fits inline, so a big value is never equal to it.
+  friend bool operator==(Rational const& r, int n) { return !r.m_big && r.m_den == 1 && r.m_num == n; }
+  friend bool operator!=(Rational const& r, int n) { return !(r == n); }
+  friend bool operator<(Rational const& r, int n) { return r.m_big ? *r.m_big < n : r.m_num < static_cast<__int128>(n) * r.m_den; }
+  friend bool operator>(Rational const& r, int n) { return r.m_big ? *r.m_big > n : r.m_num > static_cast<__int128>(n) * r.m_den; }
+  friend bool operator<=(Rational const& r, int n) { return !(r > n); }
+  friend bool operator>=(Rational const& r, int n) { return !(r < n); }
+
+  // Prints the same as mpq_rational.
+  friend std::ostream& operator<<(std::ostream& os, Rational const& r);
+};
+
+//static
+inline uint64_t Rational::gcd(uint64_t u, uint64_t v)
+{
+  // Binary GCD. Most denominators are powers of two, for which this is very fast.
+  if (u == 0)
+    return v;
+  if (v == 0)
+    return u;
+  int const shift = __builtin_ctzll(u | v);
+  u >>= __builtin_ctzll(u);
+  do
+  {
+    v >>= __builtin_ctzll(v);
+    if (u > v)
+      std::swap(u, v);
+    v -= u;
+  }
+  while (v != 0);
+  return u << shift;
+}
+
+//static
+inline bool Rational::add(int64_t n1, int64_t d1, int64_t n2, int64_t d2, int64_t& num, int64_t& den)
+{
+  if (d1 == d2)
+  {
+    // The most common case: equal denominators (often both 1).
+    if (__builtin_add_overflow(n1, n2, &num))
+      return false;
+    den = d1;
+    if (den != 1)
+    {
+      int64_t const g = gcd(abs(num), den);
+      num /= g;
+      den /= g;
+    }
+  }
+  else
+  {
+    // See Knuth, TAOCP Vol 2, 4.5.1.
+    int64_t const g = gcd(d1, d2);
+    int64_t t1, t2, t;
+    if (__builtin_mul_overflow(n1, d2 / g, &t1) ||
+        __builtin_mul_overflow(n2, d1 / g, &t2) ||
+        __builtin_add_overflow(t1, t2, &t))
+      return false;
+    int64_t const g2 = g == 1 ? 1 : gcd(abs(t), g);
+    num = t / g2;
+    if (__builtin_mul_overflow(d1 / g, d2 / g2, &den))
+      return false;
+  }
+  return num >= min_num;
+}
+
+//static
+inline bool Rational::mul(int64_t n1, int64_t d1, int64_t n2, int64_t d2, int64_t& num, int64_t& den)
+{
+  int64_t const g1 = gcd(abs(n1), d2);
+  int64_t const g2 = gcd(abs(n2), d1);
+  if (__builtin_mul_overflow(n1 / g1, n2 / g2, &num) ||
+      __builtin_mul_overflow(d1 / g2, d2 / g1, &den))
+    return false;
+  return num >= min_num;
+}
+
+} // namespace quantum
+
+// Add support for libeigen3. See https://eigen.tuxfamily.org/dox/TopicCustomizing_CustomScalar.html
+
+namespace Eigen {
+
+template<> struct NumTraits<quantum::Rational> : GenericNumTraits<quantum::Rational>
+{
+  typedef quantum::Rational Real;
+  typedef quantum::Rational NonInteger;
+  typedef quantum::Rational Nested;
+
+  static inline Real epsilon() { return 0; }
+  static inline Real dummy_precision() { return 0; }
+  static inline int digits10() { return 0; }
+
+  enum {
+    IsInteger = 0,
+    IsSigned = 1,
+    IsComplex = 0,
+    RequireInitialization = 1,
+    ReadCost = 3,
+    AddCost = 10,
+    MulCost = 10
+  };
+};
+
+} // namespace Eigen
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace quantum {
+
+// Kernels for the coefficients of EntangledStates of at most max_qubits qubits.
+//
+// Most separable states are that small; their 2^n coefficients are stored inline in
+// an array_type instead of in a heap allocated std::vector. Every kernel below is
+// instantiated for every number of qubits and every choice of input rowbits, so that
+// all loops are unrolled and all indices are compile-time constants. The run-time
+// dispatch is a single lookup in a table of function pointers.
+namespace small_amplitudes {
+
+constexpr int max_qubits = 4;
+constexpr std::size_t max_size = std::size_t{1} << max_qubits;
+
+template<typename Scalar>
+using array_type = std::array<Scalar, max_size>;
+
+// Return index with a zero bit inserted at position bit.
+constexpr unsigned long insert_zero_bit(unsigned long index, int bit)
+{
+  return ((index >> bit) << (bit + 1)) | (index & ((1UL << bit) - 1));
+}
+
+namespace detail {
+
+// Apply the 2x2 matrix to every pair (i0, i1) of a state of number_of_qubits qubits,
+// where i0 and i1 only differ in rowbit.
+template<int number_of_qubits, int rowbit, typename Scalar, typename Matrix, std::size_t... pair>
+void apply_pairs(array_type<Scalar>& c, Matrix const& matrix, std::index_sequence<pair...>)
+{
+  Scalar scratch;
+  ([&]{
+    constexpr unsigned long i0 = insert_zero_bit(pair, rowbit);
+    constexpr unsigned long i1 = i0 | 1UL << rowbit;
+    scratch = c[i0];
+    c[i0] = mul_add(matrix(0, 0), c[i0], matrix(0, 1), c[i1]);
+    c[i1] = mul_add(matrix(1, 0), scratch, matrix(1, 1), c[i1]);
+  }(), ...);
+}
+
+// The same as apply_pairs, for a matrix whose entries are all ±1 (H without its factor √½); negate is true for the -1 entries.
+template<int number_of_qubits, int rowbit, typename Scalar, std::size_t... pair>
+void add_pairs(array_type<Scalar>& c, bool const (&negate)[2][2], std::index_sequence<pair...>)
+{
+  Scalar scratch;
+  ([&]{
+    constexpr unsigned long i0 = insert_zero_bit(pair, rowbit);
+    constexpr unsigned long i1 = i0 | 1UL << rowbit;
+    scratch = c[i0];
+    if (negate[0][0])
+      c[i0] = -c[i0];
+    if (negate[0][1])
+      c[i0] -= c[i1];
+    else
+      c[i0] += c[i1];
+    if (negate[1][1])
+      c[i1] = -c[i1];
+    if (negate[1][0])
+      c[i1] -= scratch;
+    else
+      c[i1] += scratch;
+  }(), ...);
+}
+
+template<int number_of_qubits, int rowbit, typename Scalar, typename Matrix>
+void apply_dense(array_type<Scalar>& c, Matrix const& matrix)
+{
+  using pairs = std::make_index_sequence<(1 << (number_of_qubits - 1))>;
+  if (matrix(0, 0).is_unity() && matrix(0, 1).is_unity() && matrix(1, 0).is_unity() && matrix(1, 1).is_unity())
+  {
+    bool const negate[2][2] = {
+      { matrix(0, 0).starts_with_a_minus(), matrix(0, 1).starts_with_a_minus() },
+      { matrix(1, 0).starts_with_a_minus(), matrix(1, 1).starts_with_a_minus() }
+    };
+    add_pairs<number_of_qubits, rowbit, Scalar>(c, negate, pairs{});
+  }
+  else
+    apply_pairs<number_of_qubits, rowbit, Scalar>(c, matrix, pairs{});
+}
+
+// Apply the monomial gate with input 0 on rowbit bit0 and, if number_of_inputs is 2, input 1 on rowbit bit1,
+// to every group of 2^number_of_inputs coefficients that only differ in those bits.
+template<int number_of_inputs, int bit0, int bit1, typename Scalar, typename Gate, std::size_t... group>
+void apply_groups(array_type<Scalar>& c, Gate const& gate, std::index_sequence<group...>)
+{
+  constexpr int rows = 1 << number_of_inputs;
+  ([&]{
+    constexpr unsigned long base = number_of_inputs == 1 ? insert_zero_bit(group, bit0) :
+        insert_zero_bit(insert_zero_bit(group, std::min(bit0, bit1)), std::max(bit0, bit1));
+    constexpr unsigned long index[4] = { base, base | 1UL << bit0, base | 1UL << bit1, base | 1UL << bit0 | 1UL << bit1 };
+    // Row r of the result is gate.factor(r) times row gate.column(r) of the input.
+    // Permute the coefficients, one cycle at a time.
+    for (int start : gate.cycle_starts())
+    {
+      Scalar first = std::move(c[index[start]]);
+      int row = start;
+      for (int col; (col = gate.column(row)) != start; row = col)
+        c[index[row]] = std::move(c[index[col]]);
+      c[index[row]] = std::move(first);
+    }
+    // Multiply with the non-zero entries, skipping those that are one.
+    for (int row = 0; row < rows; ++row)
+      if (!gate.factor_is_one(row) && !c[index[row]].is_zero())
+        c[index[row]] = gate.times_factor(row, c[index[row]]);
+  }(), ...);
+}
+
+template<int number_of_qubits, int number_of_inputs, int bit0, int bit1, typename Scalar, typename Gate>
+void apply_monomial(array_type<Scalar>& c, Gate const& gate)
+{
+  apply_groups<number_of_inputs, bit0, bit1, Scalar>(c, gate, std::make_index_sequence<(1 << (number_of_qubits - number_of_inputs))>{});
+}
+
+// Replace the coefficients c1 of a state of n1 qubits with the Kronecker product of c2 (n2 qubits) and c1.
+template<int n1, int size, typename Scalar, std::size_t... reverse>
+void merge_in_place(array_type<Scalar>& c1, array_type<Scalar> const& c2, std::index_sequence<reverse...>)
+{
+  // Calculate the result in place, from the highest index down: c1[i] is read last by result index i itself.
+  ([&]{
+    constexpr unsigned long index = size - 1 - reverse;
+    Scalar const& factor1 = c1[index % (1UL << n1)];
+    Scalar const& factor2 = c2[index >> n1];
+    if (factor1.is_zero() || factor2.is_zero())
+      c1[index] = Scalar{};
+    else
+      c1[index] = factor1 * factor2;
+  }(), ...);
+}
+
+template<int n1, int n2, typename Scalar>
+void merge(array_type<Scalar>& c1, array_type<Scalar> const& c2)
+{
+  merge_in_place<n1, (1 << (n1 + n2)), Scalar>(c1, c2, std::make_index_sequence<(1 << (n1 + n2))>{});
+}
+
+// The entries of the dispatch tables. Entry I of a table of single-input kernels is for
+// I / max_qubits + 1 qubits and rowbit I % max_qubits; entry I of the table of two-input kernels
+// is for I / max_qubits² + 1 qubits, with rowbits I / max_qubits % max_qubits and I % max_qubits.
+// Entries for impossible combinations are null.
+template<typename Scalar, typename Matrix, std::size_t I>
+constexpr auto dense_entry()
+{
+  constexpr int n = I / max_qubits + 1, bit = I % max_qubits;
+  if constexpr (bit < n)
+    return &apply_dense<n, bit, Scalar, Matrix>;
+  else
+    return static_cast<void (*)(array_type<Scalar>&, Matrix const&)>(nullptr);
+}
+
+template<typename Scalar, typename Gate, std::size_t I>
+constexpr auto single_input_entry()
+{
+  constexpr int n = I / max_qubits + 1, bit = I % max_qubits;
+  if constexpr (bit < n)
+    return &apply_monomial<n, 1, bit, bit, Scalar, Gate>;
+  else
+    return static_cast<void (*)(array_type<Scalar>&, Gate const&)>(nullptr);
+}
+
+template<typename Scalar, typename Gate, std::size_t I>
+constexpr auto two_input_entry()
+{
+  constexpr int n = I / (max_qubits * max_qubits) + 1, bit0 = I / max_qubits % max_qubits, bit1 = I % max_qubits;
+  if constexpr (bit0 < n && bit1 < n && bit0 != bit1)
+    return &apply_monomial<n, 2, bit0, bit1, Scalar, Gate>;
+  else
+    return static_cast<void (*)(array_type<Scalar>&, Gate const&)>(nullptr);
+}
+
+template<typename Scalar, std::size_t I>
+constexpr auto merge_entry()
+{
+  constexpr int n1 = I / max_qubits + 1, n2 = I % max_qubits + 1;
+  if constexpr (n1 + n2 <= max_qubits)
+    return &merge<n1, n2, Scalar>;
+  else
+    return static_cast<void (*)(array_type<Scalar>&, array_type<Scalar> const&)>(nullptr);
+}
+
+template<typename Scalar, typename Matrix, std::size_t... I>
+constexpr auto dense_table(std::index_sequence<I...>) { return std::array{dense_entry<Scalar, Matrix, I>()...}; }
+
+template<typename Scalar, typename Gate, std::size_t... I>
+constexpr auto single_input_table(std::index_sequence<I...>) { return std::array{single_input_entry<Scalar, Gate, I>()...}; }
+
+template<typename Scalar, typename Gate, std::size_t... I>
+constexpr auto two_input_table(std::index_sequence<I...>) { return std::array{two_input_entry<Scalar, Gate, I>()...}; }
+
+template<typename Scalar, std::size_t... I>
+constexpr auto merge_table(std::index_sequence<I...>) { return std::array{merge_entry<Scalar, I>()...}; }
+
+} // namespace detail
+
+// Apply the 2x2 matrix to rowbit of the coefficients c of a state of number_of_qubits qubits.
+template<typename Scalar, typename Matrix>
+void apply_dense(array_type<Scalar>& c, int number_of_qubits, Matrix const& matrix, int rowbit)
+{
+  static constexpr auto table = detail::dense_table<Scalar, Matrix>(std::make_index_sequence<max_qubits * max_qubits>{});
+  table[(number_of_qubits - 1) * max_qubits + rowbit](c, matrix);
+}
+
+// Apply the monomial single-input gate to rowbit of the coefficients c of a state of number_of_qubits qubits.
+template<typename Scalar, typename Gate>
+void apply_monomial(array_type<Scalar>& c, int number_of_qubits, Gate const& gate, int rowbit)
+{
+  static constexpr auto table = detail::single_input_table<Scalar, Gate>(std::make_index_sequence<max_qubits * max_qubits>{});
+  table[(number_of_qubits - 1) * max_qubits + rowbit](c, gate);
+}
+
+// Apply the monomial two-input gate (like CX), with inputs on rowbit0 and rowbit1, to the coefficients c of a state of number_of_qubits qubits.
+template<typename Scalar, typename Gate>
+void apply_monomial(array_type<Scalar>& c, int number_of_qubits, Gate const& gate, int rowbit0, int rowbit1)
+{
+  static constexpr auto table = detail::two_input_table<Scalar, Gate>(std::make_index_sequence<max_qubits * max_qubits * max_qubits>{});
+  table[((number_of_qubits - 1) * max_qubits + rowbit0) * max_qubits + rowbit1](c, gate);
+}
+
+// Replace the coefficients c1 of a state of n1 qubits with the Kronecker product of c2 (n2 qubits) and c1.
+// Only call when n1 + n2 <= max_qubits.
+template<typename Scalar>
+void merge(array_type<Scalar>& c1, int n1, array_type<Scalar> const& c2, int n2)
+{
+  static constexpr auto table = detail::merge_table<Scalar>(std::make_index_sequence<max_qubits * max_qubits>{});
+  table[(n1 - 1) * max_qubits + n2 - 1](c1, c2);
+}
+
+} // namespace small_amplitudes
+
+} // namespace quantum
@@ -1,16 +1,26 @@
 #include "sys.h"
 #include "State.h"
+#include "CircuitGraph.h"
+#include "ThreadPool.h"
 #include "debug.h"
 #include "utils/reversed.h"
 #include <algorithm>
+#include <iterator>
+#include <mutex>
 #include <numeric>
 
 namespace quantum {
 
-State::State(Circuit const* circuit) : m_circuit(circuit)
+template<typename Scalar>
+BasicState<Scalar>::BasicState(Circuit const* circuit) : State(circuit), m_registry(circuit->q_iend())
 {
+  // The measurement qubits are only added to an EntangledState when needed (see BasicEntangledState::measure).
   for (q_index_type q_index = circuit->q_ibegin(); q_index < circuit->q_iend(); ++q_index)
-    m_separable_states.emplace_back(q_index);
+    if (!circuit->is_measurement(q_index))
+    {
+      m_separable_states.emplace_back(q_index);
+      m_registry.add(m_separable_states.size() - 1, m_separable_states.back());
+    }
 }
 
 int State::apply(q_index_type& chain, Circuit::QuBit::iterator current_node)
@@ -62,39 +72,241 @@ int State::apply(q_index_type& chain, Circuit::QuBit::iterator current_node)
   return 0;
 }
 
-void State::apply(gates::GateInput const& gate_input, q_index_type chain)
+template<typename Scalar>
+void BasicState<Scalar>::apply(gates::GateInput const& gate_input, q_index_type chain)
 {
-  DoutEntering(dc::notice, "State::apply(" << gate_input << ", " << chain << ')');
-  for (auto entangled_state = m_separable_states.begin(); entangled_state != m_separable_states.end(); ++entangled_state)
-    if (entangled_state->has(chain))
-    {
-      entangled_state->apply(gate_input.matrix(), chain);
-      break;
-    }
+  DoutEntering(dc::notice, "BasicState::apply(" << gate_input << ", " << chain << ')');
+  ComponentRegistry::Location const location = m_registry.find(chain);
+  BasicEntangledState<Scalar>& entangled_state = m_separable_states[location.component];
+  entangled_state.apply(gates::GateMatrices<Scalar>::instance().gate[gate_input.gate_index()], chain, location.rowbit);
+  if (entangled_state.maybe_relabel())
+    m_registry.add(location.component, entangled_state);
   Dout(dc::notice, "State now: " << *this);
 }
 
-void State::apply(gates::GateInput const& gate_input, InputCollector const& collector)
+template<typename Scalar>
+void BasicState<Scalar>::remove_component(int component)
+{
+  int const last = m_separable_states.size() - 1;
+  if (component != last)
+  {
+    swap(m_separable_states[component], m_separable_states[last]);
+    m_registry.move(m_separable_states[component].q_index(0), component);
+  }
+  m_separable_states.pop_back();
+}
+
+template<typename Scalar>
+void BasicState<Scalar>::apply(gates::GateInput const& gate_input, InputCollector const& collector)
 {
-  DoutEntering(dc::notice, "State::apply(" << gate_input << ", " << collector << ')');
-  auto entangled_state = m_separable_states.begin();
-  while (!entangled_state->has(collector))
-    ++entangled_state;
-  auto const first_entangled_state = entangled_state;
-  Dout(dc::notice, "Found state " << *first_entangled_state);
-  auto new_end_entangled_state = m_separable_states.end();
-  while (++entangled_state != new_end_entangled_state)
-    if (entangled_state->has(collector))
+  DoutEntering(dc::notice, "BasicState::apply(" << gate_input << ", " << collector << ')');
+  // The only multi-input gate is the controlled NOT (rowbit 1 is the control, rowbit 0 the target).
+  q_index_type const control = collector.rowbit_to_chain(1);
+  q_index_type const target = collector.rowbit_to_chain(0);
+  int const control_component = m_registry.component(control);
+  if (gate_input.is_measurement())
+  {
+    // The target is the measurement qubit.
+    m_separable_states[control_component].measure(control, target);
+    Dout(dc::notice, "State now: " << *this);
+    return;
+  }
+  int const target_component = m_registry.component(target);
+  if (control_component != target_component &&
+      apply_locally(collector, m_separable_states[control_component], m_separable_states[target_component]))
+  {
+    Dout(dc::notice, "State now: " << *this);
+    return;
+  }
+  // Merge the EntangledStates of the inputs into the largest one (the one with the lowest index if there are
+  // more), so that the coefficients that are moved or copied are those of the smaller states.
+  std::vector<int> components;
+  collector.q_index_mask().for_each([&](q_index_type q_index){ components.push_back(m_registry.component(q_index)); });
+  std::sort(components.begin(), components.end());
+  components.erase(std::unique(components.begin(), components.end()), components.end());
+  int destination = *std::max_element(components.begin(), components.end(), [&](int component1, int component2){
+      return m_separable_states[component1].number_of_quantum_bits() < m_separable_states[component2].number_of_quantum_bits(); });
+  Dout(dc::notice, "Found state " << m_separable_states[destination]);
+  for (int component : components)
+  {
+    if (component == destination)
+      continue;
+    BasicEntangledState<Scalar>& destination_state = m_separable_states[destination];
+    BasicEntangledState<Scalar> const& entangled_state = m_separable_states[component];
+    Dout(dc::notice, "Merging state " << entangled_state);
+    m_registry.merge(destination_state.q_index(0), entangled_state.q_index(0), destination_state.number_of_quantum_bits());
+    destination_state.merge(entangled_state);
+    Dout(dc::notice, "Merged state " << destination_state);
+  }
+  // Remove the merged EntangledStates, highest index first, so that the moved elements are never removed later.
+  for (auto component = components.rbegin(); component != components.rend(); ++component)
+  {
+    if (*component == destination)
+      continue;
+    if (destination == static_cast<int>(m_separable_states.size()) - 1)
+      destination = *component;
+    remove_component(*component);
+  }
+  BasicEntangledState<Scalar>& first_entangled_state = m_separable_states[destination];
+  // The only multi-input gate is the controlled NOT.
+  first_entangled_state.apply(gates::GateMatrices<Scalar>::instance().Controlled_X, collector);
+  // The gate might have disentangled some qubits again.
+  std::vector<BasicEntangledState<Scalar>> factors = first_entangled_state.separate(collector, m_circuit->get_measurement_mask());
+  // Separating changed the rowbits of the remaining qubits too, and so does relabeling.
+  if (first_entangled_state.maybe_relabel() || !factors.empty())
+    m_registry.add(destination, first_entangled_state);
+  for (auto& factor : factors)
+  {
+    m_separable_states.push_back(std::move(factor));
+    m_registry.add(m_separable_states.size() - 1, m_separable_states.back());
+  }
+  Dout(dc::notice, "State now: " << *this);
+}
+
+template<typename Scalar>
+bool BasicState<Scalar>::apply_locally(InputCollector const& collector, BasicEntangledState<Scalar>& control_state, BasicEntangledState<Scalar>& target_state)
+{
+  q_index_type const control = collector.rowbit_to_chain(1);
+  q_index_type const target = collector.rowbit_to_chain(0);
+  bool value;
+  if (control_state.is_basis_state(control, value))
+  {
+    Dout(dc::notice, "Control qubit " << control << " is |" << value << "\u27e9.");
+    if (value)
+      target_state.apply(gates::GateMatrices<Scalar>::instance().gate[gates::X], target);
+    return true;
+  }
+  bool minus;
+  if (target_state.is_hadamard_basis_state(minus))
+  {
+    Dout(dc::notice, "Target qubit " << target << " is |" << (minus ? "\u2212" : "+") << "\u27e9.");
+    if (minus)
+      control_state.apply(gates::GateMatrices<Scalar>::instance().gate[gates::Z], control);
+    return true;
+  }
+  return false;
+}
+
+template<typename Scalar>
+void BasicState<Scalar>::execute(CircuitGraph const& graph)
+{
+  DoutEntering(dc::notice, "BasicState::execute(" << graph << ')');
+  // Initially m_separable_states[i] holds qubit i. The result of merging EntangledStates is stored in the one with
+  // the lowest index, so that m_separable_states[i] always holds qubit i, until it is merged away.
+  int const number_of_states = m_separable_states.size();
+  std::vector<int> state_of(m_circuit->q_iend().get_value());   // The index of the EntangledState that holds each qubit,
+  std::iota(state_of.begin(), state_of.end(), 0);               // including the measurement qubits that were materialized.
+  std::mutex state_of_mutex;                            // Protects state_of.
+  std::vector<std::mutex> state_mutex(number_of_states);        // Locked while an operation uses the EntangledState.
+
+  // Lock the EntangledStates that hold the qubits of q_index_mask and return their indices in increasing order.
+  auto lock_states = [&](QIndexMask const& q_index_mask){
+    for (;;)
+    {
+      std::vector<int> states;
+      {
+        std::lock_guard<std::mutex> lock(state_of_mutex);
+        q_index_mask.for_each([&](q_index_type q_index){ states.push_back(state_of[q_index.get_value()]); });
+      }
+      std::sort(states.begin(), states.end());
+      states.erase(std::unique(states.begin(), states.end()), states.end());
+      // Always lock in the same order, so that this can't deadlock.
+      for (int state : states)
+        state_mutex[state].lock();
+      // A merge might have moved a qubit to another EntangledState while we were waiting.
+      bool moved = false;
+      {
+        std::lock_guard<std::mutex> lock(state_of_mutex);
+        q_index_mask.for_each([&](q_index_type q_index){
+          if (!std::binary_search(states.begin(), states.end(), state_of[q_index.get_value()]))
+            moved = true;
+        });
+      }
+      if (!moved)
+        return states;
+      for (int state : states)
+        state_mutex[state].unlock();
+    }
+  };
+
+  TaskScheduler scheduler(ThreadPool::instance().number_of_threads());
+  scheduler.run(graph.successors(), [&](int operation_index){
+    CircuitGraph::Operation const& operation = graph.operations()[operation_index];
+    if (operation.inputs.number_of_inputs() == 0)
+    {
+      int const state = lock_states(QIndexMask{operation.chain})[0];
+      m_separable_states[state].apply(gates::GateMatrices<Scalar>::instance().gate[operation.gate_input->gate_index()], operation.chain);
+      // The registry isn't used here; it is updated at the end.
+      m_separable_states[state].maybe_relabel();
+      state_mutex[state].unlock();
+      return;
+    }
+    q_index_type const control = operation.inputs.rowbit_to_chain(1);
+    if (operation.gate_input->is_measurement())
+    {
+      int const state = lock_states(QIndexMask{control})[0];
+      m_separable_states[state].measure(control, operation.inputs.rowbit_to_chain(0));
+      state_mutex[state].unlock();
+      return;
+    }
+    std::vector<int> const states = lock_states(operation.inputs.q_index_mask());
+    if (states.size() == 2)
     {
-      Dout(dc::notice, "Merging state " << *entangled_state);
-      first_entangled_state->merge(*entangled_state);
-      Dout(dc::notice, "Merged state " << *first_entangled_state);
-      if (entangled_state == --new_end_entangled_state)
-        break;
-      std::swap(*entangled_state, *new_end_entangled_state);
+      bool const control_in_first = m_separable_states[states[0]].has(control);
+      if (apply_locally(operation.inputs, m_separable_states[states[control_in_first ? 0 : 1]], m_separable_states[states[control_in_first ? 1 : 0]]))
+      {
+        state_mutex[states[0]].unlock();
+        state_mutex[states[1]].unlock();
+        return;
+      }
+    }
+    // Merge into the largest EntangledState, after moving that to m_separable_states[states[0]].
+    auto const largest = std::max_element(states.begin(), states.end(), [&](int state1, int state2){
+        return m_separable_states[state1].number_of_quantum_bits() < m_separable_states[state2].number_of_quantum_bits(); });
+    if (largest != states.begin())
+      swap(m_separable_states[states[0]], m_separable_states[*largest]);
+    BasicEntangledState<Scalar>& first_entangled_state = m_separable_states[states[0]];
+    for (auto state = states.begin() + 1; state != states.end(); ++state)
+    {
+      first_entangled_state.merge(m_separable_states[*state]);
+      m_separable_states[*state] = BasicEntangledState<Scalar>();
+    }
+    {
+      std::lock_guard<std::mutex> lock(state_of_mutex);
+      first_entangled_state.q_index_mask().for_each([&](q_index_type q_index){ state_of[q_index.get_value()] = states[0]; });
+    }
+    // The only multi-input gate is the controlled NOT.
+    first_entangled_state.apply(gates::GateMatrices<Scalar>::instance().Controlled_X, operation.inputs);
+    for (auto state = states.begin() + 1; state != states.end(); ++state)
+      state_mutex[*state].unlock();
+    // The gate might have disentangled some qubits again. Every factor goes to the (empty) EntangledState
+    // of its lowest qubit, while the factor with qubit states[0] must stay where it is.
+    std::vector<BasicEntangledState<Scalar>> factors = first_entangled_state.separate(operation.inputs, m_circuit->get_measurement_mask());
+    for (auto& factor : factors)
+      if (factor.has(q_index_type{static_cast<std::size_t>(states[0])}))
+        std::swap(factor, first_entangled_state);
+    for (auto& factor : factors)
+    {
+      int const state = factor.q_index_mask().first().get_value();
+      std::lock_guard<std::mutex> state_lock(state_mutex[state]);
+      m_separable_states[state] = std::move(factor);
+      std::lock_guard<std::mutex> lock(state_of_mutex);
+      m_separable_states[state].q_index_mask().for_each([&](q_index_type q_index){ state_of[q_index.get_value()] = state; });
     }
-  first_entangled_state->apply(gate_input.matrixX(), collector);
-  m_separable_states.erase(new_end_entangled_state, m_separable_states.end());
+    state_mutex[states[0]].unlock();
+  });
+
+  // Remove the EntangledStates that were merged away.
+  std::vector<BasicEntangledState<Scalar>> separable_states;
+  for (int state = 0; state < number_of_states; ++state)
+    if (state_of[state] == state)
+    {
+      separable_states.push_back(std::move(m_separable_states[state]));
+      separable_states.back().sort_quantum_bits();
+    }
+  m_separable_states.swap(separable_states);
+  for (int component = 0; component < static_cast<int>(m_separable_states.size()); ++component)
+    m_registry.add(component, m_separable_states[component]);
   Dout(dc::notice, "State now: " << *this);
 }
 
@@ -123,16 +335,28 @@ void State::apply(gates::measure const& measurement, q_index_type chain)
   Dout(dc::notice, "State now: " << *this);
 }
 
-void State::print_on(std::ostream& os) const
+template<typename Scalar>
+void BasicState<Scalar>::print_on(std::ostream& os) const
 {
-  unsigned long const measurement_mask = m_circuit->get_measurement_mask();
-  bool const need_parens = m_separable_states.size() > 1;
+  // Print the outcomes of the measurements as their measurement qubits.
+  bool const has_measurements = std::any_of(m_separable_states.begin(), m_separable_states.end(), [](auto const& state){ return state.has_measurements(); });
+  std::vector<BasicEntangledState<Scalar>> materialized_states;
+  if (has_measurements)
+  {
+    materialized_states = m_separable_states;
+    for (auto& entangled_state : materialized_states)
+      entangled_state.materialize_measurements();
+  }
+  std::vector<BasicEntangledState<Scalar>> const& separable_states = has_measurements ? materialized_states : m_separable_states;
+
+  QIndexMask const& measurement_mask = m_circuit->get_measurement_mask();
+  bool const need_parens = separable_states.size() > 1;
 
   char const* prefix = "";
-  for (auto entangled_state : adaptor::reversed(m_separable_states))
+  for (auto entangled_state : adaptor::reversed(separable_states))
   {
     // Skip all pure "measurement qubits" product states (should be just a single term).
-    if ((entangled_state.q_index_mask() & measurement_mask) == entangled_state.q_index_mask())
+    if (entangled_state.q_index_mask().is_subset_of(measurement_mask))
       continue;
     os << prefix;
     if (entangled_state.starts_with_a_minus())
@@ -145,13 +369,12 @@ void State::print_on(std::ostream& os) const
   // First print the isolated quantum state -- not entangled with measurement bits.
   int cnt = 0;
   /* char const* */ prefix = "";
-  for (auto entangled_state : adaptor::reversed(m_separable_states))
+  for (auto entangled_state : adaptor::reversed(separable_states))
   {
     // Skip all pure "measurement qubits" product states (should be just a single term).
-    if ((entangled_state.q_index_mask() & measurement_mask) == entangled_state.q_index_mask())
+    if (entangled_state.q_index_mask().is_subset_of(measurement_mask))
       continue;
-    unsigned long reality_mask = entangled_state.q_index_mask() & measurement_mask;
-    if (reality_mask == 0)
+    if (!entangled_state.q_index_mask().intersects(measurement_mask))
     {
       os << prefix;
       if (entangled_state.starts_with_a_minus())
@@ -167,13 +390,12 @@ void State::print_on(std::ostream& os) const
     return;
   if (*prefix != '\0')
     prefix = " \u2297";       // " ⊗", no trailing space because print_measurement_permutations_on prints things on a new line anyway.
-  for (auto entangled_state : adaptor::reversed(m_separable_states))
+  for (auto entangled_state : adaptor::reversed(separable_states))
   {
     // Skip all pure "measurement qubits" product states (should be just a single term).
-    if ((entangled_state.q_index_mask() & measurement_mask) == entangled_state.q_index_mask())
+    if (entangled_state.q_index_mask().is_subset_of(measurement_mask))
       continue;
-    unsigned long reality_mask = entangled_state.q_index_mask() & measurement_mask;
-    if (reality_mask != 0)
+    if (entangled_state.q_index_mask().intersects(measurement_mask))
     {
       os << prefix;
       entangled_state.print_measurement_permutations_on(os, m_circuit);
@@ -182,9 +404,10 @@ void State::print_on(std::ostream& os) const
   }
 }
 
-// Only use for debugging purposes; this isn't *always* exact.
-bool operator==(State const& lhs, State const& rhs)
+template<typename Scalar>
+bool BasicState<Scalar>::equals(BasicState const& rhs) const
 {
+  BasicState const& lhs{*this};
   size_t lhs_size = lhs.m_separable_states.size();
   std::vector<int> lhs_i(lhs_size);
   std::iota(lhs_i.begin(), lhs_i.end(), 0);
@@ -197,9 +420,9 @@ bool operator==(State const& lhs, State const& rhs)
   std::vector<int>::iterator rhs_ii = rhs_i.begin();
   for (;;)
   {
-    unsigned long lhs_mask = lhs.m_separable_states[*lhs_ii].q_index_mask();
-    unsigned long rhs_mask = rhs.m_separable_states[*rhs_ii].q_index_mask();
-    if ((lhs_mask & rhs_mask) != std::min(lhs_mask, rhs_mask))
+    QIndexMask const& lhs_mask = lhs.m_separable_states[*lhs_ii].q_index_mask();
+    QIndexMask const& rhs_mask = rhs.m_separable_states[*rhs_ii].q_index_mask();
+    if (!lhs_mask.is_subset_of(rhs_mask) && !rhs_mask.is_subset_of(lhs_mask))
       return false;     // Different entangled states. Strictly this could mean that both sides holds an EntangledState that is actually separable,
                         // ie, XY and YZ; where the correct (most separated) list should be X, Y, Z, but to detect that I'd have to always calculate
                         // the full state (merge all EntangledState's) and I don't want to do that (or worse, be able to find those separations).
@@ -210,13 +433,13 @@ bool operator==(State const& lhs, State const& rhs)
     }
     else
     {
-      unsigned long larger_mask = lhs_mask | rhs_mask;
-      State const& smaller_hsp{(lhs_mask < rhs_mask) ? lhs : rhs};
-      State const& larger_hsp{(lhs_mask > rhs_mask) ? lhs : rhs};
+      QIndexMask const larger_mask = lhs_mask | rhs_mask;
+      BasicState const& smaller_hsp{(lhs_mask < rhs_mask) ? lhs : rhs};
+      BasicState const& larger_hsp{(lhs_mask > rhs_mask) ? lhs : rhs};
       std::vector<int>::iterator& smaller_hs_ii{(lhs_mask < rhs_mask) ? lhs_ii : rhs_ii};
       std::vector<int>::iterator& larger_hs_ii{(lhs_mask > rhs_mask) ? lhs_ii : rhs_ii};
       std::vector<int>::iterator const& smaller_ii_end{(lhs_mask < rhs_mask) ? lhs_i.end() : rhs_i.end()};
-      EntangledState smaller_es_cpy{smaller_hsp.m_separable_states[*smaller_hs_ii]};
+      BasicEntangledState<Scalar> smaller_es_cpy{smaller_hsp.m_separable_states[*smaller_hs_ii]};
       while (smaller_hs_ii != smaller_ii_end && smaller_es_cpy.q_index_mask() < larger_mask)
         smaller_es_cpy.merge(smaller_hsp.m_separable_states[*++smaller_hs_ii]);
       if (smaller_hs_ii == smaller_ii_end || smaller_es_cpy.q_index_mask() != larger_mask)
@@ -231,6 +454,10 @@ bool operator==(State const& lhs, State const& rhs)
   }
 }
 
+// Explicit instantiations.
+template class BasicState<QuBitField>;
+template class BasicState<QuBitComplex>;
+
 } // namespace quantum
 
 #if defined(CWDEBUG) && !defined(DOXYGEN)
@@ -3,6 +3,8 @@
 #include "Circuit.h"
 #include "InputCollector.h"
 #include "EntangledState.h"
+#include "ComponentRegistry.h"
+#include "QuBitComplex.h"
 #include "debug.h"
 #include <cstddef>
 #include <stack>
@@ -17,22 +19,29 @@ NAMESPACE_DEBUG_CHANNELS_END
 namespace quantum {
 
 // Quantum state of the whole system.
+//
+// This base class parses the circuit (see apply); the derived class BasicState
+// stores the actual state and applies the gates to it.
 class State
 {
- private:
+ protected:
   using q_index_type = utils::VectorIndex<index_category::qubits>;
 
   Circuit const* m_circuit;                             // A pointer to the underlaying circuit that this is the state of.
+
+ private:
   std::stack<InputCollector> m_stack;                   // A temporary stack used by `apply' to parse the circuit-building code.
-  std::vector<EntangledState> m_separable_states;       // A list of separable states; the Kronecker product of which forms the complete state.
+
+ protected:
+  virtual void apply(gates::GateInput const& gate_input, q_index_type chain) = 0;
+  virtual void apply(gates::GateInput const& gate_input, InputCollector const& collector) = 0;
 
  private:
-  void apply(gates::GateInput const& gate_input, q_index_type chain);
-  void apply(gates::GateInput const& gate_input, InputCollector const& collector);
   void apply(gates::measure const& measurement, q_index_type chain);
 
  public:
-  State(Circuit const* circuit);
+  State(Circuit const* circuit) : m_circuit(circuit) { }
+  virtual ~State() { }
 
   // Called from Circuit::execute while parsing the circuit-building code.
   // chain is the current qubit index (into Circuit::m_quantum_register) and
@@ -40,12 +49,51 @@ class State
   // which is just a wrapper around a pointer to a gate input.
   int apply(q_index_type& chain, Circuit::QuBit::iterator current_node);
 
+  // Print the product of the separable states.
+  virtual void print_on(std::ostream& os) const = 0;
+  friend std::ostream& operator<<(std::ostream& os, State const& state) { state.print_on(os); return os; }
+};
+
+// The state as a list of separable BasicEntangledState<Scalar>.
+//
+// Circuit::execute uses QuBitField (exact) or QuBitComplex (fast) for Scalar.
+template<typename Scalar>
+class BasicState : public State
+{
+ private:
+  std::vector<BasicEntangledState<Scalar>> m_separable_states;  // A list of separable states; the Kronecker product of which forms the complete state.
+  ComponentRegistry m_registry;                                 // The element of m_separable_states that holds each qubit, and its rowbit.
+
+ private:
+  void apply(gates::GateInput const& gate_input, q_index_type chain) override;
+  void apply(gates::GateInput const& gate_input, InputCollector const& collector) override;
+
+  // Apply the controlled NOT on the inputs of collector without merging control_state and target_state, the EntangledStates
+  // of its control and target qubit, when that is possible: when the control qubit is exactly |0⟩ (do nothing) or |1⟩ (apply X
+  // to the target), or when the target is exactly |+⟩ (do nothing) or |−⟩ (apply Z to the control). Returns true if it did.
+  bool apply_locally(InputCollector const& collector, BasicEntangledState<Scalar>& control_state, BasicEntangledState<Scalar>& target_state);
+
+  // Remove m_separable_states[component] by moving the last element into its place.
+  void remove_component(int component);
+
+  // Only use for debugging purposes; this isn't *always* exact.
+  bool equals(BasicState const& rhs) const;
+
+ public:
+  BasicState(Circuit const* circuit);
+
+  // Apply all operations of graph to the initial state, on ThreadPool::instance().number_of_threads() threads.
+  //
+  // Operations on different EntangledStates run at the same time; an operation locks the EntangledStates of
+  // its qubits and a multi-input gate merges them first. The qubits of the resulting EntangledStates are put
+  // in order of their index, because the order in which they were merged depends on the timing.
+  void execute(CircuitGraph const& graph);
+
   // Compare if two states are equal.
-  friend bool operator==(State const& lhs, State const& rhs);
+  friend bool operator==(BasicState const& lhs, BasicState const& rhs) { return lhs.equals(rhs); }
 
   // Print the product of the m_separable_states.
-  void print_on(std::ostream& os) const;
-  friend std::ostream& operator<<(std::ostream& os, State const& state) { state.print_on(os); return os; }
+  void print_on(std::ostream& os) const override;
 };
 
 } // namespace quantum
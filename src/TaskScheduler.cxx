@@ -0,0 +1,92 @@
+#include "sys.h"
+#include "TaskScheduler.h"
+#include "debug.h"
+#include <thread>
+
+namespace quantum {
+
+TaskScheduler::TaskScheduler(int number_of_threads) :
+  m_number_of_threads(number_of_threads), m_successors(nullptr), m_task(nullptr), m_remaining(0)
+{
+  ASSERT(number_of_threads >= 1);
+}
+
+void TaskScheduler::worker(int thread)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;)
+  {
+    int task = -1;
+    std::deque<int>& own_queue = m_queues[thread];
+    if (!own_queue.empty())
+    {
+      task = own_queue.back();
+      own_queue.pop_back();
+    }
+    else
+    {
+      for (int i = 1; i < m_number_of_threads; ++i)
+      {
+        std::deque<int>& victim_queue = m_queues[(thread + i) % m_number_of_threads];
+        if (!victim_queue.empty())
+        {
+          task = victim_queue.front();
+          victim_queue.pop_front();
+          break;
+        }
+      }
+    }
+    if (task == -1)
+    {
+      if (m_remaining == 0)
+        return;
+      m_task_available.wait(lock);
+      continue;
+    }
+    lock.unlock();
+    (*m_task)(task);
+    lock.lock();
+    --m_remaining;
+    int ready = 0;
+    for (int successor : (*m_successors)[task])
+      if (--m_number_of_predecessors[successor] == 0)
+      {
+        own_queue.push_back(successor);
+        ++ready;
+      }
+    // This thread continues with one of the ready tasks itself; wake up the others for the rest (or to return).
+    if (ready > 1 || m_remaining == 0)
+      m_task_available.notify_all();
+  }
+}
+
+void TaskScheduler::run(successors_type const& successors, task_type const& task)
+{
+  int const number_of_tasks = successors.size();
+  m_successors = &successors;
+  m_task = &task;
+  m_remaining = number_of_tasks;
+  m_number_of_predecessors.assign(number_of_tasks, 0);
+  for (auto const& task_successors : successors)
+    for (int successor : task_successors)
+      ++m_number_of_predecessors[successor];
+  // Deal out the tasks that are ready from the start.
+  m_queues.assign(m_number_of_threads, {});
+  int next_thread = 0;
+  for (int i = 0; i < number_of_tasks; ++i)
+    if (m_number_of_predecessors[i] == 0)
+    {
+      m_queues[next_thread].push_back(i);
+      next_thread = (next_thread + 1) % m_number_of_threads;
+    }
+
+  std::vector<std::thread> threads;
+  for (int thread = 1; thread < m_number_of_threads; ++thread)
+    threads.emplace_back(&TaskScheduler::worker, this, thread);
+  worker(0);
+  for (std::thread& thread : threads)
+    thread.join();
+  ASSERT(m_remaining == 0);
+}
+
+} // namespace quantum
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace quantum {
+
+// Runs a set of tasks that depend on each other (a DAG) on a number of threads, with work stealing.
+//
+// Every thread has its own queue of ready tasks. A thread takes the task that it made ready
+// last from the back of its own queue (so that it continues with the same data), and when its
+// own queue is empty it steals the oldest task from the front of the queue of another thread.
+// A task becomes ready when all tasks that it depends on returned.
+//
+// The calling thread is one of the threads; the others are started by run and joined before it returns.
+class TaskScheduler
+{
+ public:
+  using successors_type = std::vector<std::vector<int>>;        // The tasks that depend on each task.
+  using task_type = std::function<void(int)>;
+
+ private:
+  int m_number_of_threads;                      // The number of threads that run tasks, including the calling thread.
+  successors_type const* m_successors;          // The dependencies of the current run.
+  task_type const* m_task;                      // The body of the tasks of the current run.
+
+  std::mutex m_mutex;                           // Protects the members below.
+  std::condition_variable m_task_available;
+  std::vector<std::deque<int>> m_queues;        // The ready tasks of each thread.
+  std::vector<int> m_number_of_predecessors;    // The number of tasks that each task still waits for.
+  int m_remaining;                              // The number of tasks that didn't return yet.
+
+  // The main loop of thread number thread.
+  void worker(int thread);
+
+ public:
+  TaskScheduler(int number_of_threads);
+
+  // Call task(i) for every i in [0, successors.size()), where task(j) is only called after task(i)
+  // returned if j is in successors[i]. Returns when all calls returned.
+  void run(successors_type const& successors, task_type const& task);
+};
+
+} // namespace quantum
@@ -0,0 +1,96 @@
+#include "sys.h"
+#include "ThreadPool.h"
+#include "debug.h"
+
+namespace quantum {
+
+ThreadPool::ThreadPool() :
+  m_number_of_threads(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1)),
+  m_grain_size(default_grain_size), m_min_parallel_size(default_min_parallel_size),
+  m_generation(0), m_stop(false), m_job(nullptr), m_size(0), m_block(1), m_busy(0), m_next(0)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+  stop_workers();
+}
+
+//static
+ThreadPool& ThreadPool::instance()
+{
+  static ThreadPool s_instance;
+  return s_instance;
+}
+
+void ThreadPool::set_number_of_threads(int number_of_threads)
+{
+  ASSERT(number_of_threads >= 1);
+  std::lock_guard<std::mutex> run_lock(m_run_mutex);
+  stop_workers();
+  m_number_of_threads = number_of_threads;
+}
+
+void ThreadPool::stop_workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_job_available.notify_all();
+  for (std::thread& worker : m_workers)
+    worker.join();
+  m_workers.clear();
+  m_stop = false;
+}
+
+void ThreadPool::take_blocks(job_type const& job)
+{
+  for (unsigned long begin; (begin = m_next.fetch_add(m_block, std::memory_order_relaxed)) < m_size;)
+    job(begin, std::min(begin + m_block, m_size));
+}
+
+void ThreadPool::worker(uint64_t generation)
+{
+  for (;;)
+  {
+    job_type const* job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_job_available.wait(lock, [&]{ return m_stop || m_generation != generation; });
+      if (m_stop)
+        return;
+      generation = m_generation;
+      job = m_job;
+    }
+    take_blocks(*job);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      // Every worker checks in once per loop, so that run doesn't return while a worker still uses the job.
+      if (--m_busy == 0)
+        m_job_done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::run(job_type const& job, unsigned long size, unsigned long block)
+{
+  std::lock_guard<std::mutex> run_lock(m_run_mutex);
+  while (static_cast<int>(m_workers.size()) < m_number_of_threads - 1)
+    m_workers.emplace_back(&ThreadPool::worker, this, m_generation);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = &job;
+    m_size = size;
+    m_block = block;
+    m_next.store(0, std::memory_order_relaxed);
+    m_busy = m_workers.size();
+    ++m_generation;
+  }
+  m_job_available.notify_all();
+  take_blocks(job);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_job_done.wait(lock, [this]{ return m_busy == 0; });
+}
+
+} // namespace quantum
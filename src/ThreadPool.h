@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quantum {
+
+// Worker threads that split the loops over the coefficients of a single large EntangledState.
+//
+// A loop is split in blocks of about grain_size() coefficients, which are handed out to
+// the workers and to the calling thread until none are left. Loops over fewer than
+// min_parallel_size() coefficients are run by the calling thread only, exactly as before,
+// because waking up the workers costs more than what they would save.
+//
+// The workers are started upon the first loop that is large enough. Every block only
+// reads and writes its own coefficients, and GMP is thread-safe for distinct values;
+// with GmpMemory::pooled each thread recycles the limbs of its temporaries through
+// its own free lists.
+class ThreadPool
+{
+ public:
+  using job_type = std::function<void(unsigned long, unsigned long)>;
+
+  static constexpr unsigned long default_grain_size = 4096;
+  static constexpr unsigned long default_min_parallel_size = 1UL << 16;
+
+ private:
+  int m_number_of_threads;              // The number of threads that run a loop, including the calling thread.
+  unsigned long m_grain_size;           // The number of coefficients per block.
+  unsigned long m_min_parallel_size;    // Smaller loops are not split.
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_run_mutex;               // Held by the thread that runs a loop, so that only one loop is split at a time.
+  std::mutex m_mutex;                   // Protects the members below.
+  std::condition_variable m_job_available;
+  std::condition_variable m_job_done;
+  uint64_t m_generation;                // Incremented for every loop.
+  bool m_stop;                          // Set to make the workers return.
+  job_type const* m_job;                // The body of the current loop.
+  unsigned long m_size;                 // The number of items of the current loop.
+  unsigned long m_block;                // The number of items per block.
+  int m_busy;                           // The number of workers that didn't finish the current loop yet.
+  std::atomic<unsigned long> m_next;    // The first item of the next block.
+
+  // The main loop of a worker; generation is the value of m_generation when it was started.
+  void worker(uint64_t generation);
+  void stop_workers();
+  // Call job for blocks of the current loop until there are none left.
+  void take_blocks(job_type const& job);
+  // Split a loop over size items in blocks of block items.
+  void run(job_type const& job, unsigned long size, unsigned long block);
+
+ public:
+  ThreadPool();
+  ~ThreadPool();
+
+  // The pool that is used by all EntangledStates.
+  static ThreadPool& instance();
+
+  // Use number_of_threads threads (including the calling thread) per loop; 1 disables splitting.
+  // The default is the number of hardware threads. Only call while no loop is running.
+  void set_number_of_threads(int number_of_threads);
+  int number_of_threads() const { return m_number_of_threads; }
+
+  void set_grain_size(unsigned long grain_size) { m_grain_size = grain_size; }
+  unsigned long grain_size() const { return m_grain_size; }
+
+  void set_min_parallel_size(unsigned long min_parallel_size) { m_min_parallel_size = min_parallel_size; }
+  unsigned long min_parallel_size() const { return m_min_parallel_size; }
+
+  // Call f(begin, end) for blocks [begin, end) that together cover [0, size) exactly once, where each item
+  // is weight coefficients. The calls are made from several threads at once if size * weight is at least
+  // min_parallel_size(); otherwise this simply calls f(0, size). Returns when all calls returned.
+  template<typename F>
+  void for_each_block(unsigned long size, unsigned long weight, F const& f)
+  {
+    unsigned long const block = std::max(m_grain_size / weight, 1UL);
+    if (m_number_of_threads <= 1 || size * weight < m_min_parallel_size || block >= size)
+    {
+      f(0, size);
+      return;
+    }
+    run(job_type(std::cref(f)), size, block);
+  }
+};
+
+} // namespace quantum
@@ -0,0 +1,91 @@
+#include "sys.h"
+#include "Butterfly.h"
+#include "PackedAmplitudes.h"
+#include "Gates.h"
+#include "debug.h"
+#include <chrono>
+#include <iostream>
+
+using namespace quantum;
+
+// Micro-benchmark for apply_butterfly: apply H (without its factor √½) to every qubit
+// of a dense state of n qubits and print the number of amplitudes that were processed per second.
+// The same is done for PackedAmplitudes (int64_t numerators), and compared with apply_butterfly.
+//
+// Usage: butterfly_benchmark [min_qubits [max_qubits]]   (default 10 20; at most 24).
+
+namespace {
+
+// Return a state vector of 2^number_of_qubits coefficients that are mostly distinct.
+std::vector<QuBitField> initial_coefficients(int number_of_qubits)
+{
+  std::vector<QuBitField> coefficients;
+  unsigned long const size = 1UL << number_of_qubits;
+  coefficients.reserve(size);
+  for (unsigned long i = 0; i < size; ++i)
+    coefficients.emplace_back(Rational(static_cast<long>(i % 7) - 3), Rational(static_cast<long>(i % 5)), Rational(static_cast<long>(i % 3) - 1), Rational(1, 2));
+  return coefficients;
+}
+
+// The previous implementation, for comparison.
+void apply_eigen(std::vector<QuBitField>& coefficients, QMatrix const& matrix, unsigned long rowbit_mask)
+{
+  for (unsigned long i0 = 0; i0 < coefficients.size(); ++i0)
+  {
+    if ((i0 & rowbit_mask))
+      continue;
+    unsigned long i1 = i0 | rowbit_mask;
+    Eigen::Matrix<QuBitField, 2, 1> v1{coefficients[i0], coefficients[i1]};
+    Eigen::Matrix<QuBitField, 2, 1> v2{matrix * v1};
+    coefficients[i0] = v2[0];
+    coefficients[i1] = v2[1];
+  }
+}
+
+template<typename Kernel>
+double run(std::vector<QuBitField>& coefficients, int number_of_qubits, Kernel kernel)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int q = 0; q < number_of_qubits; ++q)
+    kernel(coefficients, 1UL << q);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int const min_qubits = argc > 1 ? std::atoi(argv[1]) : 10;
+  int const max_qubits = std::min(argc > 2 ? std::atoi(argv[2]) : 20, 24);
+
+  GateMatrix<QMatrix> const& H_gate = gates::gate_matrices[gates::H];
+  QMatrix const& H = H_gate.unscaled();
+  for (int number_of_qubits = min_qubits; number_of_qubits <= max_qubits; ++number_of_qubits)
+  {
+    std::vector<QuBitField> coefficients = initial_coefficients(number_of_qubits);
+    std::vector<QuBitField> reference = coefficients;
+    double const seconds = run(coefficients, number_of_qubits,
+        [&](std::vector<QuBitField>& c, unsigned long rowbit_mask){ apply_butterfly(c, H, rowbit_mask); });
+    double const eigen_seconds = run(reference, number_of_qubits,
+        [&](std::vector<QuBitField>& c, unsigned long rowbit_mask){ apply_eigen(c, H, rowbit_mask); });
+    // Both must give exactly the same result.
+    ASSERT(coefficients == reference);
+    PackedAmplitudes packed;
+    [[maybe_unused]] bool const fits = packed.assign(initial_coefficients(number_of_qubits));
+    ASSERT(fits);
+    auto start = std::chrono::steady_clock::now();
+    for (int q = 0; q < number_of_qubits; ++q)
+    {
+      [[maybe_unused]] unsigned long const first = packed.apply(H_gate, { 1UL << q });
+      ASSERT(first == packed.size());
+    }
+    double const packed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ASSERT(packed.expand() == coefficients);
+    double const amplitudes = static_cast<double>(number_of_qubits) * coefficients.size();
+    std::cout << number_of_qubits << " qubits: " << (amplitudes / seconds) << " amplitudes/s (Eigen: " <<
+      (amplitudes / eigen_seconds) << " amplitudes/s, speed up " << (eigen_seconds / seconds) << "; packed: " <<
+      (amplitudes / packed_seconds) << " amplitudes/s, speed up " << (seconds / packed_seconds) << ")." << std::endl;
+  }
+}
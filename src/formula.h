@@ -238,7 +238,7 @@ bool Sum<SumContainer>::is_zero() const
   {
     return !std::any_of(m_sum.begin(), m_sum.end(),
         [](typename SumContainer::value_type const& i)
-        { return !i.is_zero(); });
+        { return !formula::is_zero(i); });
   }
   else
   {
@@ -2,11 +2,12 @@
 #include "debug.h"
 #include "EntangledState.h"
 #include "State.h"
+#include <string>
 
 using namespace quantum;
 using namespace gates;
 
-int main()
+int main(int argc, char* argv[])
 {
   Debug(NAMESPACE_DEBUG::init());
 
@@ -20,7 +21,17 @@ int main()
 
   std::cout << "The circuit:\n";
   std::cout << q << std::endl;
-  q.execute();
+  // Pass --fast to calculate with double precision (printing decimal amplitudes) instead of exact,
+  // and --concurrent to apply gates on separate EntangledStates on several threads at once.
+  bool fast = false;
+  bool concurrent = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string const arg = argv[i];
+    fast |= arg == "--fast";
+    concurrent |= arg == "--concurrent";
+  }
+  q.execute(fast ? Circuit::fast : Circuit::exact, concurrent ? Circuit::concurrent : Circuit::sequential);
   std::shared_ptr<State> state = q.state();
   std::cout << "\nResult: " << *state << '\n' << std::endl;
 }
@@ -17,4 +17,50 @@ int main()
           QuBitField v(k * th, l * th, m * th, n * th);
           Dout(dc::notice, v);
         }
+
+  // Test that Rational gives exactly the same results as mpq_rational,
+  // also when the inline int64_t representation overflows.
+  {
+    Dout(dc::notice, "TEST OF quantum::Rational.");
+    debug::Indent indent(2);
+
+    int64_t const big = std::numeric_limits<int64_t>::max();
+    std::vector<mpq_rational> values = {
+      0, 1, -1, mpq_rational(1, 2), mpq_rational(-3, 4), mpq_rational(big), mpq_rational(-big),
+      mpq_rational(big, 2), mpq_rational(1, big), mpq_rational(-big, big - 1), mpq_rational(big) * big
+    };
+    for (auto&& q1 : values)
+      for (auto&& q2 : values)
+      {
+        Rational r1(q1), r2(q2);
+        ASSERT((r1 + r2).to_mpq() == q1 + q2);
+        ASSERT((r1 - r2).to_mpq() == q1 - q2);
+        ASSERT((r1 * r2).to_mpq() == q1 * q2);
+        ASSERT((r1 < r2) == (q1 < q2));
+        ASSERT((r1 == r2) == (q1 == q2));
+        // Results that fit must have been demoted to the inline representation.
+        ASSERT((r1 * r2).is_small() == Rational(mpq_rational(q1 * q2)).is_small());
+      }
+    for (auto&& q : values)
+      if (q != 0)
+        ASSERT(Rational(q).inverse().to_mpq() == 1 / q);
+    for (int exponent = -70; exponent <= 70; exponent += 7)
+    {
+      int e;
+      ASSERT(Rational::power_of_two(exponent).is_power_of_two(e) && e == exponent);
+      ASSERT(!(-Rational::power_of_two(exponent)).is_power_of_two(e));
+      ASSERT(!(Rational::power_of_two(exponent) * Rational(mpq_rational(3))).is_power_of_two(e));
+    }
+    // Repeated squaring must promote and stay exact.
+    Rational r(mpq_rational(3, 2));
+    mpq_rational q(3, 2);
+    for (int i = 0; i < 10; ++i)
+    {
+      r *= r;
+      q *= q;
+      ASSERT(r.to_mpq() == q);
+    }
+    ASSERT(!r.is_small());
+    Dout(dc::notice, "SUCCESS.");
+  }
 }
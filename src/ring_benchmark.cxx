@@ -0,0 +1,112 @@
+#include "sys.h"
+#include "EntangledState.h"
+#include "QuBitRing.h"
+#include "QuBitModular.h"
+#include "QuBitComplex.h"
+#include "Gates.h"
+#include "GmpMemory.h"
+#include "debug.h"
+#include <chrono>
+#include <iostream>
+
+using namespace quantum;
+
+// Benchmark BasicEntangledState<QuBitField> against BasicEntangledState<QuBitRing>,
+// BasicEntangledState<QuBitModular> and (inexact) BasicEntangledState<QuBitComplex> on a T-heavy circuit.
+//
+// Each layer applies H to every qubit, followed by T, S, T_inv and T on every qubit
+// and finally a CNOT between each pair of neighboring qubits.
+//
+// The QuBitField run is done with GmpMemory::counting and repeated with GmpMemory::pooled,
+// to show how many calls to malloc the pool saves.
+
+template<typename Scalar>
+struct Gates
+{
+  using matrix_type = typename BasicEntangledState<Scalar>::matrix_type;
+  using matrixX_type = typename BasicEntangledState<Scalar>::matrixX_type;
+
+  std::vector<GateMatrix<matrix_type>> gate;
+  GateMatrix<matrixX_type> Controlled_X;
+
+  Gates() : Controlled_X(gates::Controlled_X.cast<Scalar>())
+  {
+    for (int g = 0; g < gates::number_of_gates; ++g)
+      gate.emplace_back(quantum::gate[g].template cast<Scalar>());
+  }
+};
+
+template<typename Scalar>
+BasicEntangledState<Scalar> run(int number_of_qubits, int number_of_layers, double& seconds)
+{
+  Gates<Scalar> const g;
+  auto start = std::chrono::steady_clock::now();
+  BasicEntangledState<Scalar> state{q_index_type{0}};
+  for (int q = 1; q < number_of_qubits; ++q)
+    state.merge(BasicEntangledState<Scalar>{q_index_type{static_cast<std::size_t>(q)}});
+  for (int layer = 0; layer < number_of_layers; ++layer)
+  {
+    for (int q = 0; q < number_of_qubits; ++q)
+    {
+      q_index_type const chain{static_cast<std::size_t>(q)};
+      state.apply(g.gate[gates::H], chain);
+      state.apply(g.gate[gates::T], chain);
+      state.apply(g.gate[gates::S], chain);
+      state.apply(g.gate[gates::T_inv], chain);
+      state.apply(g.gate[gates::T], chain);
+    }
+    for (int q = 0; q + 1 < number_of_qubits; ++q)
+    {
+      InputCollector collector;
+      collector.add(q_index_type{static_cast<std::size_t>(q)}, 0);      // Normal input.
+      collector.add(q_index_type{static_cast<std::size_t>(q + 1)}, 1);  // Control input.
+      state.apply(g.Controlled_X, collector);
+    }
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return state;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int const number_of_layers = argc > 2 ? std::atoi(argv[2]) : 4;
+  int const max_qubits = argc > 1 ? std::atoi(argv[1]) : 12;
+
+  for (int number_of_qubits = 4; number_of_qubits <= max_qubits; number_of_qubits += 2)
+  {
+    double field_seconds, pooled_seconds, ring_seconds, modular_seconds, complex_seconds;
+    GmpMemory::set_mode(GmpMemory::counting);
+    GmpMemory::reset_counters();
+    auto field_state = run<QuBitField>(number_of_qubits, number_of_layers, field_seconds);
+    GmpMemory::Counters const counting = GmpMemory::counters();
+    GmpMemory::set_mode(GmpMemory::pooled);
+    GmpMemory::reset_counters();
+    auto pooled_state = run<QuBitField>(number_of_qubits, number_of_layers, pooled_seconds);
+    GmpMemory::Counters const pooled = GmpMemory::counters();
+    GmpMemory::set_mode(GmpMemory::gmp_default);
+    auto ring_state = run<QuBitRing>(number_of_qubits, number_of_layers, ring_seconds);
+    auto modular_state = run<QuBitModular>(number_of_qubits, number_of_layers, modular_seconds);
+    auto complex_state = run<QuBitComplex>(number_of_qubits, number_of_layers, complex_seconds);
+
+    // All must give exactly the same result (QuBitComplex up to rounding errors).
+    ASSERT(field_state.number_of_coefficients() == ring_state.number_of_coefficients());
+    for (unsigned long i = 0; i < field_state.number_of_coefficients(); ++i)
+    {
+      QuBitField const field_coefficient = field_state.coefficient(i);
+      ASSERT(pooled_state.coefficient(i) == field_coefficient);
+      QuBitRing const ring_coefficient = ring_state.coefficient(i);
+      ASSERT(ring_coefficient.to_field() == field_coefficient && QuBitRing(field_coefficient) == ring_coefficient);
+      ASSERT(modular_state.coefficient(i).to_field() == field_coefficient);
+      ASSERT((complex_state.coefficient(i) - QuBitComplex(field_coefficient)).is_zero());
+    }
+
+    std::cout << number_of_qubits << " qubits, " << number_of_layers << " layers: QuBitField: " << field_seconds <<
+      " s, QuBitRing: " << ring_seconds << " s (speed up " << (field_seconds / ring_seconds) << "), QuBitModular: " <<
+      modular_seconds << " s (speed up " << (field_seconds / modular_seconds) << "), QuBitComplex: " << complex_seconds << " s." << std::endl;
+    std::cout << "  GMP allocations: " << (counting.allocations + counting.reallocations) <<
+      " (" << ((counting.allocations + counting.reallocations) / field_seconds) << " per s); calls to malloc: " <<
+      counting.mallocs << " without pool, " << pooled.mallocs << " with pool (QuBitField with pool: " << pooled_seconds << " s)." << std::endl;
+  }
+}